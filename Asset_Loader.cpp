@@ -0,0 +1,249 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// asset pipeline: files are read and decoded on the worker pool while the
+// first frames are drawn; the GL thread only uploads, and only once a draw
+// mode actually needs the result
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Asset_Loader.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+// created in main.cpp
+
+extern GLuint objprogramID;
+extern GLuint objMatrixID;
+extern GLuint objViewMatrixID;
+extern GLuint objModelMatrixID;
+extern GLuint objTextureID;
+extern GLuint objLightID;
+
+extern MeshCache obj_mesh;
+extern float obj_scale;
+extern GLsizei obj_num_indices;
+extern GLenum obj_index_type;
+extern GLuint obj_Texture;
+extern GLuint pred_Texture;
+extern GLuint obj_vertexbuffer;
+extern GLuint obj_uvbuffer;
+extern GLuint obj_normalbuffer;
+extern GLuint obj_elementbuffer;
+
+// what the reads produce, and how many are still going
+
+struct Pending_Assets
+{
+  string obj_path;
+  string obj_texture_path;
+  string pred_texture_path;
+  bool is_obj_texture_bmp;
+
+  bool is_mesh_ok;
+  TextureImage obj_texture;
+  TextureImage pred_texture;
+  bool is_obj_texture_ok;
+  bool is_pred_texture_ok;
+
+  int num_reads_left;
+  bool is_uploaded;
+};
+
+static Pending_Assets pending;
+static mutex pending_mutex;
+static condition_variable pending_cv;
+
+//----------------------------------------------------------------------------
+
+static void finish_read()
+{
+  lock_guard<mutex> lock(pending_mutex);
+
+  pending.num_reads_left--;
+  pending_cv.notify_all();
+}
+
+//----------------------------------------------------------------------------
+
+// queue the reads and return -- nothing here touches GL
+
+void start_loading_assets(int argc, char **argv)
+{
+  pending.obj_texture_path = "uvmap.DDS";
+  pending.pred_texture_path = "inverse.DDS";
+  pending.is_obj_texture_bmp = false;
+
+  if (argc == 1 || !strcmp("cube", argv[1]))
+    pending.obj_path = "cube.obj";
+  else if (!strcmp("suzanne", argv[1]))
+    pending.obj_path = "suzanne.obj";
+  else if (!strcmp("banana", argv[1])) {
+    pending.obj_path = "banana.obj";
+    pending.obj_texture_path = "banana.bmp";
+    pending.is_obj_texture_bmp = true;
+  }
+  else {
+    printf("unsupported object\n");
+    exit(1);
+  }
+
+  // if not doing bullet demo, scale down objects to creature size -- kind of eye-balled this
+
+  if (argc < 3)
+    obj_scale = 0.15;
+
+  pending.is_mesh_ok = pending.is_obj_texture_ok = pending.is_pred_texture_ok = false;
+  pending.is_uploaded = false;
+  pending.num_reads_left = 3;
+
+  Thread_Pool *pool = get_thread_pool();
+
+  // indexed mesh straight from the compiled cache (built from the .obj the first time)
+
+  pool->submit([] {
+      pending.is_mesh_ok = loadMeshCached(pending.obj_path.c_str(), obj_mesh);
+      finish_read();
+    });
+  pool->submit([] {
+      if (pending.is_obj_texture_bmp)
+	pending.is_obj_texture_ok = readBMP(pending.obj_texture_path.c_str(), pending.obj_texture);
+      else
+	pending.is_obj_texture_ok = readDDS(pending.obj_texture_path.c_str(), pending.obj_texture);
+      finish_read();
+    });
+  pool->submit([] {
+      pending.is_pred_texture_ok = readDDS(pending.pred_texture_path.c_str(), pending.pred_texture);
+      finish_read();
+    });
+}
+
+//----------------------------------------------------------------------------
+
+// help out with queued tasks while waiting -- with no workers (one core) the
+// reads only ever run on this thread
+
+static void wait_for_reads()
+{
+  Thread_Pool *pool = get_thread_pool();
+
+  while (true) {
+    {
+      lock_guard<mutex> lock(pending_mutex);
+      if (pending.num_reads_left == 0)
+	return;
+    }
+
+    if (!pool->run_pending_task()) {
+      unique_lock<mutex> lock(pending_mutex);
+      pending_cv.wait(lock, [] { return pending.num_reads_left == 0; });
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+
+void require_obj_mesh()
+{
+  wait_for_reads();
+
+  if (!pending.is_mesh_ok) {
+    printf("could not load %s\n", pending.obj_path.c_str());
+    exit(1);
+  }
+}
+
+//----------------------------------------------------------------------------
+
+bool are_obj_assets_uploaded()
+{
+  return pending.is_uploaded;
+}
+
+//----------------------------------------------------------------------------
+
+const char *get_obj_path()
+{
+  return pending.obj_path.c_str();
+}
+
+//----------------------------------------------------------------------------
+
+// GL thread.  the first call pays for the uploads (and the shader); later
+// ones return right away
+
+void require_obj_assets()
+{
+  if (pending.is_uploaded)
+    return;
+
+  double t_start = get_monotonic_time();
+
+  require_obj_mesh();
+
+  if (!pending.is_obj_texture_ok)
+    printf("could not load %s\n", pending.obj_texture_path.c_str());
+  if (!pending.is_pred_texture_ok)
+    printf("could not load %s\n", pending.pred_texture_path.c_str());
+
+  obj_Texture = pending.is_obj_texture_ok ? uploadTexture(pending.obj_texture) : 0;
+  pred_Texture = pending.is_pred_texture_ok ? uploadTexture(pending.pred_texture) : 0;
+
+  // decoded copies aren't needed once GL has them
+
+  vector<unsigned char>().swap(pending.obj_texture.data);
+  vector<unsigned char>().swap(pending.pred_texture.data);
+
+  obj_num_indices = obj_mesh.lod_num_indices[0];   // the full mesh; the flock picks coarser levels itself
+  obj_index_type = obj_mesh.index_size == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+
+  // Load into array buffers
+
+  glGenBuffers(1, &obj_vertexbuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, obj_vertexbuffer);
+  glBufferData(GL_ARRAY_BUFFER, obj_mesh.num_vertices * sizeof(glm::vec3), obj_mesh.vertices, GL_STATIC_DRAW);
+
+  glGenBuffers(1, &obj_uvbuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, obj_uvbuffer);
+  glBufferData(GL_ARRAY_BUFFER, obj_mesh.num_vertices * sizeof(glm::vec2), obj_mesh.uvs, GL_STATIC_DRAW);
+
+  glGenBuffers(1, &obj_normalbuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, obj_normalbuffer);
+  glBufferData(GL_ARRAY_BUFFER, obj_mesh.num_vertices * sizeof(glm::vec3), obj_mesh.normals, GL_STATIC_DRAW);
+
+  // Generate a buffer for the indices as well
+
+  glGenBuffers(1, &obj_elementbuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj_elementbuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj_mesh.num_indices * obj_mesh.index_size, obj_mesh.indices, GL_STATIC_DRAW);
+
+  // obj rendering mode uses shaders that came with bullet demo program
+
+  objprogramID = LoadShaders( "StandardShading.vertexshader", "StandardShading.fragmentshader" );
+
+  objMatrixID = glGetUniformLocation(objprogramID, "MVP");
+  objViewMatrixID = glGetUniformLocation(objprogramID, "V");
+  objModelMatrixID = glGetUniformLocation(objprogramID, "M");
+
+  objTextureID  = glGetUniformLocation(objprogramID, "myTextureSampler");
+  objLightID = glGetUniformLocation(objprogramID, "LightPosition_worldspace");
+
+  pending.is_uploaded = true;
+
+  printf("obj assets ready in %.1f ms\n", 1000.0 * (get_monotonic_time() - t_start));
+}
+
+//----------------------------------------------------------------------------
+
+void finish_loading_assets()
+{
+  wait_for_reads();
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
@@ -0,0 +1,53 @@
+#ifndef ASSET_LOADER_HH
+
+#define ASSET_LOADER_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// asset pipeline: files are read and decoded on the worker pool while the
+// first frames are drawn; the GL thread only uploads, and only once a draw
+// mode actually needs the result
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <common/shader.hpp>
+#include <common/texture.hpp>
+#include <common/meshcache.hpp>
+
+#include "Thread_Pool.hh"
+#include "Frame_Scheduler.hh"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+void start_loading_assets(int, char **);   // picks the object from argv; returns right away
+
+void require_obj_mesh();                    // block until the mesh is in memory (physics hull)
+void require_obj_assets();                  // ...and mesh, textures, shader are on the GPU (OBJ drawing)
+bool are_obj_assets_uploaded();
+const char *get_obj_path();                 // the .obj being used -- derived caches live next to it
+
+void finish_loading_assets();               // wait for stray reads before teardown
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef BULLET_POOL_HH
+
+#define BULLET_POOL_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// arena for the physics objects: rigid bodies, motion states and shapes are
+// constructed in place in a few big 16-byte aligned blocks, stay put until
+// the whole pool is cleared, and are then destroyed and freed in one go
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <vector>
+#include <utility>
+#include <new>
+
+#include <LinearMath/btAlignedAllocator.h>
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define BULLET_POOL_ALIGNMENT        16       // what Bullet's ATTRIBUTE_ALIGNED16 classes need
+#define BULLET_POOL_MIN_BLOCK        64       // objects in the first block, if reserve() wasn't called
+
+//----------------------------------------------------------------------------
+
+template <class T>
+class Bullet_Pool
+{
+public:
+
+  vector <T *> blocks;                      // never moved or shrunk, so pointers into them are stable
+  vector <int> block_sizes;
+  int num_objects;                          // constructed so far, filling the blocks in order
+  int capacity;                             // all blocks together
+
+  Bullet_Pool() { fill_block = fill_index = num_objects = capacity = 0; }
+  ~Bullet_Pool() { clear(); }
+
+  // room for n objects in all, as one new block for whatever is missing --
+  // a session that reserves up front gets its objects side by side
+
+  void reserve(int n)
+  {
+    if (n <= capacity)
+      return;
+
+    blocks.push_back((T *) btAlignedAlloc((n - capacity) * sizeof(T), BULLET_POOL_ALIGNMENT));
+    block_sizes.push_back(n - capacity);
+    capacity = n;
+  }
+
+  // construct one object in the next free slot
+
+  template <class ... Args>
+  T *create(Args && ... args)
+  {
+    if (num_objects == capacity)
+      reserve(capacity ? 2 * capacity : BULLET_POOL_MIN_BLOCK);
+
+    while (fill_index == block_sizes[fill_block]) {
+      fill_block++;
+      fill_index = 0;
+    }
+
+    T *object = new (blocks[fill_block] + fill_index) T(std::forward<Args>(args)...);
+    fill_index++;
+    num_objects++;
+
+    return object;
+  }
+
+  // destroy every object and give all of the memory back
+
+  void clear()
+  {
+    int remaining = num_objects;
+
+    for (int b = 0; b < blocks.size(); b++) {
+      int n = remaining < block_sizes[b] ? remaining : block_sizes[b];
+      for (int i = 0; i < n; i++)
+	blocks[b][i].~T();
+      remaining -= n;
+      btAlignedFree(blocks[b]);
+    }
+
+    blocks.clear();
+    block_sizes.clear();
+    fill_block = fill_index = num_objects = capacity = 0;
+  }
+
+private:
+
+  int fill_block;                           // where create() puts the next object
+  int fill_index;
+
+  Bullet_Pool(const Bullet_Pool &);         // owns its blocks -- no copies
+  Bullet_Pool & operator=(const Bullet_Pool &);
+};
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,110 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// multithreaded Bullet: a task scheduler that hands Bullet's parallel loops
+// to the same worker pool the flocking step and renderer use.  needs a
+// Bullet (2.88 or later) built with BT_THREADSAFE=1
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Bullet_Threads.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+Pool_Task_Scheduler::Pool_Task_Scheduler(Thread_Pool *_pool) : btITaskScheduler("Thread_Pool")
+{
+  pool = _pool;
+  num_threads = getMaxNumThreads();
+}
+
+//----------------------------------------------------------------------------
+
+int Pool_Task_Scheduler::getMaxNumThreads() const
+{
+  int n = pool->num_threads();
+
+  return n < BT_MAX_THREAD_COUNT ? n : BT_MAX_THREAD_COUNT;
+}
+
+//----------------------------------------------------------------------------
+
+int Pool_Task_Scheduler::getNumThreads() const
+{
+  return num_threads;
+}
+
+//----------------------------------------------------------------------------
+
+// the pool itself stays the same size -- fewer threads just means fewer,
+// bigger chunks, so that no more than n of them run at once
+
+void Pool_Task_Scheduler::setNumThreads(int n)
+{
+  int max_threads = getMaxNumThreads();
+
+  num_threads = n < 1 ? 1 : (n > max_threads ? max_threads : n);
+}
+
+//----------------------------------------------------------------------------
+
+void Pool_Task_Scheduler::parallelFor(int begin, int end, int grain, const btIParallelForBody & body)
+{
+  if (num_threads < pool->num_threads()) {
+    int min_grain = (end - begin + num_threads - 1) / num_threads;
+    if (grain < min_grain)
+      grain = min_grain;
+  }
+
+  pool->parallel_for(begin, end, grain, [&body](int chunk_begin, int chunk_end, int chunk) {
+      body.forLoop(chunk_begin, chunk_end);
+    });
+}
+
+//----------------------------------------------------------------------------
+
+// one partial sum per chunk, added up in chunk order so the result doesn't
+// depend on which thread finished first
+
+btScalar Pool_Task_Scheduler::parallelSum(int begin, int end, int grain, const btIParallelSumBody & body)
+{
+  if (num_threads < pool->num_threads()) {
+    int min_grain = (end - begin + num_threads - 1) / num_threads;
+    if (grain < min_grain)
+      grain = min_grain;
+  }
+
+  vector <btScalar> sums(pool->num_chunks(begin, end, grain), btScalar(0));
+
+  pool->parallel_for(begin, end, grain, [&body, &sums](int chunk_begin, int chunk_end, int chunk) {
+      sums[chunk] = body.sumLoop(chunk_begin, chunk_end);
+    });
+
+  btScalar total = 0;
+  for (int c = 0; c < sums.size(); c++)
+    total += sums[c];
+
+  return total;
+}
+
+//----------------------------------------------------------------------------
+
+// created on first use, lives until exit -- like the pool it runs on
+
+Pool_Task_Scheduler *get_bullet_task_scheduler()
+{
+  static Pool_Task_Scheduler *scheduler = NULL;
+
+  if (!scheduler) {
+    scheduler = new Pool_Task_Scheduler(get_thread_pool());
+    btSetTaskScheduler(scheduler);
+  }
+
+  return scheduler;
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
@@ -0,0 +1,57 @@
+#ifndef BULLET_THREADS_HH
+
+#define BULLET_THREADS_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// multithreaded Bullet: a task scheduler that hands Bullet's parallel loops
+// to the same worker pool the flocking step and renderer use.  needs a
+// Bullet (2.88 or later) built with BT_THREADSAFE=1
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <btBulletDynamicsCommon.h>
+#include <LinearMath/btThreads.h>
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+
+#include "Thread_Pool.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define BULLET_MT_DISPATCH_GRAIN     40     // collision pairs per narrowphase task
+#define BULLET_MT_POOL_SIZE          80000  // persistent manifolds / collision algorithms preallocated
+
+//----------------------------------------------------------------------------
+
+class Pool_Task_Scheduler : public btITaskScheduler
+{
+public:
+
+  Thread_Pool *pool;
+  int num_threads;                          // at most this many pool threads work on one loop
+
+  Pool_Task_Scheduler(Thread_Pool *);
+
+  virtual int getMaxNumThreads() const;
+  virtual int getNumThreads() const;
+  virtual void setNumThreads(int);
+
+  virtual void parallelFor(int, int, int, const btIParallelForBody &);
+  virtual btScalar parallelSum(int, int, int, const btIParallelSumBody &);
+};
+
+//----------------------------------------------------------------------------
+
+Pool_Task_Scheduler *get_bullet_task_scheduler();   // installed with btSetTaskScheduler() on first use
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
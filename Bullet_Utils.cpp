@@ -13,6 +13,8 @@
 #include "Bullet_Utils.hh"
 #include "Flocker.hh"
 #include "Predator.hh"
+#include "Asset_Loader.hh"
+#include "Flock_World.hh"
 
 using namespace std;
 
@@ -29,22 +31,21 @@ extern GLuint objModelMatrixID;
 extern GLuint objTextureID;
 extern GLuint objLightID;
 
-extern vector<glm::vec3> obj_vertices;
-extern vector<glm::vec2> obj_uvs;
-extern vector<glm::vec3> obj_normals;
+extern MeshCache obj_mesh;
+extern float obj_scale;
+extern GLsizei obj_num_indices;
+extern GLenum obj_index_type;
 extern GLuint obj_Texture;
-extern vector<unsigned short> obj_indices;
-extern vector<glm::vec3> obj_indexed_vertices;
-extern vector<glm::vec2> obj_indexed_uvs;
-extern vector<glm::vec3> obj_indexed_normals;
 extern GLuint obj_vertexbuffer;
 extern GLuint obj_uvbuffer;
 extern GLuint obj_normalbuffer;
 extern GLuint obj_elementbuffer;
 extern int num_flockers;
-extern vector <Flocker *> flocker_array;
+extern vector <Flocker *> & flocker_array;
 extern int num_predators;
-extern vector <Predator *> predator_array;
+extern vector <Predator *> & predator_array;
+extern vector <vector <double> > & flocker_squared_distance;
+extern vector <vector <double> > & p_to_f_squared_distance;
 
 int num_creatures = num_predators + num_flockers;
 int velocity_scale = 35;
@@ -58,11 +59,29 @@ btSequentialImpulseConstraintSolver* bullet_solver;
 btBroadphaseInterface* bullet_broadphase;
 btDefaultCollisionConfiguration* bullet_collisionConfiguration;
 btCollisionDispatcher* bullet_dispatcher;
-vector<btRigidBody*> bullet_rigidbodies;   // bullet side
-
-vector<glm::vec3> xyz_positions;        // ogl side
-vector<glm::vec3> xyz_velocities;
-vector<glm::quat> quat_orientations;     // ogl side
+btConstraintSolverPoolMt* bullet_solver_pool;   // multithreaded world only
+bool is_bullet_multithreaded = false;       // build btDiscreteDynamicsWorldMt on the worker pool
+bool is_hybrid_active = false;              // flock and collide at the same time
+int bullet_broadphase_type = BROADPHASE_DBVT;
+bool is_bullet_sleep_enabled = true;        // resting islands stop being simulated until something touches them
+int num_awake_bodies = 0;                   // as of the last step
+int num_sleeping_bodies = 0;
+vector<btRigidBody*> bullet_rigidbodies;   // bullet side -- a pool; only the first num_creatures are in the world
+int num_bodies_in_world = 0;
+
+vector<btRigidBody*> bullet_obstacles;
+
+// every body, motion state and obstacle shape lives in one of these until
+// delete_bullet_simulator() -- the creatures' bodies side by side
+
+Bullet_Pool<btRigidBody> bullet_creature_body_pool;
+Bullet_Pool<Creature_Motion_State> bullet_creature_motion_state_pool;
+Bullet_Pool<btRigidBody> bullet_obstacle_body_pool;
+Bullet_Pool<btDefaultMotionState> bullet_obstacle_motion_state_pool;
+Bullet_Pool<btStaticPlaneShape> bullet_obstacle_shape_pool;
+
+btConvexHullShape* bullet_creature_shape = NULL;   // simplified hull, shared by every creature
+btVector3 bullet_creature_inertia;
 
 float initialCameraZ = 25.0;
 
@@ -83,76 +102,71 @@ bool isRestarting = false;
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
 
-// get information FROM flocker objects
-// note that orientations are NOT currently taken from flocker -- they are random
+Creature_Motion_State::Creature_Motion_State()
+{
+  creature = NULL;
+}
+
+//----------------------------------------------------------------------------
+
+// where the body starts -- Bullet only asks when the body is created or reset
 
-void copy_flocker_states_to_graphics_objects()
+void Creature_Motion_State::getWorldTransform(btTransform & trans) const
 {
-  xyz_positions.resize(num_creatures);
-  xyz_velocities.resize(num_creatures);
-  quat_orientations.resize(num_creatures);
-
-  for (int i = 0; i < num_flockers; i++) {
-    xyz_positions[i] = glm::vec3(flocker_array[i]->position.x, flocker_array[i]->position.y, flocker_array[i]->position.z);
-    xyz_velocities[i] = glm::vec3(flocker_array[i]->velocity.x * velocity_scale, flocker_array[i]->velocity.y * velocity_scale, flocker_array[i]->velocity.z * velocity_scale);
-    quat_orientations[i] = glm::normalize(glm::quat(glm::vec3(drand48() * 360.0, drand48() * 360.0, drand48() * 360.0)));
-  }
-  for (int i = 0; i < num_predators; i++) {
-    xyz_positions[i + num_flockers] = glm::vec3(predator_array[i]->position.x, predator_array[i]->position.y, predator_array[i]->position.z);
-    xyz_velocities[i + num_flockers] = glm::vec3(flocker_array[i]->velocity.x * velocity_scale, flocker_array[i]->velocity.y * velocity_scale, flocker_array[i]->velocity.z * velocity_scale);
-    quat_orientations[i + num_flockers] = glm::normalize(glm::quat(glm::vec3(drand48() * 360.0, drand48() * 360.0, drand48() * 360.0)));
+  if (!creature) {
+    trans.setIdentity();
+    return;
   }
+
+  trans = btTransform(btQuaternion(creature->orientation.x, creature->orientation.y, creature->orientation.z, creature->orientation.w),
+		      btVector3(creature->position.x, creature->position.y, creature->position.z));
 }
 
 //----------------------------------------------------------------------------
 
-// move information TO flocker objects
-// orientations are not touched
+// called from stepSimulation() for active bodies only (possibly on several
+// worker threads at once in the multithreaded world -- each body has its own creature)
 
-void copy_graphics_objects_to_flocker_states()
-{  
-  for (int i = 0; i < num_flockers; i++) {
-    flocker_array[i]->position.x = xyz_positions[i].x;
-    flocker_array[i]->position.y = xyz_positions[i].y;
-    flocker_array[i]->position.z = xyz_positions[i].z;
-  }
-  for (int i = 0; i < num_predators; i++) {
-    predator_array[i]->position.x = xyz_positions[i + num_flockers].x;
-    predator_array[i]->position.y = xyz_positions[i + num_flockers].y;
-    predator_array[i]->position.z = xyz_positions[i + num_flockers].z;
-  }
+void Creature_Motion_State::setWorldTransform(const btTransform & trans)
+{
+  const btVector3 & origin = trans.getOrigin();
+  btQuaternion rotation = trans.getRotation();
+
+  creature->position = glm::vec3(origin.getX(), origin.getY(), origin.getZ());
+  creature->orientation = glm::quat(rotation.getW(), rotation.getX(), rotation.getY(), rotation.getZ());
 }
 
 //----------------------------------------------------------------------------
 
-// only the ground plane for now
+// one infinite static plane through point, facing along normal
 
-void bullet_add_obstacles()
+static void bullet_add_plane(btVector3 normal, btVector3 point)
 {
-  // add the ground plane (not drawn)
+  btCollisionShape* planeShape = bullet_obstacle_shape_pool.create(normal, 0);
 
-  btCollisionShape* groundShape = new btStaticPlaneShape(btVector3(0, 1, 0), 0);
+  btDefaultMotionState* planeMotionState = bullet_obstacle_motion_state_pool.create(btTransform(btQuaternion(0, 0, 0, 1), point));
+  btRigidBody::btRigidBodyConstructionInfo planeRigidBodyCI(0, planeMotionState, planeShape, btVector3(0, 0, 0));
+  btRigidBody* planeRigidBody = bullet_obstacle_body_pool.create(planeRigidBodyCI);
+  bullet_dynamicsWorld->addRigidBody(planeRigidBody);
+  bullet_obstacles.push_back(planeRigidBody);
+}
 
-  btDefaultMotionState* groundMotionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(0, 0, 0)));
-  btRigidBody::btRigidBodyConstructionInfo groundRigidBodyCI(0, groundMotionState, groundShape, btVector3(0, 0, 0));
-  btRigidBody* groundRigidBody = new btRigidBody(groundRigidBodyCI);
-  bullet_dynamicsWorld->addRigidBody(groundRigidBody);
-  
-  // add left wall
-  
-  btCollisionShape* leftWallShape = new btStaticPlaneShape(btVector3(1, 0, 0), 0);
+//----------------------------------------------------------------------------
 
-  btDefaultMotionState* leftWallMotionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(0, 0, 0)));
-  btRigidBody::btRigidBodyConstructionInfo leftWallRigidBodyCI(0, leftWallMotionState, leftWallShape, btVector3(0, 0, 0));
-  btRigidBody* leftWallRigidBody = new btRigidBody(leftWallRigidBodyCI);
-  bullet_dynamicsWorld->addRigidBody(leftWallRigidBody);
-  
-  btCollisionShape* rightWallShape = new btStaticPlaneShape(btVector3(-1, 0, 0), 0);
+// the six sides of the box (not drawn), all facing in
 
-  btDefaultMotionState* rightWallMotionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(9, 0, 0)));
-  btRigidBody::btRigidBodyConstructionInfo rightWallRigidBodyCI(0, rightWallMotionState, rightWallShape, btVector3(0, 0, 0));
-  btRigidBody* rightWallRigidBody = new btRigidBody(rightWallRigidBodyCI);
-  bullet_dynamicsWorld->addRigidBody(rightWallRigidBody);
+void bullet_add_obstacles()
+{
+  bullet_obstacle_shape_pool.reserve(6);
+  bullet_obstacle_motion_state_pool.reserve(6);
+  bullet_obstacle_body_pool.reserve(6);
+
+  bullet_add_plane(btVector3(0, 1, 0), btVector3(0, 0, 0));                     // ground
+  bullet_add_plane(btVector3(0, -1, 0), btVector3(0, box_height, 0));           // ceiling
+  bullet_add_plane(btVector3(1, 0, 0), btVector3(0, 0, 0));                     // left wall
+  bullet_add_plane(btVector3(-1, 0, 0), btVector3(box_width, 0, 0));            // right wall
+  bullet_add_plane(btVector3(0, 0, 1), btVector3(0, 0, 0));                     // back wall
+  bullet_add_plane(btVector3(0, 0, -1), btVector3(0, 0, box_depth));            // front wall
 }
 
 //----------------------------------------------------------------------------
@@ -163,10 +177,8 @@ void bullet_add_obstacles()
 
 void randomize_graphics_objects()
 {
-  for (int i = 0; i < num_flockers; i++) {
-    xyz_positions[i] = glm::vec3(drand48() * box_width, drand48() * box_height, drand48() * box_depth);
-    quat_orientations[i] = glm::normalize(glm::quat(glm::vec3(drand48() * 360.0, drand48() * 360.0, drand48() * 360.0)));
-  }
+  for (int i = 0; i < num_flockers; i++)
+    flocker_array[i]->position = glm::vec3(drand48() * box_width, drand48() * box_height, drand48() * box_depth);
 }
 
 //----------------------------------------------------------------------------
@@ -217,9 +229,8 @@ void myComputeMatricesFromInputs()
     if (!isRestarting) {
       isRestarting = true;
       printf("randomize!\n");
-      delete_bullet_simulator();
       randomize_graphics_objects();
-      initialize_bullet_simulator();
+      reset_bullet_simulator();
     }
   }
 
@@ -241,83 +252,436 @@ void myComputeMatricesFromInputs()
 
 //----------------------------------------------------------------------------
 
-// add all of the moveable objects.
-// quat_orientations, xyz_positions should already be set
+// the hull depends only on the mesh vertices, the scale they are drawn at and
+// the collision margin -- hash all three
 
-void bullet_add_dynamic_objects()
+static uint64_t hull_cache_key(btScalar margin)
 {
-  // from here: http://bulletphysics.org/mediawiki-1.5.8/index.php/Simple_RigidBody_loaded_from_an_obj_file
-  
-  btConvexHullShape* chShape = new btConvexHullShape();
-  for (int i = 0; i < obj_vertices.size(); i++) 
-    chShape->addPoint(btVector3(obj_vertices[i].x, obj_vertices[i].y, obj_vertices[i].z));
-  chShape->initializePolyhedralFeatures();
-  
-  // optimizeConvexHull() from link above does not work here, so simplifying in the following way:
-  // http://www.bulletphysics.org/mediawiki-1.5.8/index.php?title=BtShapeHull_vertex_reduction_utility
-  
-  btShapeHull *hull = new btShapeHull(chShape);
-  btScalar margin = chShape->getMargin();
-  hull->buildHull(margin);
-  btConvexHullShape* simplifiedShape = new btConvexHullShape();
-  printf("%i before, %i after\n", (int) obj_vertices.size(), (int) hull->numVertices());
-  for (int i = 0; i < hull->numVertices(); i++) 
-    simplifiedShape->addPoint(hull->getVertexPointer()[i]);
+  uint64_t key = 14695981039346656037ULL;   // FNV-1a
+
+  const unsigned char *bytes = (const unsigned char *) obj_mesh.vertices;
+  for (size_t i = 0; i < obj_mesh.num_vertices * sizeof(glm::vec3); i++)
+    key = (key ^ bytes[i]) * 1099511628211ULL;
+
+  float params[2] = { obj_scale, (float) margin };
+  bytes = (const unsigned char *) params;
+  for (size_t i = 0; i < sizeof(params); i++)
+    key = (key ^ bytes[i]) * 1099511628211ULL;
+
+  return key;
+}
+
+//----------------------------------------------------------------------------
+
+struct Hull_Cache_Header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_points;
+  uint32_t reserved;
+  uint64_t key;
+};
+
+static bool read_hull_cache(const string & path, uint64_t key, vector<btVector3> & points)
+{
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp)
+    return false;
+
+  Hull_Cache_Header header;
+  bool ok = fread(&header, sizeof(header), 1, fp) == 1
+    && header.magic == HULL_CACHE_MAGIC
+    && header.version == HULL_CACHE_VERSION
+    && header.key == key
+    && header.num_points > 0;
+
+  if (ok) {
+    vector<float> xyz(3 * header.num_points);
+    ok = fread(&xyz[0], sizeof(float), xyz.size(), fp) == xyz.size();
+    for (int i = 0; ok && i < header.num_points; i++)
+      points.push_back(btVector3(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]));
+  }
+
+  fclose(fp);
+  return ok;
+}
+
+// written under a temporary name and renamed, like the mesh cache
+
+static void write_hull_cache(const string & path, uint64_t key, const vector<btVector3> & points)
+{
+  Hull_Cache_Header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = HULL_CACHE_MAGIC;
+  header.version = HULL_CACHE_VERSION;
+  header.num_points = points.size();
+  header.key = key;
+
+  vector<float> xyz;
+  for (int i = 0; i < points.size(); i++) {
+    xyz.push_back(points[i].getX());
+    xyz.push_back(points[i].getY());
+    xyz.push_back(points[i].getZ());
+  }
+
+  char suffix[32];
+  sprintf(suffix, ".tmp%d", (int) getpid());
+  string temp_path = path + suffix;
+
+  FILE *fp = fopen(temp_path.c_str(), "wb");
+  if (!fp)
+    return;
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  ok = ok && fwrite(&xyz[0], sizeof(float), xyz.size(), fp) == xyz.size();
+  ok = fclose(fp) == 0 && ok;
+
+  if (!ok || rename(temp_path.c_str(), path.c_str()) != 0)
+    unlink(temp_path.c_str());
+}
+
+//----------------------------------------------------------------------------
+
+// collision shape for every creature: a simplified convex hull of the object.
+// built once per run, and read back from <object>.hull on later runs
+
+static btConvexHullShape *get_creature_shape()
+{
+  if (bullet_creature_shape)
+    return bullet_creature_shape;
+
+  bullet_creature_shape = new btConvexHullShape();
+  btScalar margin = bullet_creature_shape->getMargin();
+
+  string cache_path = string(get_obj_path()) + ".hull";
+  uint64_t key = hull_cache_key(margin);
+  vector<btVector3> points;
+
+  if (read_hull_cache(cache_path, key, points))
+    printf("Loaded hull cache %s (%i vertices)\n", cache_path.c_str(), (int) points.size());
+  else {
+
+    // from here: http://bulletphysics.org/mediawiki-1.5.8/index.php/Simple_RigidBody_loaded_from_an_obj_file
   
-  btScalar shapeMass = 1;  // in kg.  0 -> static object aka never moves
-  btVector3 simplifiedShapeInertia(1, 1, 1);   // if we leave it as all 0's -> treat like point mass -> no spin
-  simplifiedShape->calculateLocalInertia(shapeMass, simplifiedShapeInertia);
+    // unique (indexed) vertices, at the size they are drawn
+
+    btConvexHullShape* chShape = new btConvexHullShape();
+    for (int i = 0; i < obj_mesh.num_vertices; i++) 
+      chShape->addPoint(btVector3(obj_scale * obj_mesh.vertices[i].x, obj_scale * obj_mesh.vertices[i].y, obj_scale * obj_mesh.vertices[i].z), false);
+    chShape->recalcLocalAabb();
   
-  // put objects into physics simulation
+    // optimizeConvexHull() from link above does not work here, so simplifying in the following way:
+    // http://www.bulletphysics.org/mediawiki-1.5.8/index.php?title=BtShapeHull_vertex_reduction_utility
   
-  for (int i = 0; i < num_creatures; i++) {
-    
-    btDefaultMotionState* motionstate = new btDefaultMotionState(btTransform(btQuaternion(quat_orientations[i].x, quat_orientations[i].y, quat_orientations[i].z, quat_orientations[i].w), 
-									     btVector3(xyz_positions[i].x, xyz_positions[i].y, xyz_positions[i].z)));
+    btShapeHull *hull = new btShapeHull(chShape);
+    hull->buildHull(margin);
+    printf("%i before, %i after\n", (int) obj_mesh.num_vertices, (int) hull->numVertices());
+    for (int i = 0; i < hull->numVertices(); i++) 
+      points.push_back(hull->getVertexPointer()[i]);
+
+    delete hull;
+    delete chShape;
+
+    write_hull_cache(cache_path, key, points);
+  }
+
+  for (int i = 0; i < points.size(); i++) 
+    bullet_creature_shape->addPoint(points[i], false);
+  bullet_creature_shape->recalcLocalAabb();
+
+  bullet_creature_inertia = btVector3(1, 1, 1);   // if we leave it as all 0's -> treat like point mass -> no spin
+  bullet_creature_shape->calculateLocalInertia(CREATURE_MASS, bullet_creature_inertia);
+
+  return bullet_creature_shape;
+}
+
+//----------------------------------------------------------------------------
+
+// make sure there is a rigid body for each creature, and that exactly the
+// first num_creatures of them are in the world.  bodies are never freed
+// before teardown -- a later session just picks them up again.  a bigger
+// flock gets its extra bodies as one more block of the pools
+
+static void bullet_pool_dynamic_objects()
+{
+  btConvexHullShape *shape = get_creature_shape();
+
+  bullet_creature_body_pool.reserve(num_creatures);
+  bullet_creature_motion_state_pool.reserve(num_creatures);
+
+  while (bullet_rigidbodies.size() < num_creatures) {
+
+    Creature_Motion_State* motionstate = bullet_creature_motion_state_pool.create();
     
-    btRigidBody::btRigidBodyConstructionInfo rigidBodyCI(shapeMass,                
+    btRigidBody::btRigidBodyConstructionInfo rigidBodyCI(CREATURE_MASS,                
 							 motionstate,
-							 simplifiedShape,   // collision shape of body
-							 simplifiedShapeInertia);
-    
-    btRigidBody *rigidBody = new btRigidBody(rigidBodyCI);
+							 shape,   // collision shape of body
+							 bullet_creature_inertia);
     
+    btRigidBody *rigidBody = bullet_creature_body_pool.create(rigidBodyCI);
+    rigidBody->setSleepingThresholds(BULLET_SLEEP_LINEAR_SPEED, BULLET_SLEEP_ANGULAR_SPEED);
     bullet_rigidbodies.push_back(rigidBody);
-    rigidBody->setActivationState(DISABLE_DEACTIVATION);
-    rigidBody->setLinearVelocity(btVector3(xyz_velocities[i].x, xyz_velocities[i].y, xyz_velocities[i].z));
-    bullet_dynamicsWorld->addRigidBody(rigidBody);
+  }
+
+  for (int i = num_bodies_in_world; i < num_creatures; i++)
+    bullet_dynamicsWorld->addRigidBody(bullet_rigidbodies[i]);
+  for (int i = num_creatures; i < num_bodies_in_world; i++)
+    bullet_dynamicsWorld->removeRigidBody(bullet_rigidbodies[i]);
+
+  num_bodies_in_world = num_creatures;
+}
+
+//----------------------------------------------------------------------------
+
+int parse_broadphase(const char *name)
+{
+  for (int b = BROADPHASE_DBVT; b <= BROADPHASE_SAP32; b++)
+    if (!strcmp(name, get_broadphase_name(b)))
+      return b;
+
+  return -1;
+}
 
+//----------------------------------------------------------------------------
+
+const char *get_broadphase_name(int broadphase_type)
+{
+  if (broadphase_type == BROADPHASE_SAP)
+    return "sap";
+  else if (broadphase_type == BROADPHASE_SAP32)
+    return "sap32";
+  else
+    return "dbvt";
+}
+
+//----------------------------------------------------------------------------
+
+// hybrid mode: before each substep, run the flocking rules on where the bodies
+// really are and push each body with its steering as a central force.  every
+// pass is over independent creatures, so all of them go to the worker pool
+
+static void hybrid_tick_callback(btDynamicsWorld *world, btScalar timeStep)
+{
+  if (!is_hybrid_active)
+    return;
+
+  Thread_Pool *pool = get_thread_pool();
+
+  // the tables are sized for the flock they were made for
+
+  if (flocker_squared_distance.size() != num_flockers) {
+    flocker_squared_distance.resize(num_flockers);
+    for (int i = 0; i < num_flockers; i++)
+      flocker_squared_distance[i].resize(num_flockers);
+  }
+  if (p_to_f_squared_distance.size() != num_predators || (num_predators && p_to_f_squared_distance[0].size() != num_flockers)) {
+    p_to_f_squared_distance.resize(num_predators);
+    for (int i = 0; i < num_predators; i++)
+      p_to_f_squared_distance[i].resize(num_flockers);
+  }
+
+  // flocking units are per frame, Bullet's are per second
+
+  pool->parallel_for(0, num_creatures, HYBRID_GRAIN, [](int begin, int end, int chunk) {
+      for (int i = begin; i < end; i++) {
+	Creature *c = get_creature(i);
+	const btTransform & trans = bullet_rigidbodies[i]->getWorldTransform();
+	const btVector3 & v = bullet_rigidbodies[i]->getLinearVelocity();
+	c->position = glm::vec3(trans.getOrigin().getX(), trans.getOrigin().getY(), trans.getOrigin().getZ());
+	c->velocity = glm::vec3(v.getX(), v.getY(), v.getZ()) / (float) velocity_scale;
+      }
+    });
+
+  calculate_flocker_squared_distances(&flock_world);
+  calculate_p_to_f_squared_distances(&flock_world);
+
+  // steering is the change in velocity per flocking step, capped at the flocking
+  // speed limit like Flocker::update() does.  the random wander term is left
+  // out -- drand48() isn't thread-safe, and the contacts jostle the flock anyway
+
+  pool->parallel_for(0, num_creatures, HYBRID_GRAIN, [timeStep](int begin, int end, int chunk) {
+      btScalar max_speed = MAX_FLOCKER_SPEED * velocity_scale;
+      for (int i = begin; i < end; i++) {
+	Creature *c = get_creature(i);
+	c->compute_steering();
+
+	btRigidBody *rigidBody = bullet_rigidbodies[i];
+	btVector3 v = rigidBody->getLinearVelocity();
+	btVector3 a = btVector3(c->acceleration.x, c->acceleration.y, c->acceleration.z) * (velocity_scale * HYBRID_FLOCKING_RATE);
+	btVector3 new_v = v + a * timeStep;
+	btScalar speed = new_v.length();
+	if (speed > max_speed)
+	  a = (new_v * (max_speed / speed) - v) / timeStep;
+
+	// a sleeping body ignores forces -- wake it if the flock is pulling on it.
+	// only touches this body, so it's safe from any thread
+
+	if (!rigidBody->isActive() && a.length2() > HYBRID_WAKE_ACCELERATION * HYBRID_WAKE_ACCELERATION)
+	  rigidBody->activate();
+
+	rigidBody->clearForces();
+	rigidBody->applyCentralForce(a * CREATURE_MASS);
+      }
+    });
+}
+
+//----------------------------------------------------------------------------
+
+// switching while physics is running only needs the bodies' gravity changed
+// -- and them woken up, since gravity going away is news to a resting pile
+
+void set_bullet_hybrid(bool is_active)
+{
+  is_hybrid_active = is_active;
+
+  if (!bullet_dynamicsWorld)
+    return;
+
+  btVector3 gravity = is_hybrid_active ? btVector3(0, 0, 0) : bullet_dynamicsWorld->getGravity();
+  for (int i = 0; i < num_bodies_in_world; i++) {
+    bullet_rigidbodies[i]->setGravity(gravity);
+    bullet_rigidbodies[i]->activate();
   }
 }
 
 //----------------------------------------------------------------------------
 
+void print_bullet_stats(FILE *fp)
+{
+  fprintf(fp, "physics: %i bodies awake, %i sleeping\n", num_awake_bodies, num_sleeping_bodies);
+}
+
+//----------------------------------------------------------------------------
+
 // This strictly follows http://bulletphysics.org/mediawiki-1.5.8/index.php/Hello_World, 
+// but only the first time -- the world then stays around until delete_bullet_simulator()
 
 void initialize_bullet_simulator()
 {  
-  // Build the broadphase
-  
-  bullet_broadphase = new btDbvtBroadphase();
+  if (bullet_dynamicsWorld)
+    return;
+
+  // Build the broadphase.  the flock never leaves the box, so sweep and prune
+  // can be bounded by it (a little beyond, for bodies resting on the walls)
+
+  btVector3 world_min(-BULLET_WORLD_MARGIN, -BULLET_WORLD_MARGIN, -BULLET_WORLD_MARGIN);
+  btVector3 world_max(box_width + BULLET_WORLD_MARGIN, box_height + BULLET_WORLD_MARGIN, box_depth + BULLET_WORLD_MARGIN);
+
+  if (bullet_broadphase_type == BROADPHASE_SAP)
+    bullet_broadphase = new btAxisSweep3(world_min, world_max, BULLET_SAP_MAX_HANDLES);
+  else if (bullet_broadphase_type == BROADPHASE_SAP32)
+    bullet_broadphase = new bt32BitAxisSweep3(world_min, world_max);
+  else
+    bullet_broadphase = new btDbvtBroadphase();
   
-  // Set up the collision configuration and dispatcher
+  if (is_bullet_multithreaded) {
+
+    // same pieces, but the narrowphase, island solving and integration are
+    // split into tasks that run on the worker pool
+
+#if !BT_THREADSAFE
+    printf("Bullet was built without BT_THREADSAFE -- the multithreaded world will step on one thread\n");
+#endif
+
+    get_bullet_task_scheduler();
+
+    btDefaultCollisionConstructionInfo cci;
+    cci.m_defaultMaxPersistentManifoldPoolSize = BULLET_MT_POOL_SIZE;
+    cci.m_defaultMaxCollisionAlgorithmPoolSize = BULLET_MT_POOL_SIZE;
+
+    bullet_collisionConfiguration = new btDefaultCollisionConfiguration(cci);
+    bullet_dispatcher = new btCollisionDispatcherMt(bullet_collisionConfiguration, BULLET_MT_DISPATCH_GRAIN);
+
+    // one solver per thread for independent islands, plus a multithreaded one for big islands
+
+    bullet_solver_pool = new btConstraintSolverPoolMt(BT_MAX_THREAD_COUNT);
+    bullet_solver = new btSequentialImpulseConstraintSolverMt();
+
+    bullet_dynamicsWorld = new btDiscreteDynamicsWorldMt(bullet_dispatcher, bullet_broadphase, bullet_solver_pool, bullet_solver, bullet_collisionConfiguration);
+  }
+  else {
+
+    // Set up the collision configuration and dispatcher
   
-  bullet_collisionConfiguration = new btDefaultCollisionConfiguration();
-  bullet_dispatcher = new btCollisionDispatcher(bullet_collisionConfiguration);
+    bullet_collisionConfiguration = new btDefaultCollisionConfiguration();
+    bullet_dispatcher = new btCollisionDispatcher(bullet_collisionConfiguration);
   
-  // The actual physics solver
+    // The actual physics solver
   
-  bullet_solver = new btSequentialImpulseConstraintSolver;
+    bullet_solver = new btSequentialImpulseConstraintSolver;
   
-  // The world.
+    // The world.
   
-  bullet_dynamicsWorld = new btDiscreteDynamicsWorld(bullet_dispatcher, bullet_broadphase, bullet_solver, bullet_collisionConfiguration);
+    bullet_dynamicsWorld = new btDiscreteDynamicsWorld(bullet_dispatcher, bullet_broadphase, bullet_solver, bullet_collisionConfiguration);
+  }
+
   bullet_dynamicsWorld->setGravity(btVector3(0,-9.81f,0));
+  bullet_dynamicsWorld->setForceUpdateAllAabbs(false);    // sleeping bodies keep their AABBs
+  gDeactivationTime = BULLET_SLEEP_TIME;
+  bullet_dynamicsWorld->setInternalTickCallback(hybrid_tick_callback, NULL, true);   // before every substep
 
-  // the stuff in the world
+  // the stuff in the world that never moves
   
   bullet_add_obstacles();
-  bullet_add_dynamic_objects();
+}
+
+//----------------------------------------------------------------------------
+
+// start a physics session from the creatures' current positions and velocities,
+// with random orientations: bind the pooled bodies to the creatures, move them
+// there and forget every contact from last time.  nothing is allocated unless
+// there are more creatures than before
+
+void reset_bullet_simulator()
+{
+  initialize_bullet_simulator();
+
+  num_creatures = num_flockers + num_predators;
+
+  if (bullet_broadphase_type == BROADPHASE_SAP && num_creatures + bullet_obstacles.size() > BULLET_SAP_MAX_HANDLES) {
+    printf("%i bodies are too many for the 16-bit sweep-and-prune broadphase -- try --broadphase sap32\n", num_creatures);
+    exit(1);
+  }
+
+  bullet_pool_dynamic_objects();
+
+  for (int i = 0; i < num_creatures; i++) {
+
+    Creature *c = get_creature(i);
+    c->orientation = glm::normalize(glm::quat(glm::vec3(drand48() * 360.0, drand48() * 360.0, drand48() * 360.0)));
+
+    btRigidBody *rigidBody = bullet_rigidbodies[i];
+    Creature_Motion_State *motionstate = (Creature_Motion_State *) rigidBody->getMotionState();
+    motionstate->creature = c;
+
+    btTransform trans;
+    motionstate->getWorldTransform(trans);
+    btVector3 velocity(c->velocity.x * velocity_scale, c->velocity.y * velocity_scale, c->velocity.z * velocity_scale);
+
+    rigidBody->setWorldTransform(trans);
+    rigidBody->setInterpolationWorldTransform(trans);
+    rigidBody->setLinearVelocity(velocity);
+    rigidBody->setInterpolationLinearVelocity(velocity);
+    rigidBody->setAngularVelocity(btVector3(0, 0, 0));
+    rigidBody->setInterpolationAngularVelocity(btVector3(0, 0, 0));
+    rigidBody->setGravity(is_hybrid_active ? btVector3(0, 0, 0) : bullet_dynamicsWorld->getGravity());
+    rigidBody->clearForces();
+
+    // everybody starts awake
+
+    rigidBody->forceActivationState(is_bullet_sleep_enabled ? ACTIVE_TAG : DISABLE_DEACTIVATION);
+    rigidBody->setDeactivationTime(0);
+  }
+
+  // drop the contact manifolds of every pair in one sweep (per-body cleanProxyFromPairs
+  // would walk the whole pair cache once per body); stale pairs fall out on the next step
+
+  btOverlappingPairCache *pair_cache = bullet_broadphase->getOverlappingPairCache();
+  btBroadphasePairArray & pairs = pair_cache->getOverlappingPairArray();
+  for (int i = 0; i < pairs.size(); i++)
+    pair_cache->cleanOverlappingPair(pairs[i], bullet_dispatcher);
+
+  bullet_dynamicsWorld->updateAabbs();
+  bullet_solver->reset();
 }
 
 //----------------------------------------------------------------------------
@@ -326,20 +690,37 @@ void initialize_bullet_simulator()
 
 void delete_bullet_simulator()
 {
-  // remove all of the objects
+  if (!bullet_dynamicsWorld)
+    return;
+
+  // remove all of the objects from the world, then free them pool by pool
 
-  for (int i = 0; i < bullet_rigidbodies.size(); i++){
+  for (int i = 0; i < num_bodies_in_world; i++)
     bullet_dynamicsWorld->removeRigidBody(bullet_rigidbodies[i]);
-    delete bullet_rigidbodies[i]->getMotionState();
-    delete bullet_rigidbodies[i];
-  }
+  for (int i = 0; i < bullet_obstacles.size(); i++)
+    bullet_dynamicsWorld->removeRigidBody(bullet_obstacles[i]);
+
   bullet_rigidbodies.clear();
+  bullet_obstacles.clear();
+  num_bodies_in_world = 0;
+
+  bullet_creature_body_pool.clear();
+  bullet_creature_motion_state_pool.clear();
+  bullet_obstacle_body_pool.clear();
+  bullet_obstacle_motion_state_pool.clear();
+  bullet_obstacle_shape_pool.clear();
+
+  delete bullet_creature_shape;
+  bullet_creature_shape = NULL;
   
   delete bullet_dynamicsWorld;
   delete bullet_solver;
+  delete bullet_solver_pool;
   delete bullet_collisionConfiguration;
   delete bullet_dispatcher;
   delete bullet_broadphase;
+  bullet_dynamicsWorld = NULL;
+  bullet_solver_pool = NULL;
 }
 
 //----------------------------------------------------------------------------
@@ -350,27 +731,25 @@ void update_physics_simulation(float deltaTime)
   
   bullet_dynamicsWorld->stepSimulation(deltaTime, 7);
 
-  // query new positions and orientations
-  
-  for (int i = 0; i < num_creatures; i++) {
-
-    btTransform trans;
-    bullet_rigidbodies[i]->getMotionState()->getWorldTransform(trans);
-    
-    //      printf("%i height = %f\n", i, trans.getOrigin().getY()); fflush(stdout);
-    xyz_positions[i].x = trans.getOrigin().getX();
-    xyz_positions[i].y = trans.getOrigin().getY();
-    xyz_positions[i].z = trans.getOrigin().getZ();
-    
-    quat_orientations[i].x = trans.getRotation().getX();
-    quat_orientations[i].y = trans.getRotation().getY();
-    quat_orientations[i].z = trans.getRotation().getZ();
-    quat_orientations[i].w = trans.getRotation().getW();
-  }
-
-  // put information back in flocker objects
-  
-  copy_graphics_objects_to_flocker_states();
+  // Creature_Motion_State has already put the new positions and orientations
+  // into the creatures.  flocking creatures also need their heading and trail
+
+  if (is_hybrid_active)
+    get_thread_pool()->parallel_for(0, num_creatures, HYBRID_GRAIN, [](int begin, int end, int chunk) {
+	for (int i = begin; i < end; i++) {
+	  Creature *c = get_creature(i);
+	  const btVector3 & v = bullet_rigidbodies[i]->getLinearVelocity();
+	  c->velocity = glm::vec3(v.getX(), v.getY(), v.getZ()) / (float) velocity_scale;
+	  c->update_frame();
+	}
+      });
+
+  // how much of the world is still being simulated
+
+  num_sleeping_bodies = 0;
+  for (int i = 0; i < num_creatures; i++)
+    num_sleeping_bodies += bullet_rigidbodies[i]->getActivationState() == ISLAND_SLEEPING;
+  num_awake_bodies = num_creatures - num_sleeping_bodies;
 }
 
 //----------------------------------------------------------------------------
@@ -380,11 +759,10 @@ void update_physics_simulation(float deltaTime)
 int bullet_hello_main( int argc, char **argv )
 {  
   //  randomize_graphics_objects();
-  copy_flocker_states_to_graphics_objects();
   
   // Initialize Bullet library.
 
-  initialize_bullet_simulator();
+  reset_bullet_simulator();
   
   // For speed computation
   double lastTime = glfwGetTime();
@@ -424,21 +802,9 @@ int bullet_hello_main( int argc, char **argv )
 
     for (int i = 0; i < num_flockers; i++) {
 
-      btTransform trans;
-      bullet_rigidbodies[i]->getMotionState()->getWorldTransform(trans);
-
-      xyz_positions[i].x = trans.getOrigin().getX();
-      xyz_positions[i].y = trans.getOrigin().getY();
-      xyz_positions[i].z = trans.getOrigin().getZ();
-
-      quat_orientations[i].x = trans.getRotation().getX();
-      quat_orientations[i].y = trans.getRotation().getY();
-      quat_orientations[i].z = trans.getRotation().getZ();
-      quat_orientations[i].w = trans.getRotation().getW();
-
-      glm::mat4 RotationMatrix = glm::toMat4(quat_orientations[i]);
-      glm::mat4 TranslationMatrix = translate(mat4(), xyz_positions[i]);
-      glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix;
+      glm::mat4 RotationMatrix = glm::toMat4(flocker_array[i]->orientation);
+      glm::mat4 TranslationMatrix = translate(mat4(), flocker_array[i]->position);
+      glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix * glm::scale(mat4(), vec3(obj_scale));
       
       glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
 
@@ -493,8 +859,8 @@ int bullet_hello_main( int argc, char **argv )
       // Draw the triangles !
       glDrawElements(
 		     GL_TRIANGLES,      // mode
-		     obj_indices.size(),    // count
-		     GL_UNSIGNED_SHORT,   // type
+		     obj_num_indices,    // count
+		     obj_index_type,   // type
 		     (void*)0           // element array buffer offset
 		     );
       
@@ -41,20 +41,68 @@
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/meshcache.hpp>
+
+#include "Bullet_Pool.hh"
+#include "Bullet_Threads.hh"
+#include "Creature.hh"
 
 using namespace std;
 using namespace glm;
 
 //----------------------------------------------------------------------------
 
+#define CREATURE_MASS                1        // in kg.  0 -> static object aka never moves
+
+#define BULLET_SLEEP_LINEAR_SPEED    0.3      // units/s -- slower than this (and the angular one)...
+#define BULLET_SLEEP_ANGULAR_SPEED   0.5      // radians/s
+#define BULLET_SLEEP_TIME            1.0      // ...for this long, and the whole island goes to sleep
+
+#define BROADPHASE_DBVT              0        // dynamic AABB trees -- unbounded
+#define BROADPHASE_SAP               1        // btAxisSweep3, 16-bit, bounded by the box
+#define BROADPHASE_SAP32             2        // bt32BitAxisSweep3, bounded by the box
+
+#define BULLET_WORLD_MARGIN          1.0      // sweep-and-prune bounds reach this far outside the box
+#define BULLET_SAP_MAX_HANDLES       32766    // all btAxisSweep3 can hold
+
+#define HYBRID_FLOCKING_RATE         60.0     // flocking steps per second the behavior weights were tuned for
+#define HYBRID_GRAIN                 512      // creatures per worker pool chunk in the hybrid tick
+#define HYBRID_WAKE_ACCELERATION     0.05     // units/s^2 of steering that wakes a sleeping body
+
+#define HULL_CACHE_MAGIC             0x4c4c5548   // "HULL"
+#define HULL_CACHE_VERSION           1
+
+//----------------------------------------------------------------------------
+
+// Bullet hands every body it moved to its motion state once per step -- this
+// one writes the new pose straight into the creature the body stands for
+
+class Creature_Motion_State : public btMotionState
+{
+public:
+
+  Creature *creature;                       // NULL until reset_bullet_simulator() binds the body
+
+  Creature_Motion_State();
+
+  virtual void getWorldTransform(btTransform &) const;
+  virtual void setWorldTransform(const btTransform &);
+};
+
+//----------------------------------------------------------------------------
+
 int bullet_hello_main(int, char **);
 
-void initialize_bullet_simulator();
-void delete_bullet_simulator();
+int parse_broadphase(const char *);         // "dbvt", "sap" or "sap32" -> BROADPHASE_*, -1 if none of them
+const char *get_broadphase_name(int);
+
+void initialize_bullet_simulator();         // world and static obstacles -- once
+void reset_bullet_simulator();              // (re)start from the creatures' current states, reusing the bodies
+void delete_bullet_simulator();             // everything, at exit
 
-void copy_flocker_states_to_graphics_objects();
-void copy_graphics_objects_to_flocker_states();
-void update_physics_simulation(float);
+void update_physics_simulation(float);      // creatures' positions and orientations follow the bodies
+void set_bullet_hybrid(bool);               // flocking forces drive the bodies (and gravity is off) while they collide
+void print_bullet_stats(FILE * = stdout);   // awake vs sleeping bodies
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
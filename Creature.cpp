@@ -12,6 +12,7 @@
 //----------------------------------------------------------------------------
 
 #include "Creature.hh"
+#include "Flock_World.hh"
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
@@ -54,6 +55,7 @@ Creature::Creature(int _index,
 		   int max_hist)
 { 
   index = _index;
+  world = &flock_world;
 
   base_color = glm::vec3(r, g, b);
 
@@ -67,10 +69,34 @@ Creature::Creature(int _index,
 
   velocity = glm::vec3(init_vx, init_vy, init_vz);
 
+  orientation = glm::quat(1.0, 0.0, 0.0, 0.0);
+
   acceleration = glm::vec3(0.0, 0.0, 0.0);
 
-  glGenBuffers(1, &vertexbuffer);
-  glGenBuffers(1, &colorbuffer);
+  vertexbuffer = colorbuffer = 0;
+}
+
+//----------------------------------------------------------------------------
+
+Creature::~Creature()
+{
+  if (vertexbuffer) {
+    glDeleteBuffers(1, &vertexbuffer);
+    glDeleteBuffers(1, &colorbuffer);
+  }
+}
+
+//----------------------------------------------------------------------------
+
+// buffers are made on the first draw rather than in the constructor, so
+// creatures can be built (and simulated) with no GL context at all
+
+void Creature::require_buffers()
+{
+  if (!vertexbuffer) {
+    glGenBuffers(1, &vertexbuffer);
+    glGenBuffers(1, &colorbuffer);
+  }
 }
 
 //----------------------------------------------------------------------------
@@ -101,6 +127,15 @@ void Creature::finalize_update(double wrap_width, double wrap_height, double wra
   velocity = new_velocity;
   position = new_position;
 
+  update_frame();
+}
+
+//----------------------------------------------------------------------------
+
+// also used when Bullet is moving the creatures
+
+void Creature::update_frame()
+{
   // update frame
 
   frame_z = -1.0f * glm::normalize(velocity);
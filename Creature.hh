@@ -33,6 +33,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/norm.hpp>
 #include <glm/gtc/random.hpp>
 
@@ -44,6 +45,8 @@ using namespace std;
 void initialize_random();
 double uniform_random(double, double);
 
+struct Flock_World;
+
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
 
@@ -52,6 +55,7 @@ class Creature
 public:
 
   int index;
+  Flock_World *world;                       // whose distance tables and random numbers this uses
 
   glm::vec3 position;                       // current position
   glm::vec3 velocity;                       // current velocity
@@ -66,13 +70,15 @@ public:
   glm::vec3 frame_y;
   glm::vec3 frame_z;
 
+  glm::quat orientation;                    // rigid body rotation -- only meaningful while physics is active
+
   deque <glm::vec3> position_history;
   int max_history;
 	
   glm::vec3 base_color;
   glm::vec3 draw_color;
 
-  GLuint vertexbuffer;
+  GLuint vertexbuffer;                      // 0 until the first draw
   GLuint colorbuffer;
 
   Creature(int,                    // index
@@ -80,10 +86,14 @@ public:
 	   double, double, double, // initial velocity
 	   float, float, float,    // base color
 	   int = 1);               // number of past states to save
+  virtual ~Creature();
 
   virtual void draw(glm::mat4) = 0;
+  virtual void compute_steering() = 0;      // acceleration from the deterministic behaviors only
   virtual void update() = 0;
   void finalize_update(double, double, double);
+  void update_frame();                      // local axes from velocity, and remember the position
+  void require_buffers();
 
 };
 
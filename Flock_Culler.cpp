@@ -0,0 +1,171 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// view-frustum culling: which creatures can be seen at all, decided before
+// anything is submitted to GL
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Flock_Culler.hh"
+
+#include <common/meshcache.hpp>
+
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+bool is_culling_enabled = true;
+
+vector <int> visible_creatures;
+int num_visible_flockers = 0;
+int num_culled_creatures = 0;
+
+extern float point_sprite_size;
+
+extern MeshCache obj_mesh;
+extern float obj_scale;
+
+// bounding spheres, one array per coordinate so the plane tests below vectorize
+
+static vector <float> cull_x, cull_y, cull_z, cull_r;
+static vector <unsigned char> cull_is_visible;
+static vector <int> cull_chunk_offsets;              // visible per chunk, then where each chunk writes
+
+//----------------------------------------------------------------------------
+
+// the six clip-space planes pulled straight out of MVP (Gribb & Hartmann),
+// normalized so plane distances are in world units.  a point is inside when
+// all of a x + b y + c z + d are >= 0
+
+static void get_frustum_planes(glm::mat4 & MVP, float planes[6][4])
+{
+  for (int k = 0; k < 3; k++)
+    for (int s = 0; s < 2; s++) {
+      float *p = planes[2 * k + s];
+      float sign = s ? -1.0f : 1.0f;
+      for (int j = 0; j < 4; j++)
+	p[j] = MVP[j][3] + sign * MVP[j][k];
+
+      float len = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+      for (int j = 0; j < 4; j++)
+	p[j] /= len;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// how far a creature's drawing can reach from its position
+
+static float get_bounding_radius(int draw_mode)
+{
+  if (draw_mode == DRAW_MODE_POINTS)
+    return 0.5 * point_sprite_size;
+  else if (draw_mode == DRAW_MODE_OBJ && obj_mesh.num_vertices > 0)
+    return obj_scale * max(glm::length(obj_mesh.bounds_min), glm::length(obj_mesh.bounds_max));
+  else
+    return CREATURE_BOUNDING_RADIUS;
+}
+
+//----------------------------------------------------------------------------
+
+// test every creature's bounding sphere against the view frustum and collect
+// the ones that may be seen into visible_creatures, in index order.  each
+// worker chunk copies its creatures' spheres out and tests them in one tight
+// loop, then the chunks write their survivors at prefix-summed offsets
+
+void cull_creatures(glm::mat4 MVP, int draw_mode)
+{
+  Thread_Pool *pool = get_thread_pool();
+
+  int num_flockers = flocker_array.size();
+  int num_creatures = num_flockers + predator_array.size();
+  int num_chunks = pool->num_chunks(0, num_creatures, CULL_GRAIN);
+
+  visible_creatures.resize(num_creatures);
+
+  if (!is_culling_enabled || num_creatures == 0) {
+    for (int i = 0; i < num_creatures; i++)
+      visible_creatures[i] = i;
+    num_visible_flockers = num_flockers;
+    num_culled_creatures = 0;
+    return;
+  }
+
+  float planes[6][4];
+  get_frustum_planes(MVP, planes);
+
+  float radius = get_bounding_radius(draw_mode);
+  bool is_history = draw_mode == DRAW_MODE_HISTORY;
+
+  cull_x.resize(num_creatures);
+  cull_y.resize(num_creatures);
+  cull_z.resize(num_creatures);
+  cull_r.resize(num_creatures);
+  cull_is_visible.resize(num_creatures);
+  cull_chunk_offsets.assign(num_chunks, 0);
+
+  pool->parallel_for(0, num_creatures, CULL_GRAIN, [&](int begin, int end, int chunk) {
+
+      for (int i = begin; i < end; i++) {
+	Creature *c = get_creature(i);
+	cull_x[i] = c->position.x;
+	cull_y[i] = c->position.y;
+	cull_z[i] = c->position.z;
+	cull_r[i] = radius;
+
+	// a trail reaches as far back as its oldest point
+
+	if (is_history) {
+	  float r2 = 0.0f;
+	  for (deque<glm::vec3>::iterator it = c->position_history.begin(); it != c->position_history.end(); ++it) {
+	    glm::vec3 d = *it - c->position;
+	    r2 = max(r2, glm::dot(d, d));
+	  }
+	  cull_r[i] = sqrt(r2) + radius;
+	}
+      }
+
+      // branch-free over plain arrays -- the compiler turns this into SIMD
+
+      const float *x = &cull_x[0], *y = &cull_y[0], *z = &cull_z[0], *r = &cull_r[0];
+      unsigned char *is_visible = &cull_is_visible[0];
+      int count = 0;
+
+      for (int i = begin; i < end; i++) {
+	float dist = planes[0][0] * x[i] + planes[0][1] * y[i] + planes[0][2] * z[i] + planes[0][3];
+	for (int p = 1; p < 6; p++)
+	  dist = fminf(dist, planes[p][0] * x[i] + planes[p][1] * y[i] + planes[p][2] * z[i] + planes[p][3]);
+	is_visible[i] = dist + r[i] >= 0.0f;
+	count += is_visible[i];
+      }
+
+      cull_chunk_offsets[chunk] = count;
+    });
+
+  int total = 0;
+  for (int c = 0; c < num_chunks; c++) {
+    int count = cull_chunk_offsets[c];
+    cull_chunk_offsets[c] = total;
+    total += count;
+  }
+
+  // same chunks as above, so each fills exactly the slots it counted
+
+  pool->parallel_for(0, num_creatures, CULL_GRAIN, [](int begin, int end, int chunk) {
+      int next = cull_chunk_offsets[chunk];
+      for (int i = begin; i < end; i++)
+	if (cull_is_visible[i])
+	  visible_creatures[next++] = i;
+    });
+
+  visible_creatures.resize(total);
+  num_visible_flockers = lower_bound(visible_creatures.begin(), visible_creatures.end(), num_flockers) - visible_creatures.begin();
+  num_culled_creatures = num_creatures - total;
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
@@ -0,0 +1,38 @@
+#ifndef FLOCK_CULLER_HH
+
+#define FLOCK_CULLER_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// view-frustum culling: which creatures can be seen at all, decided before
+// anything is submitted to GL
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Flock_World.hh"
+#include "Thread_Pool.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define CREATURE_BOUNDING_RADIUS       0.25   // world units -- covers the AXES and POLY shapes
+#define CULL_GRAIN                     4096   // creatures per worker pool chunk
+
+//----------------------------------------------------------------------------
+
+extern bool is_culling_enabled;
+
+extern vector <int> visible_creatures;      // get_creature() indices, ascending
+extern int num_visible_flockers;            // how many of visible_creatures are flockers (they come first)
+extern int num_culled_creatures;
+
+void cull_creatures(glm::mat4, int);        // MVP, draw mode (sets the bounding spheres)
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,279 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// ensemble runs: many small, independent flock worlds with different
+// behavior weights, one per worker pool task, summarized side by side in a
+// single columnar file
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Flock_Ensemble.hh"
+
+#include "Frame_Scheduler.hh"
+#include "Thread_Pool.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+static const char *ensemble_metrics[ENSEMBLE_NUM_METRICS] = {
+  "polarization",                           // length of the mean flocker heading: 0 milling .. 1 all one way
+  "mean_speed",                             // flockers, per step
+  "nearest_neighbor",                       // mean distance from a flocker to the closest other one
+  "predator_distance",                      // mean distance from a flocker to the closest predator
+  "fear_fraction",                          // flockers close enough to a predator to flee it
+};
+
+extern int num_flockers;
+extern int num_predators;
+extern int max_frames;
+
+extern float box_width;
+extern float box_height;
+extern float box_depth;
+
+//----------------------------------------------------------------------------
+
+// the app's creatures, but all with the world's weights instead of random ones
+
+static void populate_ensemble_world(Flock_World & world, const Ensemble_World & e)
+{
+  int i;
+
+  for (i = 0; i < num_flockers; i++)
+    world.add_flocker(world.new_flocker(i, e.params));
+
+  for (i = 0; i < num_predators; i++)
+    world.add_predator(world.new_predator(i, e.params));
+
+  world.resize_distance_tables();
+}
+
+//----------------------------------------------------------------------------
+
+// add this step's metrics to sums.  the distances are the ones the step
+// steered by -- already in the tables, so they cost nothing to recompute
+
+static void measure_ensemble_world(Flock_World & world, double *sums)
+{
+  int n = world.flockers.size();
+  glm::vec3 heading(0.0f, 0.0f, 0.0f);
+  double speed = 0.0, nearest = 0.0, predator = 0.0;
+  int num_afraid = 0;
+
+  if (n == 0)
+    return;
+
+  for (int i = 0; i < n; i++) {
+
+    Flocker *f = world.flockers[i];
+
+    float s = glm::length(f->velocity);
+    if (s > 0.0f)
+      heading += f->velocity / s;
+    speed += s;
+
+    double d2 = INFINITY;
+    for (int j = i + 1; j < n; j++)
+      d2 = fmin(d2, world.flocker_squared_distance[i][j]);
+    for (int j = 0; j < i; j++)
+      d2 = fmin(d2, world.flocker_squared_distance[j][i]);
+    nearest += sqrt(d2);
+
+    d2 = INFINITY;
+    for (int p = 0; p < world.predators.size(); p++)
+      d2 = fmin(d2, world.p_to_f_squared_distance[p][i]);
+    predator += sqrt(d2);
+
+    if (glm::length2(f->fear_force) > 0.0f)
+      num_afraid++;
+  }
+
+  sums[0] += glm::length(heading) / n;
+  sums[1] += speed / n;
+  sums[2] += nearest / n;
+  sums[3] += predator / n;
+  sums[4] += (double) num_afraid / n;
+}
+
+//----------------------------------------------------------------------------
+
+// build, step and measure one world on the calling thread, then throw it
+// away.  a random sweep draws the weights from the world's own stream first,
+// so the seed alone reproduces the world
+
+static void run_ensemble_world(Ensemble_World & e, bool is_random_sweep, int num_steps)
+{
+  Flock_World world;
+
+  world.box_size = glm::vec3(box_width, box_height, box_depth);
+  world.is_parallel = false;
+  world.seed_random(e.seed);
+
+  if (is_random_sweep)
+    for (int p = 0; p < ENSEMBLE_NUM_PARAMS; p++)
+      e.params[p] = world.uniform_random(behavior_weight_ranges[p].lower, behavior_weight_ranges[p].upper);
+
+  populate_ensemble_world(world, e);
+
+  int num_measured = (int) (ENSEMBLE_MEASURED_FRACTION * num_steps);
+  if (num_measured < 1)
+    num_measured = 1;
+
+  double sums[ENSEMBLE_NUM_METRICS];
+  for (int m = 0; m < ENSEMBLE_NUM_METRICS; m++)
+    sums[m] = 0.0;
+
+  for (int step = 0; step < num_steps; step++) {
+    world.step();
+    if (step >= num_steps - num_measured)
+      measure_ensemble_world(world, sums);
+  }
+
+  for (int m = 0; m < ENSEMBLE_NUM_METRICS; m++)
+    e.metrics[m] = sums[m] / num_measured;
+
+  world.clear();
+}
+
+//----------------------------------------------------------------------------
+
+// one JSON array per column, so a whole sweep loads straight into a table
+// (e.g. pandas.DataFrame(json.load(f)["columns"]))
+
+static void write_ensemble_column(FILE *fp, const char *name, const vector <double> & values, bool is_last)
+{
+  fprintf(fp, "    \"%s\": [", name);
+
+  for (int i = 0; i < values.size(); i++) {
+    if (isfinite(values[i]))
+      fprintf(fp, "%s%.6g", i ? ", " : "", values[i]);
+    else
+      fprintf(fp, "%snull", i ? ", " : "");          // e.g. predator_distance with no predators
+  }
+
+  fprintf(fp, "]%s\n", is_last ? "" : ",");
+}
+
+//----------------------------------------------------------------------------
+
+// every world gets its own seed and runs start to finish in one worker pool
+// task, with nothing shared but the (read-only) settings -- so the worlds
+// scale across cores with no locking, and each result depends only on its
+// seed and weights.  timing is only for the run as a whole: how long one
+// world takes depends on what else the pool is running alongside it
+
+void run_flock_ensemble(const char *filename, int num_worlds, int grid_size)
+{
+  bool is_random_sweep = grid_size == 0;
+  int num_steps = max_frames > 0 ? max_frames : ENSEMBLE_STEPS;
+
+  // check the size before anything is allocated -- grid_size^5 overflows an int from 74 up
+
+  if (grid_size < 0) {
+    printf("ensemble grid size must be at least 1 (or 0 for a random sweep)\n");
+    exit(1);
+  }
+
+  if (!is_random_sweep) {
+    num_worlds = 1;
+    for (int p = 0; p < ENSEMBLE_NUM_PARAMS; p++) {
+      if (num_worlds > ENSEMBLE_MAX_WORLDS / grid_size) {
+	printf("ensemble grid of %i values per weight is more than %i worlds\n", grid_size, ENSEMBLE_MAX_WORLDS);
+	exit(1);
+      }
+      num_worlds *= grid_size;
+    }
+  }
+  else if (num_worlds < 1 || num_worlds > ENSEMBLE_MAX_WORLDS) {
+    printf("ensemble must have 1 to %i worlds\n", ENSEMBLE_MAX_WORLDS);
+    exit(1);
+  }
+
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    printf("could not open %s for writing\n", filename);
+    exit(1);
+  }
+
+  // grid: world w's weights are the digits of w in base grid_size
+
+  vector <Ensemble_World> worlds(num_worlds);
+
+  for (int w = 0; w < num_worlds; w++) {
+    worlds[w].seed = ENSEMBLE_SEED + w;
+    int digits = w;
+    for (int p = 0; p < ENSEMBLE_NUM_PARAMS && !is_random_sweep; p++) {
+      const Behavior_Weight_Range & r = behavior_weight_ranges[p];
+      worlds[w].params[p] = grid_size == 1
+	? 0.5 * (r.lower + r.upper)
+	: r.lower + (r.upper - r.lower) * (digits % grid_size) / (grid_size - 1);
+      digits /= grid_size;
+    }
+  }
+
+  Thread_Pool *pool = get_thread_pool();
+
+  printf("ensemble: %i worlds of %i flockers and %i predators, %i steps each, on %i threads\n",
+	 num_worlds, num_flockers, num_predators, num_steps, pool->num_threads());
+  fflush(stdout);
+
+  double t_start = get_monotonic_time();
+
+  pool->parallel_for(0, num_worlds, 1, [&worlds, is_random_sweep, num_steps](int begin, int end, int chunk) {
+      for (int w = begin; w < end; w++)
+	run_ensemble_world(worlds[w], is_random_sweep, num_steps);
+    });
+
+  double wall_time = get_monotonic_time() - t_start;
+
+  // rows -> columns
+
+  vector <double> column(num_worlds);
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"sweep\": \"%s\",\n", is_random_sweep ? "random" : "grid");
+  fprintf(fp, "  \"worlds\": %i,\n", num_worlds);
+  fprintf(fp, "  \"flockers\": %i,\n", num_flockers);
+  fprintf(fp, "  \"predators\": %i,\n", num_predators);
+  fprintf(fp, "  \"box\": [%.3f, %.3f, %.3f],\n", box_width, box_height, box_depth);
+  fprintf(fp, "  \"steps\": %i,\n", num_steps);
+  fprintf(fp, "  \"measured_fraction\": %.3f,\n", ENSEMBLE_MEASURED_FRACTION);
+  fprintf(fp, "  \"pool_threads\": %i,\n", pool->num_threads());
+  fprintf(fp, "  \"wall_seconds\": %.3f,\n", wall_time);
+  fprintf(fp, "  \"world_steps_per_second\": %.1f,\n", (double) num_worlds * num_steps / wall_time);
+  fprintf(fp, "  \"columns\": {\n");
+
+  for (int w = 0; w < num_worlds; w++)
+    column[w] = worlds[w].seed;
+  write_ensemble_column(fp, "seed", column, false);
+
+  for (int p = 0; p < ENSEMBLE_NUM_PARAMS; p++) {
+    for (int w = 0; w < num_worlds; w++)
+      column[w] = worlds[w].params[p];
+    write_ensemble_column(fp, behavior_weight_ranges[p].name, column, false);
+  }
+
+  for (int m = 0; m < ENSEMBLE_NUM_METRICS; m++) {
+    for (int w = 0; w < num_worlds; w++)
+      column[w] = worlds[w].metrics[m];
+    write_ensemble_column(fp, ensemble_metrics[m], column, m == ENSEMBLE_NUM_METRICS - 1);
+  }
+
+  fprintf(fp, "  }\n}\n");
+
+  bool is_write_ok = !ferror(fp);
+  is_write_ok = !fclose(fp) && is_write_ok;
+  if (!is_write_ok) {
+    printf("could not write all of %s\n", filename);
+    exit(1);
+  }
+
+  printf("ensemble: %.2f s, %.1f worlds/s, %.0f creature steps/s -- results in %s\n",
+	 wall_time, num_worlds / wall_time, (double) num_worlds * num_steps * (num_flockers + num_predators) / wall_time, filename);
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
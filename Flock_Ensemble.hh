@@ -0,0 +1,61 @@
+#ifndef FLOCK_ENSEMBLE_HH
+
+#define FLOCK_ENSEMBLE_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// ensemble runs: many small, independent flock worlds with different
+// behavior weights, one per worker pool task, summarized side by side in a
+// single columnar file
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Flock_World.hh"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define ENSEMBLE_NUM_WORLDS          256    // random sweep -- --ensemble-worlds overrides
+#define ENSEMBLE_MAX_WORLDS          100000 // either sweep -- a grid of 10 values per weight just fits
+#define ENSEMBLE_STEPS               1000   // per world -- --frames overrides
+#define ENSEMBLE_MEASURED_FRACTION   0.5    // metrics average over this last part of each run
+#define ENSEMBLE_SEED                440    // world i draws from seed ENSEMBLE_SEED + i
+
+#define ENSEMBLE_NUM_PARAMS          NUM_BEHAVIOR_WEIGHTS   // indexed by BEHAVIOR_*
+#define ENSEMBLE_NUM_METRICS         5
+
+//----------------------------------------------------------------------------
+
+// the weights one world's creatures all share -- everything else about them
+// is as Flock_World::new_flocker() and new_predator() make them
+
+struct Ensemble_World
+{
+  uint64_t seed;
+  double params[ENSEMBLE_NUM_PARAMS];
+  double metrics[ENSEMBLE_NUM_METRICS];
+};
+
+//----------------------------------------------------------------------------
+
+// num_flockers + num_predators creatures per world.  grid_size > 0 steps
+// every weight through that many values (grid_size^ENSEMBLE_NUM_PARAMS
+// worlds); otherwise num_worlds worlds draw their weights at random.  more
+// than ENSEMBLE_MAX_WORLDS worlds either way is an error
+
+void run_flock_ensemble(const char *, int, int);   // JSON results file, worlds, grid size
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
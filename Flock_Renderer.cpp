@@ -0,0 +1,506 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// whole-flock draw paths: one draw call for all creatures instead of one each
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Flock_Renderer.hh"
+#include "Render_Bench.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+int density_grid_res = DEFAULT_DENSITY_GRID_RES;
+float density_opacity = DEFAULT_DENSITY_OPACITY;
+float point_sprite_size = DEFAULT_POINT_SPRITE_SIZE;
+float obj_lod_pixel_error = DEFAULT_OBJ_LOD_PIXEL_ERROR;
+
+extern glm::mat4 ViewMat;
+extern glm::mat4 ProjectionMat;
+
+extern float box_width;
+extern float box_height;
+extern float box_depth;
+
+extern int win_h;
+
+extern MeshCache obj_mesh;
+extern float obj_scale;
+extern GLenum obj_index_type;
+extern GLuint obj_Texture;
+extern GLuint pred_Texture;
+extern GLuint obj_vertexbuffer;
+extern GLuint obj_uvbuffer;
+extern GLuint obj_normalbuffer;
+extern GLuint obj_elementbuffer;
+
+GLuint points_programID;
+GLuint points_MatrixID;
+GLuint points_PointScaleID;
+GLuint points_vertexbuffer;
+
+GLuint density_programID;
+GLuint density_MatrixID;
+GLuint density_BoxSizeID;
+GLuint density_OpacityID;
+GLuint density_SamplerID;
+GLuint density_vertexbuffer;
+GLuint density_Texture;
+
+GLuint obj_instanced_programID = 0;   // loaded with the first OBJ frame, like the object itself
+GLuint obj_instanced_MatrixID;
+GLuint obj_instanced_ViewMatrixID;
+GLuint obj_instanced_ScaleID;
+GLuint obj_instanced_TextureID;
+GLuint obj_instanced_LightID;
+GLuint obj_instancebuffer;
+
+// kept around between frames so we aren't mallocing 10^6-element arrays 60 times a second
+
+vector <GLfloat> point_buffer_data;                  // x, y, z, r, g, b per creature
+vector <unsigned int> density_counts;                // one grid per thread, back to back
+vector <GLfloat> density_grid;
+vector <GLfloat> density_slice_data;
+vector <GLfloat> obj_instance_data;                  // x, y, z per creature, grouped by bucket
+vector <unsigned char> obj_instance_bucket;          // which bucket each creature went to
+vector <int> obj_bucket_offsets;                     // per chunk and bucket: counts, then where that chunk writes
+
+int density_nx = 0, density_ny = 0, density_nz = 0;  // size of the texture currently allocated
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+void initialize_flock_renderer()
+{
+  points_programID = LoadShaders( "Points.vertexshader", "Points.fragmentshader" );
+  points_MatrixID = glGetUniformLocation(points_programID, "MVP");
+  points_PointScaleID = glGetUniformLocation(points_programID, "PointScale");
+
+  density_programID = LoadShaders( "Density.vertexshader", "Density.fragmentshader" );
+  density_MatrixID = glGetUniformLocation(density_programID, "MVP");
+  density_BoxSizeID = glGetUniformLocation(density_programID, "BoxSize");
+  density_OpacityID = glGetUniformLocation(density_programID, "Opacity");
+  density_SamplerID = glGetUniformLocation(density_programID, "densitySampler");
+
+  glGenBuffers(1, &points_vertexbuffer);
+  glGenBuffers(1, &density_vertexbuffer);
+
+  glGenTextures(1, &density_Texture);
+  glBindTexture(GL_TEXTURE_3D, density_Texture);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+//----------------------------------------------------------------------------
+
+void delete_flock_renderer()
+{
+  glDeleteBuffers(1, &points_vertexbuffer);
+  glDeleteBuffers(1, &density_vertexbuffer);
+  glDeleteTextures(1, &density_Texture);
+  glDeleteProgram(points_programID);
+  glDeleteProgram(density_programID);
+
+  if (obj_instanced_programID) {
+    glDeleteBuffers(1, &obj_instancebuffer);
+    glDeleteProgram(obj_instanced_programID);
+  }
+}
+
+
+//----------------------------------------------------------------------------
+
+// every visible creature is one GL_POINTS vertex, expanded to a round sprite
+// by the shader.  only the per-creature data goes over the bus
+
+void draw_flock_points(glm::mat4 Model)
+{
+  int num_creatures = visible_creatures.size();
+  if (num_creatures == 0)
+    return;
+
+  point_buffer_data.resize(6 * num_creatures);
+
+  get_thread_pool()->parallel_for(0, num_creatures, 4096, [](int begin, int end, int chunk) {
+      for (int i = begin; i < end; i++) {
+	Creature *c = get_creature(visible_creatures[i]);
+	GLfloat *p = &point_buffer_data[6 * i];
+	p[0] = c->position.x;
+	p[1] = c->position.y;
+	p[2] = c->position.z;
+	p[3] = c->draw_color.r;
+	p[4] = c->draw_color.g;
+	p[5] = c->draw_color.b;
+      }
+    });
+
+  glm::mat4 MVP = ProjectionMat * ViewMat * Model;
+
+  // pixels covered by point_sprite_size world units at distance 1 from the eye
+
+  float point_scale = point_sprite_size * 0.5f * win_h * ProjectionMat[1][1];
+
+  glUseProgram(points_programID);
+  glUniformMatrix4fv(points_MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  glUniform1f(points_PointScaleID, point_scale);
+
+  // orphan last frame's storage so the driver doesn't have to wait on it
+
+  glBindBuffer(GL_ARRAY_BUFFER, points_vertexbuffer);
+  glBufferData(GL_ARRAY_BUFFER, point_buffer_data.size() * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, point_buffer_data.size() * sizeof(GLfloat), &point_buffer_data[0]);
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0,                  // attribute. 0 to match the layout in the shader.
+			3,                  // size
+			GL_FLOAT,           // type
+			GL_FALSE,           // normalized?
+			6 * sizeof(GLfloat),// stride
+			(void*)0            // array buffer offset
+			);
+
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1,                                // attribute. 1 to match the layout in the shader.
+			3,                                // size
+			GL_FLOAT,                         // type
+			GL_FALSE,                         // normalized?
+			6 * sizeof(GLfloat),              // stride
+			(void*)(3 * sizeof(GLfloat))      // array buffer offset
+			);
+
+  glEnable(GL_PROGRAM_POINT_SIZE);
+  glDrawArrays(GL_POINTS, 0, num_creatures);
+  count_gl_draw(GL_POINTS, num_creatures);
+  glDisable(GL_PROGRAM_POINT_SIZE);
+
+  glDisableVertexAttribArray(0);
+  glDisableVertexAttribArray(1);
+}
+
+//----------------------------------------------------------------------------
+
+// count creatures per cell.  each thread bins its share into a private grid,
+// then the grids are summed cell-by-cell (also in parallel) and normalized
+
+static void bin_flock_density(int nx, int ny, int nz)
+{
+  Thread_Pool *pool = get_thread_pool();
+
+  int num_creatures = flocker_array.size() + predator_array.size();
+  int num_cells = nx * ny * nz;
+
+  // one chunk (and so one private grid) per thread
+
+  int grain = (num_creatures + pool->num_threads() - 1) / pool->num_threads();
+  int num_grids = pool->num_chunks(0, num_creatures, grain);
+  if (num_grids < 1)
+    num_grids = 1;
+
+  density_counts.assign(num_grids * num_cells, 0);
+  density_grid.resize(num_cells);
+
+  float sx = nx / box_width;
+  float sy = ny / box_height;
+  float sz = nz / box_depth;
+
+  pool->parallel_for(0, num_creatures, grain, [=](int begin, int end, int chunk) {
+      unsigned int *counts = &density_counts[chunk * num_cells];
+      for (int i = begin; i < end; i++) {
+	glm::vec3 & p = get_creature(i)->position;
+	int x = (int) (p.x * sx);
+	int y = (int) (p.y * sy);
+	int z = (int) (p.z * sz);
+	x = x < 0 ? 0 : (x >= nx ? nx - 1 : x);
+	y = y < 0 ? 0 : (y >= ny ? ny - 1 : y);
+	z = z < 0 ? 0 : (z >= nz ? nz - 1 : z);
+	counts[(z * ny + y) * nx + x]++;
+      }
+    });
+
+  // a cell holding saturation_count creatures is drawn at full intensity.  scale with
+  // the mean occupancy so the picture looks similar at 10^3 and 10^6 creatures
+
+  float saturation_count = 8.0f * num_creatures / num_cells;
+  if (saturation_count < 1.0f)
+    saturation_count = 1.0f;
+  float inv_saturation = 1.0f / saturation_count;
+
+  pool->parallel_for(0, num_cells, 4096, [=](int begin, int end, int chunk) {
+      for (int c = begin; c < end; c++) {
+	unsigned int total = 0;
+	for (int g = 0; g < num_grids; g++)
+	  total += density_counts[g * num_cells + c];
+	density_grid[c] = total * inv_saturation;
+      }
+    });
+}
+
+//----------------------------------------------------------------------------
+
+// volume render the density grid as a stack of additively blended, axis-aligned
+// slices.  cost here is set by density_grid_res, not by the number of creatures
+
+void draw_flock_density(glm::mat4 Model)
+{
+  // grid cells are (nearly) cubes
+
+  float max_dim = box_width;
+  if (box_height > max_dim)
+    max_dim = box_height;
+  if (box_depth > max_dim)
+    max_dim = box_depth;
+
+  int nx = (int) ceil(density_grid_res * box_width / max_dim);
+  int ny = (int) ceil(density_grid_res * box_height / max_dim);
+  int nz = (int) ceil(density_grid_res * box_depth / max_dim);
+
+  bin_flock_density(nx, ny, nz);
+
+  glBindTexture(GL_TEXTURE_3D, density_Texture);
+  count_gl_call();
+  if (nx != density_nx || ny != density_ny || nz != density_nz) {
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, nx, ny, nz, 0, GL_RED, GL_FLOAT, &density_grid[0]);
+    density_nx = nx;
+    density_ny = ny;
+    density_nz = nz;
+  }
+  else
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, GL_RED, GL_FLOAT, &density_grid[0]);
+
+  // slice perpendicular to whichever box axis points most nearly at the camera
+
+  glm::vec4 eye = glm::inverse(ViewMat * Model) * glm::vec4(0, 0, 0, 1);
+  glm::vec3 view_dir = glm::vec3(eye.x, eye.y, eye.z) - 0.5f * glm::vec3(box_width, box_height, box_depth);
+
+  int axis = 0;
+  if (fabs(view_dir.y) > fabs(view_dir[axis]))
+    axis = 1;
+  if (fabs(view_dir.z) > fabs(view_dir[axis]))
+    axis = 2;
+
+  int num_slices = axis == 0 ? nx : (axis == 1 ? ny : nz);
+  int u = (axis + 1) % 3;
+  int v = (axis + 2) % 3;
+
+  // two triangles per slice, in [0, 1]^3 grid coordinates
+
+  static const float corners[6][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1} };
+
+  density_slice_data.resize(num_slices * 6 * 3);
+  for (int s = 0; s < num_slices; s++) {
+    float t = (s + 0.5f) / num_slices;
+    for (int k = 0; k < 6; k++) {
+      GLfloat *p = &density_slice_data[(s * 6 + k) * 3];
+      p[axis] = t;
+      p[u] = corners[k][0];
+      p[v] = corners[k][1];
+    }
+  }
+
+  glm::mat4 MVP = ProjectionMat * ViewMat * Model;
+
+  glUseProgram(density_programID);
+  glUniformMatrix4fv(density_MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  glUniform3f(density_BoxSizeID, box_width, box_height, box_depth);
+
+  // keep total brightness the same however many slices there are
+
+  glUniform1f(density_OpacityID, density_opacity * DEFAULT_DENSITY_GRID_RES / num_slices);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_3D, density_Texture);
+  count_gl_call();
+  glUniform1i(density_SamplerID, 0);
+
+  glBindBuffer(GL_ARRAY_BUFFER, density_vertexbuffer);
+  glBufferData(GL_ARRAY_BUFFER, density_slice_data.size() * sizeof(GLfloat), &density_slice_data[0], GL_STREAM_DRAW);
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0,                  // attribute. 0 to match the layout in the shader.
+			3,                  // size
+			GL_FLOAT,           // type
+			GL_FALSE,           // normalized?
+			0,                  // stride
+			(void*)0            // array buffer offset
+			);
+
+  // additive, so slice order doesn't matter and no sorting is needed
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+  glDepthMask(GL_FALSE);
+
+  glDrawArrays(GL_TRIANGLES, 0, num_slices * 6);
+  count_gl_draw(GL_TRIANGLES, num_slices * 6);
+
+  glDepthMask(GL_TRUE);
+  glDisable(GL_BLEND);
+
+  glDisableVertexAttribArray(0);
+}
+
+//----------------------------------------------------------------------------
+
+// coarsest level of detail whose error, projected to the screen from distance
+// dist, stays under obj_lod_pixel_error.  errors only grow with the level
+
+static int select_obj_lod(float dist, float pixels_per_unit)
+{
+  float max_error = obj_lod_pixel_error * dist / pixels_per_unit;
+
+  int lod = obj_mesh.num_lods - 1;
+  while (lod > 0 && obj_mesh.lod_error[lod] > max_error)
+    lod--;
+  return lod;
+}
+
+//----------------------------------------------------------------------------
+
+// every visible creature drawn with the object mesh, each at a level of detail
+// picked from its distance to the camera.  creatures are sorted into one bucket
+// per (level, texture) and each bucket is a single instanced draw, so the
+// triangle count follows what is on screen rather than how many creatures there are
+
+void draw_flock_obj(glm::mat4 Model)
+{
+  int num_creatures = visible_creatures.size();
+  if (num_creatures == 0)
+    return;
+
+  if (!obj_instanced_programID) {
+    obj_instanced_programID = LoadShaders( "ObjInstanced.vertexshader", "StandardShading.fragmentshader" );
+    obj_instanced_MatrixID = glGetUniformLocation(obj_instanced_programID, "MVP");
+    obj_instanced_ViewMatrixID = glGetUniformLocation(obj_instanced_programID, "V");
+    obj_instanced_ScaleID = glGetUniformLocation(obj_instanced_programID, "Scale");
+    obj_instanced_TextureID = glGetUniformLocation(obj_instanced_programID, "myTextureSampler");
+    obj_instanced_LightID = glGetUniformLocation(obj_instanced_programID, "LightPosition_worldspace");
+    glGenBuffers(1, &obj_instancebuffer);
+  }
+
+  Thread_Pool *pool = get_thread_pool();
+
+  int num_flockers = num_visible_flockers;
+  int grain = 4096;
+  int num_chunks = pool->num_chunks(0, num_creatures, grain);
+
+  // camera in creature coordinates, and pixels covered by one model unit at distance 1
+
+  glm::vec4 eye4 = glm::inverse(ViewMat * Model) * glm::vec4(0, 0, 0, 1);
+  glm::vec3 eye = glm::vec3(eye4.x, eye4.y, eye4.z);
+  float pixels_per_unit = obj_scale * 0.5f * win_h * ProjectionMat[1][1];
+
+  obj_instance_bucket.resize(num_creatures);
+  obj_instance_data.resize(3 * num_creatures);
+  obj_bucket_offsets.assign(num_chunks * NUM_OBJ_BUCKETS, 0);
+
+  pool->parallel_for(0, num_creatures, grain, [=](int begin, int end, int chunk) {
+      int *counts = &obj_bucket_offsets[chunk * NUM_OBJ_BUCKETS];
+      for (int i = begin; i < end; i++) {
+	float dist = glm::length(get_creature(visible_creatures[i])->position - eye);
+	int bucket = 2 * select_obj_lod(dist, pixels_per_unit) + (i >= num_flockers);
+	obj_instance_bucket[i] = bucket;
+	counts[bucket]++;
+      }
+    });
+
+  // counts -> offsets: bucket by bucket, then chunk by chunk inside a bucket
+
+  int bucket_first[NUM_OBJ_BUCKETS];
+  int bucket_count[NUM_OBJ_BUCKETS];
+  int total = 0;
+
+  for (int b = 0; b < NUM_OBJ_BUCKETS; b++) {
+    bucket_first[b] = total;
+    for (int c = 0; c < num_chunks; c++) {
+      int count = obj_bucket_offsets[c * NUM_OBJ_BUCKETS + b];
+      obj_bucket_offsets[c * NUM_OBJ_BUCKETS + b] = total;
+      total += count;
+    }
+    bucket_count[b] = total - bucket_first[b];
+  }
+
+  // same chunks as the counting pass, so each one fills exactly the slots it counted
+
+  pool->parallel_for(0, num_creatures, grain, [](int begin, int end, int chunk) {
+      int *next = &obj_bucket_offsets[chunk * NUM_OBJ_BUCKETS];
+      for (int i = begin; i < end; i++) {
+	glm::vec3 & p = get_creature(visible_creatures[i])->position;
+	GLfloat *q = &obj_instance_data[3 * next[obj_instance_bucket[i]]++];
+	q[0] = p.x;
+	q[1] = p.y;
+	q[2] = p.z;
+      }
+    });
+
+  glm::mat4 MVP = ProjectionMat * ViewMat * Model;
+  glm::vec3 lightPos = glm::vec3(4,4,4);
+
+  glUseProgram(obj_instanced_programID);
+  glUniformMatrix4fv(obj_instanced_MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  glUniformMatrix4fv(obj_instanced_ViewMatrixID, 1, GL_FALSE, &ViewMat[0][0]);
+  glUniform1f(obj_instanced_ScaleID, obj_scale);
+  glUniform3f(obj_instanced_LightID, lightPos.x, lightPos.y, lightPos.z);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(obj_instanced_TextureID, 0);
+
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, obj_vertexbuffer);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+  glEnableVertexAttribArray(1);
+  glBindBuffer(GL_ARRAY_BUFFER, obj_uvbuffer);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+  glEnableVertexAttribArray(2);
+  glBindBuffer(GL_ARRAY_BUFFER, obj_normalbuffer);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj_elementbuffer);
+
+  // one upload for all buckets; orphan last frame's storage first
+
+  glBindBuffer(GL_ARRAY_BUFFER, obj_instancebuffer);
+  glBufferData(GL_ARRAY_BUFFER, obj_instance_data.size() * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, obj_instance_data.size() * sizeof(GLfloat), &obj_instance_data[0]);
+
+  glEnableVertexAttribArray(3);
+  glVertexAttribDivisor(3, 1);
+
+  for (int b = 0; b < NUM_OBJ_BUCKETS; b++) {
+    if (bucket_count[b] == 0)
+      continue;
+
+    int lod = b / 2;
+
+    glBindTexture(GL_TEXTURE_2D, b % 2 ? pred_Texture : obj_Texture);
+    count_gl_call();
+
+    // no base instance in GL 3.3 -- point the instance attribute at the bucket instead
+
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)(3 * bucket_first[b] * sizeof(GLfloat)));
+
+    glDrawElementsInstanced(GL_TRIANGLES,
+			    obj_mesh.lod_num_indices[lod],
+			    obj_index_type,
+			    (void*)((size_t) obj_mesh.lod_first_index[lod] * obj_mesh.index_size),
+			    bucket_count[b]);
+  }
+
+  // the vertex array object is shared with every other draw path
+
+  glVertexAttribDivisor(3, 0);
+  glDisableVertexAttribArray(0);
+  glDisableVertexAttribArray(1);
+  glDisableVertexAttribArray(2);
+  glDisableVertexAttribArray(3);
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
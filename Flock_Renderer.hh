@@ -0,0 +1,46 @@
+#ifndef FLOCK_RENDERER_HH
+
+#define FLOCK_RENDERER_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// whole-flock draw paths: one draw call for all creatures instead of one each
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Creature.hh"
+#include "Flocker.hh"
+#include "Predator.hh"
+#include "Thread_Pool.hh"
+#include "Flock_Culler.hh"
+
+#include <common/shader.hpp>
+#include <common/meshcache.hpp>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define DEFAULT_DENSITY_GRID_RES       64     // cells along longest box side
+#define DEFAULT_DENSITY_OPACITY        0.15
+#define DEFAULT_POINT_SPRITE_SIZE      0.08   // world units
+#define DEFAULT_OBJ_LOD_PIXEL_ERROR    1.0    // how far (in pixels) a coarser mesh may stray before a finer one is used
+
+#define NUM_OBJ_BUCKETS                (2 * MESHCACHE_MAX_LODS)   // flockers and predators at each level of detail
+
+//----------------------------------------------------------------------------
+
+void initialize_flock_renderer();
+void delete_flock_renderer();
+
+void draw_flock_points(glm::mat4);
+void draw_flock_density(glm::mat4);
+void draw_flock_obj(glm::mat4);
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
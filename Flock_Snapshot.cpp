@@ -0,0 +1,535 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// flock snapshots: every creature's state, parameters and trail plus the
+// random number generator, as one versioned binary file of flat arrays.
+// written on the worker pool; read back by mapping the file
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Flock_Snapshot.hh"
+
+#include "Flock_World.hh"
+#include "Frame_Scheduler.hh"
+#include "Thread_Pool.hh"
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+extern int num_flockers;
+extern int num_predators;
+extern int flocker_history_length;
+
+extern vector <Flocker *> & flocker_array;
+extern vector <Predator *> & predator_array;
+
+extern float box_width;
+extern float box_height;
+extern float box_depth;
+
+// file layout: the header, then one flat array per field, each starting on a
+// 16 byte boundary.  per-creature arrays are in get_creature() order (flockers,
+// then predators); a creature's trail is history_length slots, newest first,
+// of which history_counts[i] are used
+
+struct Flock_Snapshot_Header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_flockers;
+  uint32_t num_predators;
+  uint32_t history_length;
+  uint16_t rng_state[3];                    // drand48's, as seed48() takes it
+  uint16_t reserved;
+  float box_size[3];                        // the box the flock lives in
+};
+
+struct Flock_Snapshot_Layout                // byte offsets into the file
+{
+  size_t positions;                         // glm::vec3 per creature
+  size_t velocities;                        // glm::vec3
+  size_t orientations;                      // glm::quat
+  size_t colors;                            // glm::vec3
+  size_t history_counts;                    // uint32_t
+  size_t histories;                         // glm::vec3 * history_length
+  size_t flocker_params;                    // Flocker_Snapshot_Params per flocker
+  size_t predator_params;                   // Predator_Snapshot_Params per predator
+  size_t size;
+};
+
+// one write at a time
+
+static mutex snapshot_mutex;
+static condition_variable snapshot_cv;
+static bool is_snapshot_writing = false;
+
+// autosave: at most one child at a time
+
+struct Flock_Autosave
+{
+  string filename;
+  double interval;                          // seconds; 0 -> off
+  double last_time;                         // when the last child was forked
+  pid_t child;                              // 0 -> none running
+  int num_forks;
+  int num_saves;                            // children that wrote their file
+  int num_skipped;                          // due, but the last child was still writing
+  double total_stall;                       // time spent in fork()
+  double max_stall;
+};
+
+static Flock_Autosave autosave = { "", 0.0, 0.0, 0, 0, 0, 0, 0.0, 0.0 };
+
+//----------------------------------------------------------------------------
+
+static size_t align16(size_t n)
+{
+  return (n + 15) & ~(size_t) 15;
+}
+
+//----------------------------------------------------------------------------
+
+static Flock_Snapshot_Layout snapshot_layout(const Flock_Snapshot_Header & header)
+{
+  Flock_Snapshot_Layout layout;
+  size_t n = (size_t) header.num_flockers + header.num_predators;
+
+  layout.positions = align16(sizeof(Flock_Snapshot_Header));
+  layout.velocities = align16(layout.positions + n * sizeof(glm::vec3));
+  layout.orientations = align16(layout.velocities + n * sizeof(glm::vec3));
+  layout.colors = align16(layout.orientations + n * sizeof(glm::quat));
+  layout.history_counts = align16(layout.colors + n * sizeof(glm::vec3));
+  layout.histories = align16(layout.history_counts + n * sizeof(uint32_t));
+  layout.flocker_params = align16(layout.histories + n * header.history_length * sizeof(glm::vec3));
+  layout.predator_params = align16(layout.flocker_params + header.num_flockers * sizeof(Flocker_Snapshot_Params));
+  layout.size = align16(layout.predator_params + header.num_predators * sizeof(Predator_Snapshot_Params));
+
+  return layout;
+}
+
+//----------------------------------------------------------------------------
+
+// written under a temporary name and renamed, so a restore never maps half a
+// file.  plain I/O only -- a forked autosave child calls this too
+
+static bool write_snapshot_image(const string & filename, const vector <char> & image)
+{
+  char suffix[32];
+  sprintf(suffix, ".tmp%i", (int) getpid());
+  string temp_path = filename + suffix;
+
+  FILE *fp = fopen(temp_path.c_str(), "wb");
+  bool is_written = fp && fwrite(&image[0], 1, image.size(), fp) == image.size();
+  if (fp)
+    is_written = !fclose(fp) && is_written;
+
+  if (!is_written || rename(temp_path.c_str(), filename.c_str())) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+static void write_snapshot_file(string filename, shared_ptr<vector <char> > image, int num_creatures, double gather_time)
+{
+  double start = get_monotonic_time();
+
+  if (!write_snapshot_image(filename, *image))
+    printf("could not write flock snapshot %s\n", filename.c_str());
+  else
+    printf("flock snapshot: %i creatures to %s (%.1f MB, gathered in %.1f ms, written in %.1f ms)\n",
+	   num_creatures, filename.c_str(), image->size() / 1048576.0, 1000.0 * gather_time, 1000.0 * (get_monotonic_time() - start));
+
+  lock_guard<mutex> lock(snapshot_mutex);
+  is_snapshot_writing = false;
+  snapshot_cv.notify_all();
+}
+
+//----------------------------------------------------------------------------
+
+// creatures [begin, end) into their slots of the file image
+
+static void gather_snapshot_creatures(char *p, const Flock_Snapshot_Layout & layout, int history_length, int begin, int end)
+{
+  glm::vec3 *positions = (glm::vec3 *) (p + layout.positions);
+  glm::vec3 *velocities = (glm::vec3 *) (p + layout.velocities);
+  glm::quat *orientations = (glm::quat *) (p + layout.orientations);
+  glm::vec3 *colors = (glm::vec3 *) (p + layout.colors);
+  uint32_t *history_counts = (uint32_t *) (p + layout.history_counts);
+  glm::vec3 *histories = (glm::vec3 *) (p + layout.histories);
+  Flocker_Snapshot_Params *flocker_params = (Flocker_Snapshot_Params *) (p + layout.flocker_params);
+  Predator_Snapshot_Params *predator_params = (Predator_Snapshot_Params *) (p + layout.predator_params);
+
+  int nf = flocker_array.size();
+
+  for (int i = begin; i < end; i++) {
+
+    Creature *c = get_creature(i);
+
+    positions[i] = c->position;
+    velocities[i] = c->velocity;
+    orientations[i] = c->orientation;
+    colors[i] = c->base_color;
+
+    int count = c->position_history.size() < history_length ? c->position_history.size() : history_length;
+    history_counts[i] = count;
+    for (int h = 0; h < count; h++)
+      histories[(size_t) i * history_length + h] = c->position_history[h];
+
+    if (i < nf) {
+      Flocker *f = flocker_array[i];
+      Flocker_Snapshot_Params & params = flocker_params[i];
+      params.random_force_limit = f->random_force_limit;
+      params.min_separation_distance = f->min_separation_distance;
+      params.max_separation_distance = f->max_separation_distance;
+      params.separation_weight = f->separation_weight;
+      params.min_alignment_distance = f->min_alignment_distance;
+      params.max_alignment_distance = f->max_alignment_distance;
+      params.alignment_weight = f->alignment_weight;
+      params.min_cohesion_distance = f->min_cohesion_distance;
+      params.max_cohesion_distance = f->max_cohesion_distance;
+      params.cohesion_weight = f->cohesion_weight;
+      params.min_fear_distance = f->min_fear_distance;
+      params.max_fear_distance = f->max_fear_distance;
+      params.fear_weight = f->fear_weight;
+    }
+    else {
+      Predator *pred = predator_array[i - nf];
+      Predator_Snapshot_Params & params = predator_params[i - nf];
+      params.random_force_limit = pred->random_force_limit;
+      params.min_hunger_distance = pred->min_hunger_distance;
+      params.max_hunger_distance = pred->max_hunger_distance;
+      params.hunger_weight = pred->hunger_weight;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+
+// the whole file image for the flock as it is now.  on the worker pool, or
+// (in a forked child, where the workers don't exist) all on this thread
+
+static void build_snapshot_image(vector <char> & image, bool is_parallel)
+{
+  Flock_Snapshot_Header header;
+  memset(&header, 0, sizeof(Flock_Snapshot_Header));
+  header.magic = FLOCK_SNAPSHOT_MAGIC;
+  header.version = FLOCK_SNAPSHOT_VERSION;
+  header.num_flockers = flocker_array.size();
+  header.num_predators = predator_array.size();
+  header.history_length = flocker_history_length;
+  header.box_size[0] = box_width;
+  header.box_size[1] = box_height;
+  header.box_size[2] = box_depth;
+
+  // seed48() is the only way to read drand48's state -- put it straight back
+
+  unsigned short probe[3] = { 0, 0, 0 };
+  memcpy(header.rng_state, seed48(probe), sizeof(header.rng_state));
+  seed48(header.rng_state);
+
+  Flock_Snapshot_Layout layout = snapshot_layout(header);
+  image.assign(layout.size, 0);
+  char *p = &image[0];
+
+  memcpy(p, &header, sizeof(Flock_Snapshot_Header));
+
+  int num_creatures = header.num_flockers + header.num_predators;
+  int history_length = header.history_length;
+
+  if (is_parallel)
+    get_thread_pool()->parallel_for(0, num_creatures, FLOCK_SNAPSHOT_GRAIN, [p, &layout, history_length](int begin, int end, int chunk) {
+	gather_snapshot_creatures(p, layout, history_length, begin, end);
+      });
+  else
+    gather_snapshot_creatures(p, layout, history_length, 0, num_creatures);
+}
+
+//----------------------------------------------------------------------------
+
+// the flock is copied into the file image here (on the pool, but blocking) so
+// the simulation can carry on while the image goes to disk
+
+bool save_flock_snapshot(const char *filename)
+{
+  {
+    lock_guard<mutex> lock(snapshot_mutex);
+    if (is_snapshot_writing) {
+      printf("still writing the last flock snapshot\n");
+      return false;
+    }
+    is_snapshot_writing = true;
+  }
+
+  double start = get_monotonic_time();
+
+  shared_ptr<vector <char> > image(new vector <char>);
+  build_snapshot_image(*image, true);
+
+  int num_creatures = flocker_array.size() + predator_array.size();
+  double gather_time = get_monotonic_time() - start;
+  string path = filename;
+
+  get_thread_pool()->submit([path, image, num_creatures, gather_time] {
+      write_snapshot_file(path, image, num_creatures, gather_time);
+    });
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+// help out with queued tasks while waiting -- with no workers the write only
+// ever runs on this thread
+
+void finish_flock_snapshots()
+{
+  Thread_Pool *pool = get_thread_pool();
+
+  while (true) {
+    {
+      lock_guard<mutex> lock(snapshot_mutex);
+      if (!is_snapshot_writing)
+	return;
+    }
+
+    if (!pool->run_pending_task()) {
+      unique_lock<mutex> lock(snapshot_mutex);
+      snapshot_cv.wait(lock, [] { return !is_snapshot_writing; });
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+
+// everything the constructor doesn't set, straight from the arrays
+
+static void restore_creature_state(Creature *c, const char *image, const Flock_Snapshot_Layout & layout,
+				   int history_length, int i)
+{
+  c->orientation = ((const glm::quat *) (image + layout.orientations))[i];
+
+  c->update_frame();     // local axes -- its history entry is replaced below
+
+  const glm::vec3 *history = (const glm::vec3 *) (image + layout.histories) + (size_t) i * history_length;
+  int count = ((const uint32_t *) (image + layout.history_counts))[i];
+
+  c->position_history.assign(history, history + count);
+}
+
+//----------------------------------------------------------------------------
+
+bool restore_flock_snapshot(const char *filename)
+{
+  double start = get_monotonic_time();
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("could not open flock snapshot %s\n", filename);
+    return false;
+  }
+
+  struct stat st;
+  char *image = (char *) MAP_FAILED;
+  if (!fstat(fd, &st) && st.st_size >= (off_t) sizeof(Flock_Snapshot_Header))
+    image = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (image == MAP_FAILED) {
+    printf("could not map flock snapshot %s\n", filename);
+    return false;
+  }
+
+  // read front to back, once
+
+  madvise(image, st.st_size, MADV_SEQUENTIAL);
+
+  Flock_Snapshot_Header header;
+  memcpy(&header, image, sizeof(Flock_Snapshot_Header));
+  Flock_Snapshot_Layout layout = snapshot_layout(header);
+
+  if (header.magic != FLOCK_SNAPSHOT_MAGIC || header.version != FLOCK_SNAPSHOT_VERSION || layout.size != (size_t) st.st_size) {
+    printf("%s is not a version %i flock snapshot\n", filename, FLOCK_SNAPSHOT_VERSION);
+    munmap(image, st.st_size);
+    return false;
+  }
+
+  if (header.box_size[0] != box_width || header.box_size[1] != box_height || header.box_size[2] != box_depth) {
+    printf("%s was taken in a %g x %g x %g box\n", filename, header.box_size[0], header.box_size[1], header.box_size[2]);
+    munmap(image, st.st_size);
+    return false;
+  }
+
+  const glm::vec3 *positions = (const glm::vec3 *) (image + layout.positions);
+  const glm::vec3 *velocities = (const glm::vec3 *) (image + layout.velocities);
+  const glm::vec3 *colors = (const glm::vec3 *) (image + layout.colors);
+  const Flocker_Snapshot_Params *flocker_params = (const Flocker_Snapshot_Params *) (image + layout.flocker_params);
+  const Predator_Snapshot_Params *predator_params = (const Predator_Snapshot_Params *) (image + layout.predator_params);
+
+  int i;
+
+  flock_world.clear();
+
+  num_flockers = header.num_flockers;
+  num_predators = header.num_predators;
+  flocker_history_length = header.history_length;
+
+  // constructors make the GL buffers, so this part stays on the GL thread
+
+  flocker_array.reserve(num_flockers);
+  for (i = 0; i < num_flockers; i++) {
+    const Flocker_Snapshot_Params & params = flocker_params[i];
+    Flocker *f = new Flocker(i,
+			     positions[i].x, positions[i].y, positions[i].z,
+			     velocities[i].x, velocities[i].y, velocities[i].z,
+			     params.random_force_limit,
+			     params.min_separation_distance, params.max_separation_distance, params.separation_weight,
+			     params.min_alignment_distance, params.max_alignment_distance, params.alignment_weight,
+			     params.min_cohesion_distance, params.max_cohesion_distance, params.cohesion_weight,
+			     params.min_fear_distance, params.max_fear_distance, params.fear_weight,
+			     colors[i].r, colors[i].g, colors[i].b,
+			     flocker_history_length);
+    restore_creature_state(f, image, layout, flocker_history_length, i);
+    flock_world.add_flocker(f);
+  }
+
+  predator_array.reserve(num_predators);
+  for (i = 0; i < num_predators; i++) {
+    const Predator_Snapshot_Params & params = predator_params[i];
+    int k = num_flockers + i;
+    Predator *pred = new Predator(i,
+				  positions[k].x, positions[k].y, positions[k].z,
+				  velocities[k].x, velocities[k].y, velocities[k].z,
+				  params.min_hunger_distance, params.max_hunger_distance, params.hunger_weight,
+				  colors[k].r, colors[k].g, colors[k].b,
+				  flocker_history_length);
+    pred->random_force_limit = params.random_force_limit;
+    restore_creature_state(pred, image, layout, flocker_history_length, k);
+    flock_world.add_predator(pred);
+  }
+
+  // same tables initialize_flocking_simulation() makes, and the same random
+  // numbers from here on as the run that was saved
+
+  flock_world.resize_distance_tables();
+
+  seed48(header.rng_state);
+
+  munmap(image, st.st_size);
+
+  printf("flock snapshot: %i flockers and %i predators from %s (%.1f ms)\n",
+	 num_flockers, num_predators, filename, 1000.0 * (get_monotonic_time() - start));
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+void start_flock_autosave(const char *filename, double interval)
+{
+  autosave.filename = filename;
+  autosave.interval = interval;
+  autosave.last_time = get_monotonic_time();
+}
+
+//----------------------------------------------------------------------------
+
+// collect the child, if it's done (or wait for it).  its exit status says
+// whether the file made it
+
+static void reap_flock_autosave(bool wait)
+{
+  if (!autosave.child)
+    return;
+
+  int status;
+  pid_t pid = waitpid(autosave.child, &status, wait ? 0 : WNOHANG);
+  if (pid == 0)
+    return;
+
+  if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+    printf("autosave to %s failed\n", autosave.filename.c_str());
+  else
+    autosave.num_saves++;
+
+  autosave.child = 0;
+}
+
+//----------------------------------------------------------------------------
+
+// the child has only this thread -- no worker pool, no GL, and it must leave
+// with _exit() so none of the parent's destructors or stdio buffers run twice
+
+void update_flock_autosave()
+{
+  if (autosave.interval <= 0.0)
+    return;
+
+  reap_flock_autosave(false);
+
+  double now = get_monotonic_time();
+  if (now - autosave.last_time < autosave.interval)
+    return;
+
+  autosave.last_time = now;
+
+  if (autosave.child) {
+    autosave.num_skipped++;
+    return;
+  }
+
+  fflush(stdout);
+
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    vector <char> image;
+    build_snapshot_image(image, false);
+    _exit(write_snapshot_image(autosave.filename, image) ? 0 : 1);
+  }
+
+  double stall = get_monotonic_time() - now;
+  autosave.total_stall += stall;
+  if (stall > autosave.max_stall)
+    autosave.max_stall = stall;
+
+  if (pid < 0)
+    printf("could not fork for autosave\n");
+  else {
+    autosave.child = pid;
+    autosave.num_forks++;
+  }
+}
+
+//----------------------------------------------------------------------------
+
+void finish_flock_autosave()
+{
+  if (autosave.interval <= 0.0)
+    return;
+
+  reap_flock_autosave(true);
+
+  printf("autosave: %i of %i saves to %s written, %i skipped (still writing); fork stall %.3f ms mean, %.3f ms max\n",
+	 autosave.num_saves, autosave.num_forks, autosave.filename.c_str(), autosave.num_skipped,
+	 autosave.num_forks ? 1000.0 * autosave.total_stall / autosave.num_forks : 0.0, 1000.0 * autosave.max_stall);
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
@@ -0,0 +1,82 @@
+#ifndef FLOCK_SNAPSHOT_HH
+
+#define FLOCK_SNAPSHOT_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// flock snapshots: every creature's state, parameters and trail plus the
+// random number generator, as one versioned binary file of flat arrays.
+// written on the worker pool; read back by mapping the file
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "Flocker.hh"
+#include "Predator.hh"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define FLOCK_SNAPSHOT_MAGIC         0x4b434c46   // "FLCK"
+#define FLOCK_SNAPSHOT_VERSION       1
+#define FLOCK_SNAPSHOT_FILE          "flock.snapshot"   // default for key N
+#define FLOCK_SNAPSHOT_GRAIN         4096     // creatures per worker pool chunk when gathering
+#define FLOCK_AUTOSAVE_FILE          "autosave.snapshot"
+
+//----------------------------------------------------------------------------
+
+// the behavior parameters a creature was constructed with -- the squared and
+// inverse-range distances are worked out again by the constructors
+
+struct Flocker_Snapshot_Params
+{
+  double random_force_limit;
+  double min_separation_distance, max_separation_distance, separation_weight;
+  double min_alignment_distance, max_alignment_distance, alignment_weight;
+  double min_cohesion_distance, max_cohesion_distance, cohesion_weight;
+  double min_fear_distance, max_fear_distance, fear_weight;
+};
+
+struct Predator_Snapshot_Params
+{
+  double random_force_limit;
+  double min_hunger_distance, max_hunger_distance, hunger_weight;
+};
+
+//----------------------------------------------------------------------------
+
+// gathers the flock right away, then hands the file to the worker pool --
+// false if a snapshot is already being written
+
+bool save_flock_snapshot(const char *);
+
+// replaces flocker_array and predator_array (and their counts, the history
+// length and drand48's state) with the snapshot's.  false if the file is
+// missing, from another version or for a different box
+
+bool restore_flock_snapshot(const char *);
+
+void finish_flock_snapshots();              // wait for any write still going -- at exit
+
+// periodic autosave in a forked child, which snapshots the frozen copy-on-write
+// image of the flock while this process keeps stepping.  the only stall is
+// fork() itself
+
+void start_flock_autosave(const char *, double);   // file, seconds between saves
+void update_flock_autosave();               // once per frame: reap a finished save, fork the next when due
+void finish_flock_autosave();               // wait for the last save and report the stalls -- at exit
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
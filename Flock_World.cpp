@@ -0,0 +1,211 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// flock worlds: the creatures, their distance tables, the box they wrap
+// around in and a random number stream -- everything one flocking step
+// touches.  the app simulates flock_world; others can step independently
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Flock_World.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define RANDOM_MULTIPLIER   0x5deece66dULL  // drand48's
+#define RANDOM_INCREMENT    0xb
+#define RANDOM_MASK         ((1ULL << 48) - 1)
+
+//----------------------------------------------------------------------------
+
+const Behavior_Weight_Range behavior_weight_ranges[NUM_BEHAVIOR_WEIGHTS] = {
+  { "separation_weight", 0.01,   0.03  },
+  { "alignment_weight",  0.0005, 0.002 },
+  { "cohesion_weight",   0.0005, 0.002 },
+  { "fear_weight",       0.0005, 0.4   },
+  { "hunger_weight",     0.005,  0.02  },
+};
+
+//----------------------------------------------------------------------------
+
+Flock_World flock_world;
+
+// the rest of the app still knows flock_world by these names
+
+vector <Flocker *> & flocker_array = flock_world.flockers;
+vector <Predator *> & predator_array = flock_world.predators;
+vector <vector <double> > & flocker_squared_distance = flock_world.flocker_squared_distance;
+vector <vector <double> > & p_to_f_squared_distance = flock_world.p_to_f_squared_distance;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+Flock_World::Flock_World()
+{
+  box_size = glm::vec3(1.0f, 1.0f, 1.0f);
+  is_parallel = true;
+  has_own_random = false;
+  random_state = 0;
+}
+
+//----------------------------------------------------------------------------
+
+// the seed is scrambled first (splitmix64's finalizer) -- consecutive seeds
+// would otherwise start consecutive worlds off with nearly the same numbers
+
+void Flock_World::seed_random(uint64_t seed)
+{
+  seed += 0x9e3779b97f4a7c15ULL;
+  seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+  seed ^= seed >> 31;
+
+  random_state = seed & RANDOM_MASK;
+  has_own_random = true;
+}
+
+//----------------------------------------------------------------------------
+
+// random float in range [lower, upper]
+
+double Flock_World::uniform_random(double lower, double upper)
+{
+  if (!has_own_random)
+    return ::uniform_random(lower, upper);
+
+  random_state = (RANDOM_MULTIPLIER * random_state + RANDOM_INCREMENT) & RANDOM_MASK;
+
+  return lower + (upper - lower) * ((double) random_state / (double) (1ULL << 48));
+}
+
+//----------------------------------------------------------------------------
+
+// position, then velocity, then weights, each in its own statement -- the
+// order of evaluation of a call's arguments is up to the compiler, and a
+// seeded flock should come out the same whichever one built it
+
+Flocker *Flock_World::new_flocker(int index, const double *weights, int history_length)
+{
+  glm::vec3 p, v;
+  double w[NUM_BEHAVIOR_WEIGHTS];
+  int k;
+
+  for (k = 0; k < 3; k++)
+    p[k] = uniform_random(0, box_size[k]);
+  for (k = 0; k < 3; k++)
+    v[k] = uniform_random(-0.01, 0.01);
+  for (k = BEHAVIOR_SEPARATION; k <= BEHAVIOR_FEAR; k++)
+    w[k] = weights ? weights[k] : uniform_random(behavior_weight_ranges[k].lower, behavior_weight_ranges[k].upper);
+
+  return new Flocker(index,
+		     p.x, p.y, p.z,
+		     v.x, v.y, v.z,
+		     0.002,            // randomness
+		     0.05, 0.5, w[BEHAVIOR_SEPARATION],  // min, max separation distance, weight
+		     0.5,  1.0, w[BEHAVIOR_ALIGNMENT],   // min, max alignment distance, weight
+		     1.0,  1.5, w[BEHAVIOR_COHESION],    // min, max cohesion distance, weight
+		     0.0,  1.0, w[BEHAVIOR_FEAR],        // min, max fear distance, weight
+		     1.0,  1.0, 1.0,
+		     history_length);
+}
+
+//----------------------------------------------------------------------------
+
+Predator *Flock_World::new_predator(int index, const double *weights, int history_length)
+{
+  glm::vec3 p, v;
+  double hunger;
+  int k;
+
+  for (k = 0; k < 3; k++)
+    p[k] = uniform_random(0, box_size[k]);
+  for (k = 0; k < 3; k++)
+    v[k] = uniform_random(-0.01, 0.01);
+  hunger = weights ? weights[BEHAVIOR_HUNGER]
+    : uniform_random(behavior_weight_ranges[BEHAVIOR_HUNGER].lower, behavior_weight_ranges[BEHAVIOR_HUNGER].upper);
+
+  return new Predator(index,
+		      p.x, p.y, p.z,
+		      v.x, v.y, v.z,
+		      0.1,  1.5, hunger,  // min, max hunger distance, weight
+		      1.0,  1.0, 1.0,
+		      history_length);
+}
+
+//----------------------------------------------------------------------------
+
+void Flock_World::add_flocker(Flocker *f)
+{
+  f->world = this;
+  flockers.push_back(f);
+}
+
+//----------------------------------------------------------------------------
+
+void Flock_World::add_predator(Predator *p)
+{
+  p->world = this;
+  predators.push_back(p);
+}
+
+//----------------------------------------------------------------------------
+
+void Flock_World::clear()
+{
+  int i;
+
+  for (i = 0; i < flockers.size(); i++)
+    delete flockers[i];
+  for (i = 0; i < predators.size(); i++)
+    delete predators[i];
+
+  flockers.clear();
+  predators.clear();
+  flocker_squared_distance.clear();
+  p_to_f_squared_distance.clear();
+}
+
+//----------------------------------------------------------------------------
+
+void Flock_World::resize_distance_tables()
+{
+  flocker_squared_distance.assign(flockers.size(), vector <double>(flockers.size()));
+  p_to_f_squared_distance.assign(predators.size(), vector <double>(flockers.size()));
+}
+
+//----------------------------------------------------------------------------
+
+// every creature works out its next state from everyone's current one, then
+// they all move at once
+
+void Flock_World::step()
+{
+  int i;
+
+  // precalculate inter-flocker distances
+
+  calculate_flocker_squared_distances(this);
+  calculate_p_to_f_squared_distances(this);
+
+  // get new_position, new_velocity for each flocker
+
+  for (i = 0; i < flockers.size(); i++)
+    flockers[i]->update();
+
+  for (i = 0; i < predators.size(); i++)
+    predators[i]->update();
+
+  // handle wrapping and make new position, velocity into current
+
+  for (i = 0; i < flockers.size(); i++)
+    flockers[i]->finalize_update(box_size.x, box_size.y, box_size.z);
+
+  for (i = 0; i < predators.size(); i++)
+    predators[i]->finalize_update(box_size.x, box_size.y, box_size.z);
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
@@ -0,0 +1,105 @@
+#ifndef FLOCK_WORLD_HH
+
+#define FLOCK_WORLD_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// flock worlds: the creatures, their distance tables, the box they wrap
+// around in and a random number stream -- everything one flocking step
+// touches.  the app simulates flock_world; others can step independently
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#include "Flocker.hh"
+#include "Predator.hh"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+// the behavior weights that differ from creature to creature -- flockers have
+// the first four, predators only hunger
+
+#define BEHAVIOR_SEPARATION          0
+#define BEHAVIOR_ALIGNMENT           1
+#define BEHAVIOR_COHESION            2
+#define BEHAVIOR_FEAR                3
+#define BEHAVIOR_HUNGER              4
+#define NUM_BEHAVIOR_WEIGHTS         5
+
+struct Behavior_Weight_Range
+{
+  const char *name;
+  double lower, upper;                      // random creatures draw from [lower, upper]
+};
+
+extern const Behavior_Weight_Range behavior_weight_ranges[NUM_BEHAVIOR_WEIGHTS];
+
+//----------------------------------------------------------------------------
+
+struct Flock_World
+{
+  vector <Flocker *> flockers;
+  vector <Predator *> predators;
+  vector <vector <double> > flocker_squared_distance;    // upper triangle: [i][j], i < j
+  vector <vector <double> > p_to_f_squared_distance;     // [predator][flocker]
+
+  glm::vec3 box_size;                       // creatures wrap around in [0, box_size]
+
+  // flock_world steps on the worker pool and draws from drand48, so snapshots
+  // and seeded benchmarks carry on as before.  a world with its own stream
+  // can be stepped on any thread alongside others
+
+  bool is_parallel;
+  bool has_own_random;
+  uint64_t random_state;                    // 48 bits, same generator as drand48
+
+  Flock_World();
+
+  void seed_random(uint64_t);               // switches to the world's own stream
+  double uniform_random(double, double);
+
+  // a creature anywhere in the box with a small random velocity, drawn from
+  // the world's stream.  weights are indexed by BEHAVIOR_* -- NULL draws
+  // random ones, so every creature gets its own "personality".  the world
+  // doesn't take it until add_flocker() / add_predator()
+
+  Flocker *new_flocker(int, const double * = NULL, int = 1);     // index, weights, history length
+  Predator *new_predator(int, const double * = NULL, int = 1);
+
+  void add_flocker(Flocker *);
+  void add_predator(Predator *);
+  void clear();                             // deletes the creatures -- nothing else does
+  void resize_distance_tables();
+
+  void step();                              // one flocking step for every creature
+};
+
+//----------------------------------------------------------------------------
+
+extern Flock_World flock_world;             // the one on screen
+
+extern vector <Flocker *> & flocker_array;  // flock_world's, by their old names
+extern vector <Predator *> & predator_array;
+
+// flockers first, then predators -- same order as the Bullet side
+
+inline Creature *get_creature(int i)
+{
+  if (i < flocker_array.size())
+    return flocker_array[i];
+  else
+    return predator_array[i - flocker_array.size()];
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
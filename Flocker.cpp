@@ -12,17 +12,15 @@
 //----------------------------------------------------------------------------
 
 #include "Flocker.hh"
+#include "Flock_World.hh"
+#include "Render_Bench.hh"
+#include "Thread_Pool.hh"
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
 
 int flocker_history_length = 30;
 int flocker_draw_mode = DRAW_MODE_POLY;
-vector <Flocker *> flocker_array;    
-vector <vector <double> > flocker_squared_distance;
-
-extern vector <Predator *> predator_array;
-extern vector <vector <double> > p_to_f_squared_distance;
 
 extern glm::mat4 ViewMat;
 extern glm::mat4 ProjectionMat;
@@ -42,24 +40,34 @@ extern GLuint obj_vertexbuffer;
 extern GLuint obj_uvbuffer;
 extern GLuint obj_normalbuffer;
 extern GLuint obj_elementbuffer;
-extern vector<unsigned short> obj_indices;
+extern float obj_scale;
+extern GLsizei obj_num_indices;
+extern GLenum obj_index_type;
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
 
 // attempt to be slightly efficient by pre-calculating all of the distances between
-// pairs of flockers exactly once
+// pairs of flockers exactly once.  rows are independent, so they go to the worker
+// pool -- unless the world is one of many being stepped there at once
 
-void calculate_flocker_squared_distances()
+void calculate_flocker_squared_distances(Flock_World *world)
 {
-  int i, j;
-  glm::vec3 diff;
-
-  for (i = 0; i < flocker_array.size(); i++)
-    for (j = i + 1; j < flocker_array.size(); j++) {
-      diff = flocker_array[i]->position - flocker_array[j]->position;
-      flocker_squared_distance[i][j] = glm::length2(diff);
-    }
+  vector <Flocker *> & flockers = world->flockers;
+  vector <vector <double> > & distance = world->flocker_squared_distance;
+
+  auto rows = [&flockers, &distance](int begin, int end, int chunk) {
+    for (int i = begin; i < end; i++)
+      for (int j = i + 1; j < flockers.size(); j++) {
+	glm::vec3 diff = flockers[i]->position - flockers[j]->position;
+	distance[i][j] = glm::length2(diff);
+      }
+  };
+
+  if (world->is_parallel)
+    get_thread_pool()->parallel_for(0, flockers.size(), DISTANCE_ROW_GRAIN, rows);
+  else
+    rows(0, flockers.size(), 0);
 }
 
 //----------------------------------------------------------------------------
@@ -132,9 +140,10 @@ void Flocker::draw(glm::mat4 Model)
     glm::vec3 lightPos = glm::vec3(4,4,4);
     glUniform3f(objLightID, lightPos.x, lightPos.y, lightPos.z);
 
-    glm::mat4 RotationMatrix = glm::mat4(); // identity    -- glm::toMat4(quat_orientations[i]);
+    glm::mat4 RotationMatrix = glm::mat4(); // identity    -- glm::toMat4(orientation);
     glm::mat4 TranslationMatrix = translate(glm::mat4(), glm::vec3(position.x, position.y, position.z));
-    glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix;
+    glm::mat4 ScaleMatrix = glm::scale(glm::mat4(), glm::vec3(obj_scale));
+    glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix * ScaleMatrix;
 
     glm::mat4 MVP = ProjectionMat * ViewMat * Model * ModelMatrix;
 
@@ -147,6 +156,7 @@ void Flocker::draw(glm::mat4 Model)
     // Bind this object's texture in Texture Unit 0
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, obj_Texture);
+    count_gl_call();
     // Set our "myTextureSampler" sampler to use Texture Unit 0
     glUniform1i(objTextureID, 0);
 
@@ -192,10 +202,11 @@ void Flocker::draw(glm::mat4 Model)
     // Draw the triangles !
     glDrawElements(
 		   GL_TRIANGLES,      // mode
-		   obj_indices.size(),    // count
-		   GL_UNSIGNED_SHORT,   // type
+		   obj_num_indices,    // count
+		   obj_index_type,   // type
 		   (void*)0           // element array buffer offset
 		   );
+    count_gl_draw(GL_TRIANGLES, obj_num_indices);
       
 
     glDisableVertexAttribArray(0);
@@ -404,6 +415,8 @@ void Flocker::draw(glm::mat4 Model)
   
   // 1st attribute buffer : vertices
   
+  require_buffers();
+
   glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
   glBufferData(GL_ARRAY_BUFFER, 3 * num_vertices * sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW);
   
@@ -435,6 +448,7 @@ void Flocker::draw(glm::mat4 Model)
   // Draw the flocker!
   
   glDrawArrays(draw_mode, 0, num_vertices); 
+  count_gl_draw(draw_mode, num_vertices);
   
   glDisableVertexAttribArray(0);
   glDisableVertexAttribArray(1);
@@ -461,31 +475,31 @@ bool Flocker::compute_separation_force()
 
   separation_force = glm::vec3(0, 0, 0);
 
-  for (j = index + 1; j < flocker_squared_distance.size(); j++)
-    if (flocker_squared_distance[index][j] >= min_squared_separation_distance &&
-	flocker_squared_distance[index][j] <= max_squared_separation_distance) {
+  for (j = index + 1; j < world->flocker_squared_distance.size(); j++)
+    if (world->flocker_squared_distance[index][j] >= min_squared_separation_distance &&
+	world->flocker_squared_distance[index][j] <= max_squared_separation_distance) {
 
       // set (unweighted) force magnitude
 
-      F = max_squared_separation_distance / flocker_squared_distance[index][j] - 1.0;
+      F = max_squared_separation_distance / world->flocker_squared_distance[index][j] - 1.0;
 
       // set force direction
 
-      direction = (float) F * glm::normalize(position - flocker_array[j]->position);
+      direction = (float) F * glm::normalize(position - world->flockers[j]->position);
       separation_force += direction;
       count++;
     }
   for (j = index - 1; j >= 0; j--)
-    if (flocker_squared_distance[j][index] >= min_squared_separation_distance && 
-	flocker_squared_distance[j][index] <= max_squared_separation_distance) {
+    if (world->flocker_squared_distance[j][index] >= min_squared_separation_distance && 
+	world->flocker_squared_distance[j][index] <= max_squared_separation_distance) {
 
       // set (unweighted) force magnitude
 
-      F = max_squared_separation_distance / flocker_squared_distance[j][index] - 1.0;
+      F = max_squared_separation_distance / world->flocker_squared_distance[j][index] - 1.0;
 
       // set force direction
 
-      direction = (float) F * glm::normalize(position - flocker_array[j]->position);
+      direction = (float) F * glm::normalize(position - world->flockers[j]->position);
       separation_force += direction;
       count++;
     }
@@ -516,33 +530,33 @@ bool Flocker::compute_alignment_force()
 
   alignment_force = glm::vec3(0, 0, 0);
 
-  for (j = index + 1; j < flocker_squared_distance.size(); j++)
-    if (flocker_squared_distance[index][j] >= min_squared_alignment_distance &&
-	flocker_squared_distance[index][j] <= max_squared_alignment_distance) {
+  for (j = index + 1; j < world->flocker_squared_distance.size(); j++)
+    if (world->flocker_squared_distance[index][j] >= min_squared_alignment_distance &&
+	world->flocker_squared_distance[index][j] <= max_squared_alignment_distance) {
 
       // set (unweighted) force magnitude
 
-      percent = (flocker_squared_distance[index][j] - max_squared_alignment_distance) * inv_range_squared_alignment_distance;
+      percent = (world->flocker_squared_distance[index][j] - max_squared_alignment_distance) * inv_range_squared_alignment_distance;
       F = 0.5 + -0.5 * cos(percent * 2.0 * M_PI);
 
       // set force direction
 
-      direction = (float) F * glm::normalize(flocker_array[j]->velocity);
+      direction = (float) F * glm::normalize(world->flockers[j]->velocity);
       alignment_force += direction;
       count++;
     }
   for (j = index - 1; j >= 0; j--)
-    if (flocker_squared_distance[j][index] >= min_squared_alignment_distance &&
-	flocker_squared_distance[j][index] <= max_squared_alignment_distance) {
+    if (world->flocker_squared_distance[j][index] >= min_squared_alignment_distance &&
+	world->flocker_squared_distance[j][index] <= max_squared_alignment_distance) {
 
       // set (unweighted) force magnitude
 
-      percent = (flocker_squared_distance[index][j] - max_squared_alignment_distance) * inv_range_squared_alignment_distance;
+      percent = (world->flocker_squared_distance[index][j] - max_squared_alignment_distance) * inv_range_squared_alignment_distance;
       F = 0.5 + -0.5 * cos(percent * 2.0 * M_PI);
 
       // set force direction
 
-      direction = (float) F * glm::normalize(flocker_array[j]->velocity);
+      direction = (float) F * glm::normalize(world->flockers[j]->velocity);
       alignment_force += direction;
       count++;
     }
@@ -573,33 +587,33 @@ bool Flocker::compute_cohesion_force()
 
   cohesion_force = glm::vec3(0, 0, 0);
 
-  for (j = index + 1; j < flocker_squared_distance.size(); j++)
-    if (flocker_squared_distance[index][j] >= min_squared_cohesion_distance &&
-	flocker_squared_distance[index][j] <= max_squared_cohesion_distance) {
+  for (j = index + 1; j < world->flocker_squared_distance.size(); j++)
+    if (world->flocker_squared_distance[index][j] >= min_squared_cohesion_distance &&
+	world->flocker_squared_distance[index][j] <= max_squared_cohesion_distance) {
 
       // set (unweighted) force magnitude
 
-      percent = (flocker_squared_distance[index][j] - max_squared_cohesion_distance) * inv_range_squared_cohesion_distance;
+      percent = (world->flocker_squared_distance[index][j] - max_squared_cohesion_distance) * inv_range_squared_cohesion_distance;
       F = 0.5 + -0.5 * cos(percent * 2.0 * M_PI);
 
       // set force direction
 
-      direction = (float) F * glm::normalize(flocker_array[j]->position - position);   // opposite direction of separation
+      direction = (float) F * glm::normalize(world->flockers[j]->position - position);   // opposite direction of separation
       cohesion_force += direction;
       count++;
     }
   for (j = index - 1; j >= 0; j--)
-    if (flocker_squared_distance[j][index] >= min_squared_cohesion_distance &&
-	flocker_squared_distance[j][index] <= max_squared_cohesion_distance) {
+    if (world->flocker_squared_distance[j][index] >= min_squared_cohesion_distance &&
+	world->flocker_squared_distance[j][index] <= max_squared_cohesion_distance) {
 
       // set (unweighted) force magnitude
 
-      percent = (flocker_squared_distance[index][j] - max_squared_cohesion_distance) * inv_range_squared_cohesion_distance;
+      percent = (world->flocker_squared_distance[index][j] - max_squared_cohesion_distance) * inv_range_squared_cohesion_distance;
       F = 0.5 + -0.5 * cos(percent * 2.0 * M_PI);
 
       // set force direction
 
-      direction = (float) F * glm::normalize(flocker_array[j]->position - position);   // opposite direction of separation
+      direction = (float) F * glm::normalize(world->flockers[j]->position - position);   // opposite direction of separation
       cohesion_force += direction;
       count++;
     }
@@ -630,18 +644,18 @@ bool Flocker::compute_fear_force() {
   fear_force = glm::vec3(0, 0, 0);
 
   double min;
-  for (pred_index = 0; pred_index < p_to_f_squared_distance.size(); pred_index++)
-    if (p_to_f_squared_distance[pred_index][index] >= min_squared_fear_distance &&
-	p_to_f_squared_distance[pred_index][index] <= max_squared_fear_distance) {
+  for (pred_index = 0; pred_index < world->p_to_f_squared_distance.size(); pred_index++)
+    if (world->p_to_f_squared_distance[pred_index][index] >= min_squared_fear_distance &&
+	world->p_to_f_squared_distance[pred_index][index] <= max_squared_fear_distance) {
 
       // set (unweighted) force magnitude
 
-      percent = (p_to_f_squared_distance[pred_index][index] - max_squared_fear_distance) * inv_range_squared_fear_distance;
+      percent = (world->p_to_f_squared_distance[pred_index][index] - max_squared_fear_distance) * inv_range_squared_fear_distance;
       F = 0.5 + -0.5 * cos(percent * 2.0 * M_PI);
 
       // set force direction
 
-      direction = (float) F * glm::normalize(position - predator_array[pred_index]->position);   // opposite direction of fear
+      direction = (float) F * glm::normalize(position - world->predators[pred_index]->position);   // opposite direction of fear
       fear_force += direction;
       count++;
     }
@@ -658,7 +672,10 @@ bool Flocker::compute_fear_force() {
 
 // apply physics
 
-void Flocker::update()
+// only reads the distance tables and other creatures' states, so the whole
+// flock can do this at once
+
+void Flocker::compute_steering()
 {
   // set accelerations (aka forces)
 
@@ -688,13 +705,20 @@ void Flocker::update()
     
   if (glm::length(fear_force) > 0.0f)
     draw_color = glm::vec3(1.0f, 0.063f, 0.941f);
+}
+
+//----------------------------------------------------------------------------
+
+void Flocker::update()
+{
+  compute_steering();
 
   // randomness
 
   if (random_force_limit > 0.0) {
-    acceleration.x += uniform_random(-random_force_limit, random_force_limit);
-    acceleration.y += uniform_random(-random_force_limit, random_force_limit);
-    acceleration.z += uniform_random(-random_force_limit, random_force_limit);
+    acceleration.x += world->uniform_random(-random_force_limit, random_force_limit);
+    acceleration.y += world->uniform_random(-random_force_limit, random_force_limit);
+    acceleration.z += world->uniform_random(-random_force_limit, random_force_limit);
   }
 
   // update velocity
@@ -23,10 +23,15 @@
 
 #define MAX_FLOCKER_SPEED           0.04
 
+#define DISTANCE_ROW_GRAIN          16    // distance table rows per worker pool chunk
+#define DISTANCE_COLUMN_GRAIN       1024  // flockers per chunk when filling one predator's row
+
 #define DRAW_MODE_HISTORY           0
 #define DRAW_MODE_AXES              1
 #define DRAW_MODE_POLY              2
 #define DRAW_MODE_OBJ               3
+#define DRAW_MODE_POINTS            4   // whole flock as point sprites, one draw call
+#define DRAW_MODE_DENSITY           5   // binned density grid, cost independent of flock size
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
@@ -75,6 +80,7 @@ public:
 
   void draw();
   void draw(glm::mat4);
+  void compute_steering();
   void update();
   bool compute_separation_force();
   bool compute_alignment_force();
@@ -85,7 +91,7 @@ public:
 
 //----------------------------------------------------------------------------
 
-void calculate_flocker_squared_distances();
+void calculate_flocker_squared_distances(Flock_World *);
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
@@ -0,0 +1,420 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// offscreen rendering and frame capture: draw into an FBO, read it back through
+// a ring of pixel buffer objects, and write frames out on a background thread
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Frame_Capture.hh"
+#include "Frame_Scheduler.hh"
+
+#include <signal.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+EGLDisplay egl_display = EGL_NO_DISPLAY;
+EGLContext egl_context = EGL_NO_CONTEXT;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+// a 3.3 core context with no surface at all -- the caller must render into an FBO
+
+bool create_headless_context()
+{
+  // prefer the surfaceless platform, which needs no X server or GPU device
+
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay)
+    egl_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  if (egl_display == EGL_NO_DISPLAY)
+    egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint major, minor;
+  if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor)) {
+    fprintf(stderr, "Failed to initialize EGL display\n");
+    return false;
+  }
+
+  static const EGLint config_attribs[] = {
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+
+  EGLConfig config;
+  EGLint num_configs;
+  if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &num_configs) || num_configs < 1) {
+    fprintf(stderr, "No usable EGL config\n");
+    return false;
+  }
+
+  eglBindAPI(EGL_OPENGL_API);
+
+  static const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+
+  egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+  if (egl_context == EGL_NO_CONTEXT) {
+    fprintf(stderr, "Failed to create EGL OpenGL 3.3 context\n");
+    return false;
+  }
+
+  // needs EGL_KHR_surfaceless_context, which Mesa always has
+
+  if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context)) {
+    fprintf(stderr, "Failed to make EGL context current\n");
+    return false;
+  }
+
+  printf("headless EGL %i.%i context: %s\n", major, minor, eglQueryString(egl_display, EGL_VENDOR));
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+void delete_headless_context()
+{
+  if (egl_display == EGL_NO_DISPLAY)
+    return;
+
+  eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (egl_context != EGL_NO_CONTEXT)
+    eglDestroyContext(egl_display, egl_context);
+  eglTerminate(egl_display);
+
+  egl_display = EGL_NO_DISPLAY;
+  egl_context = EGL_NO_CONTEXT;
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+Frame_Capture::Frame_Capture(int w, int h, const char *dir, const char *encoder_command)
+{
+  width = w;
+  height = h;
+
+  // render target
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+  glGenRenderbuffers(1, &color_renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_renderbuffer);
+
+  glGenRenderbuffers(1, &depth_renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    printf("offscreen framebuffer incomplete\n");
+    exit(1);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  // readback ring
+
+  glGenBuffers(CAPTURE_NUM_PBOS, pbos);
+  for (int i = 0; i < CAPTURE_NUM_PBOS; i++) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, NULL, GL_STREAM_READ);
+    pbo_fences[i] = 0;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  num_pending = 0;
+  is_window_blit_ok = true;
+
+  // where frames go
+
+  encoder_pipe = NULL;
+  if (encoder_command) {
+    signal(SIGPIPE, SIG_IGN);     // a dead encoder should be an error message, not a dead viewer
+    encoder_pipe = popen(encoder_command, "w");
+    if (!encoder_pipe) {
+      printf("could not start encoder: %s\n", encoder_command);
+      exit(1);
+    }
+    printf("piping %ix%i rgb24 frames to: %s\n", width, height, encoder_command);
+  }
+  if (dir)
+    output_dir = dir;
+
+  frames_issued = 0;
+  frames_written = 0;
+  stall_time = 0.0;
+  first_write_time = last_write_time = 0.0;
+
+  for (int i = 0; i < CAPTURE_NUM_BUFFERS; i++) {
+    buffers.push_back((unsigned char *) malloc(4 * width * height));
+    free_buffers.push_back(i);
+  }
+  is_finishing = false;
+
+  writer = thread(&Frame_Capture::writer_loop, this);
+}
+
+//----------------------------------------------------------------------------
+
+Frame_Capture::~Frame_Capture()
+{
+  finish();
+
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteRenderbuffers(1, &color_renderbuffer);
+  glDeleteRenderbuffers(1, &depth_renderbuffer);
+  glDeleteBuffers(CAPTURE_NUM_PBOS, pbos);
+
+  for (int i = 0; i < buffers.size(); i++)
+    free(buffers[i]);
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Capture::begin_frame()
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glViewport(0, 0, width, height);
+}
+
+//----------------------------------------------------------------------------
+
+// copy the offscreen image to the window.  the window has to be single-sampled
+// (main() doesn't ask for GLFW_SAMPLES when capturing) -- GL refuses a blit
+// into a multisampled framebuffer, so check once and say so rather than show
+// a blank window without a word
+
+void Frame_Capture::show_in_window()
+{
+  while (glGetError() != GL_NO_ERROR)
+    ;   // not ours
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR && is_window_blit_ok) {
+    printf("could not copy captured frames to the window (GL error 0x%x)\n", error);
+    is_window_blit_ok = false;
+  }
+}
+
+//----------------------------------------------------------------------------
+
+// queue an asynchronous glReadPixels into the next PBO, then hand over whichever
+// earlier readbacks the GPU has already finished.  we only ever wait on the GPU
+// when all CAPTURE_NUM_PBOS are still in flight
+
+void Frame_Capture::end_frame(bool is_shown)
+{
+  // just an offscreen render target -- nowhere to send frames
+
+  if (!encoder_pipe && output_dir.empty()) {
+    if (is_shown)
+      show_in_window();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return;
+  }
+
+  if (num_pending == CAPTURE_NUM_PBOS)
+    collect_readback(true);
+
+  int slot = frames_issued % CAPTURE_NUM_PBOS;
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *) 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  pbo_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frames_issued++;
+  num_pending++;
+
+  // oldest first, and stop at the first one that isn't ready so frames stay in order
+
+  while (num_pending > 0) {
+    int oldest = (frames_issued - num_pending) % CAPTURE_NUM_PBOS;
+    GLenum status = glClientWaitSync(pbo_fences[oldest], 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      break;
+    collect_readback(false);
+  }
+
+  if (is_shown)
+    show_in_window();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//----------------------------------------------------------------------------
+
+// copy the oldest in-flight readback into a free frame buffer and queue it for the writer
+
+void Frame_Capture::collect_readback(bool wait)
+{
+  long frame = frames_issued - num_pending;
+  int slot = frame % CAPTURE_NUM_PBOS;
+
+  if (wait)
+    while (glClientWaitSync(pbo_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED)
+      ;
+  glDeleteSync(pbo_fences[slot]);
+  pbo_fences[slot] = 0;
+
+  int buffer;
+
+  {
+    unique_lock <mutex> lock(queue_mutex);
+    if (free_buffers.empty()) {
+      double t = get_monotonic_time();
+      queue_cv.wait(lock, [this] { return !free_buffers.empty(); });
+      stall_time += get_monotonic_time() - t;
+    }
+    buffer = free_buffers.front();
+    free_buffers.pop_front();
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+  void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * width * height, GL_MAP_READ_BIT);
+  if (pixels) {
+    memcpy(buffers[buffer], pixels, 4 * width * height);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  num_pending--;
+
+  {
+    lock_guard <mutex> lock(queue_mutex);
+    filled_buffers.push_back(make_pair(buffer, frame));
+  }
+  queue_cv.notify_all();
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Capture::writer_loop()
+{
+  vector <unsigned char> rgb_row_data(3 * width * height);
+
+  while (true) {
+
+    pair <int, long> job;
+
+    {
+      unique_lock <mutex> lock(queue_mutex);
+      queue_cv.wait(lock, [this] { return is_finishing || !filled_buffers.empty(); });
+      if (filled_buffers.empty())
+	return;
+      job = filled_buffers.front();
+      filled_buffers.pop_front();
+    }
+
+    write_frame(buffers[job.first], job.second, rgb_row_data);
+
+    {
+      lock_guard <mutex> lock(queue_mutex);
+      free_buffers.push_back(job.first);
+    }
+    queue_cv.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------
+
+// GL rows are bottom-up RGBA; image files and encoders want top-down RGB
+
+void Frame_Capture::write_frame(unsigned char *rgba, long frame, vector <unsigned char> & rgb)
+{
+  double t = get_monotonic_time();
+  if (frames_written == 0)
+    first_write_time = t;
+
+  for (int y = 0; y < height; y++) {
+    unsigned char *src = rgba + 4 * width * (height - 1 - y);
+    unsigned char *dst = &rgb[3 * width * y];
+    for (int x = 0; x < width; x++) {
+      dst[3 * x]     = src[4 * x];
+      dst[3 * x + 1] = src[4 * x + 1];
+      dst[3 * x + 2] = src[4 * x + 2];
+    }
+  }
+
+  if (encoder_pipe) {
+    if (fwrite(&rgb[0], 1, rgb.size(), encoder_pipe) != rgb.size()) {
+      printf("encoder stopped accepting frames at frame %li\n", frame);
+      pclose(encoder_pipe);
+      encoder_pipe = NULL;
+    }
+  }
+
+  if (!output_dir.empty()) {
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s/frame_%06li.ppm", output_dir.c_str(), frame);
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+      printf("could not write %s\n", filename);
+    else {
+      fprintf(fp, "P6\n%i %i\n255\n", width, height);
+      fwrite(&rgb[0], 1, rgb.size(), fp);
+      fclose(fp);
+    }
+  }
+
+  frames_written++;
+  last_write_time = get_monotonic_time();
+
+  if (frames_written % CAPTURE_REPORT_INTERVAL == 0 && last_write_time > first_write_time) {
+    printf("captured %li frames, %.1f frames/sec\n", frames_written, (frames_written - 1) / (last_write_time - first_write_time));
+    fflush(stdout);
+  }
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Capture::finish()
+{
+  if (!writer.joinable())
+    return;
+
+  while (num_pending > 0)
+    collect_readback(true);
+
+  {
+    lock_guard <mutex> lock(queue_mutex);
+    is_finishing = true;
+  }
+  queue_cv.notify_all();
+  writer.join();
+
+  if (encoder_pipe) {
+    pclose(encoder_pipe);
+    encoder_pipe = NULL;
+  }
+
+  double elapsed = last_write_time - first_write_time;
+  printf("captured %li frames in %.2f s (%.1f frames/sec), render thread stalled %.2f s waiting on writer\n",
+	 frames_written, elapsed, elapsed > 0.0 ? (frames_written - 1) / elapsed : 0.0, stall_time);
+  fflush(stdout);
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
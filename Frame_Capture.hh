@@ -0,0 +1,100 @@
+#ifndef FRAME_CAPTURE_HH
+
+#define FRAME_CAPTURE_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// offscreen rendering and frame capture: draw into an FBO, read it back through
+// a ring of pixel buffer objects, and write frames out on a background thread
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define CAPTURE_NUM_PBOS             3     // readbacks in flight
+#define CAPTURE_NUM_BUFFERS          8     // frames waiting for (or in) the writer
+#define CAPTURE_REPORT_INTERVAL      120   // frames between throughput reports
+
+//----------------------------------------------------------------------------
+
+// no window, no display: EGL on Mesa's surfaceless platform (llvmpipe is fine).
+// everything is drawn into a Frame_Capture FBO instead of a default framebuffer
+
+bool create_headless_context();
+void delete_headless_context();
+
+//----------------------------------------------------------------------------
+
+class Frame_Capture
+{
+public:
+
+  int width, height;
+
+  GLuint framebuffer;
+  GLuint color_renderbuffer;
+  GLuint depth_renderbuffer;
+
+  GLuint pbos[CAPTURE_NUM_PBOS];
+  GLsync pbo_fences[CAPTURE_NUM_PBOS];
+  int num_pending;                          // readbacks issued but not yet collected
+
+  string output_dir;                        // frame_NNNNNN.ppm files go here...
+  FILE *encoder_pipe;                       // ...or raw rgb24 goes to this process
+
+  long frames_issued;
+  long frames_written;
+  bool is_window_blit_ok;                   // false after the first failed copy to the window
+  double stall_time;                        // time the render thread waited on the writer
+  double first_write_time, last_write_time;
+
+  // frame buffers cycle free -> filled -> (writer) -> free
+
+  vector <unsigned char *> buffers;
+  deque <int> free_buffers;
+  deque <pair<int, long> > filled_buffers;  // buffer, frame number
+  bool is_finishing;
+
+  mutex queue_mutex;
+  condition_variable queue_cv;
+  thread writer;
+
+  Frame_Capture(int, int, const char *, const char *);     // size, output dir, encoder command (either may be NULL)
+  ~Frame_Capture();
+
+  void begin_frame();                       // draw into the offscreen target
+  void end_frame(bool);                     // start readback; true to also show it in the window
+  void finish();                            // flush everything and report throughput
+
+private:
+
+  void show_in_window();
+  void collect_readback(bool);
+  void writer_loop();
+  void write_frame(unsigned char *, long, vector <unsigned char> &);
+};
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,273 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// frame pacing: sleep instead of spinning until the next frame is due, so
+// the core is free for the worker pool in the meantime
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Frame_Scheduler.hh"
+
+#include <time.h>
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+// weight of the newest sample in the moving averages
+
+#define COST_SMOOTHING       0.1
+
+//----------------------------------------------------------------------------
+
+double get_monotonic_time()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+//----------------------------------------------------------------------------
+
+// absolute-time sleep so that a late wakeup doesn't compound
+
+static void sleep_until(double t)
+{
+  struct timespec ts;
+
+  ts.tv_sec = (time_t) t;
+  ts.tv_nsec = (long) ((t - ts.tv_sec) * 1.0e9);
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+    ;   // interrupted by a signal -- go back to sleep
+}
+
+//----------------------------------------------------------------------------
+
+static double moving_average(double average, double sample)
+{
+  return (1.0 - COST_SMOOTHING) * average + COST_SMOOTHING * sample;
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+Frame_Scheduler::Frame_Scheduler(double target_fps)
+{
+  set_target_fps(target_fps);
+
+  use_vsync = false;
+  is_free_running = false;
+  can_skip_renders = true;
+
+  frame_start = sim_done = render_done = 0.0;
+  deadline = -1.0;
+  last_release = -1.0;
+
+  sim_cost = render_cost = 0.0;
+  sleep_overshoot = MIN_SPIN_MARGIN;
+
+  frame_times.assign(FRAME_STATS_WINDOW, 0.0);
+  sim_times.assign(FRAME_STATS_WINDOW, 0.0);
+  render_times.assign(FRAME_STATS_WINDOW, 0.0);
+  visible_counts.assign(FRAME_STATS_WINDOW, 0);
+  culled_counts.assign(FRAME_STATS_WINDOW, 0);
+  frame_visible = frame_culled = 0;
+  ring_index = 0;
+  total_frames = 0;
+  missed_deadlines = 0;
+  skipped_renders = 0;
+  num_skipped_in_a_row = 0;
+  is_render_skipped = false;
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Scheduler::set_target_fps(double target_fps)
+{
+  target_period = 1.0 / target_fps;
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Scheduler::begin_frame()
+{
+  frame_start = get_monotonic_time();
+
+  // first frame -- nothing to pace against yet
+
+  if (deadline < 0.0)
+    deadline = frame_start + target_period;
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Scheduler::end_simulation()
+{
+  sim_done = get_monotonic_time();
+  sim_cost = moving_average(sim_cost, sim_done - frame_start);
+}
+
+//----------------------------------------------------------------------------
+
+// when the simulation plus drawing has been taking longer than a frame and
+// drawing this one would make it late, skip the draw so the simulation keeps
+// its pace -- but never more than MAX_SKIPPED_RENDERS in a row, so the screen
+// still updates.  vsync and free running have no deadline to protect
+
+bool Frame_Scheduler::should_render()
+{
+  is_render_skipped = false;
+
+  if (can_skip_renders && !use_vsync && !is_free_running &&
+      sim_cost + render_cost > target_period &&
+      sim_done + render_cost > deadline &&
+      num_skipped_in_a_row < MAX_SKIPPED_RENDERS) {
+
+    is_render_skipped = true;
+    num_skipped_in_a_row++;
+    skipped_renders++;
+    render_done = sim_done;                 // nothing drawn, and nothing folded into render_cost
+
+    return false;
+  }
+
+  num_skipped_in_a_row = 0;
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Scheduler::end_render()
+{
+  render_done = get_monotonic_time();
+  render_cost = moving_average(render_cost, render_done - sim_done);
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Scheduler::record_culling(int num_visible, int num_culled)
+{
+  frame_visible = num_visible;
+  frame_culled = num_culled;
+}
+
+//----------------------------------------------------------------------------
+
+// sleep until the frame is due, waking a little early and spinning the last
+// stretch since the OS is never exactly on time.  the pool's workers get the
+// core while we sleep -- its queued tasks (asset loads, snapshot writes) have
+// no bound on how long they take, so none of them is run here
+
+void Frame_Scheduler::wait_for_deadline()
+{
+  double now = get_monotonic_time();
+
+  // late: show it now and restart the cadence from here rather than trying to catch up
+
+  if (now > deadline) {
+    if (now - deadline > 0.05 * target_period)
+      missed_deadlines++;
+    deadline = now;
+  }
+  else if (!use_vsync && !is_free_running) {
+
+    double spin_margin = 2.0 * sleep_overshoot;
+    if (spin_margin < MIN_SPIN_MARGIN)
+      spin_margin = MIN_SPIN_MARGIN;
+    else if (spin_margin > MAX_SPIN_MARGIN)
+      spin_margin = MAX_SPIN_MARGIN;
+
+    if (deadline - now > spin_margin) {
+      double wake = deadline - spin_margin;
+      sleep_until(wake);
+      now = get_monotonic_time();
+      sleep_overshoot = moving_average(sleep_overshoot, now - wake);
+    }
+
+    while (now < deadline)
+      now = get_monotonic_time();
+  }
+
+  // with vsync the swap that follows does the waiting
+
+  frame_times[ring_index] = now - (last_release < 0.0 ? frame_start : last_release);
+  sim_times[ring_index] = sim_done - frame_start;
+  render_times[ring_index] = render_done - sim_done;
+  visible_counts[ring_index] = frame_visible;
+  culled_counts[ring_index] = frame_culled;
+  ring_index = (ring_index + 1) % FRAME_STATS_WINDOW;
+  total_frames++;
+
+  last_release = now;
+  deadline += target_period;
+}
+
+//----------------------------------------------------------------------------
+
+Frame_Stats Frame_Scheduler::get_stats()
+{
+  Frame_Stats stats;
+
+  stats.num_frames = total_frames < FRAME_STATS_WINDOW ? total_frames : FRAME_STATS_WINDOW;
+  stats.total_frames = total_frames;
+  stats.missed_deadlines = missed_deadlines;
+  stats.skipped_renders = skipped_renders;
+  stats.mean_frame_time = stats.p99_frame_time = 0.0;
+  stats.mean_sim_time = stats.mean_render_time = 0.0;
+  stats.mean_visible = stats.mean_culled = 0.0;
+
+  if (stats.num_frames == 0)
+    return stats;
+
+  vector <double> sorted(frame_times.begin(), frame_times.begin() + stats.num_frames);
+
+  for (int i = 0; i < stats.num_frames; i++) {
+    stats.mean_frame_time += frame_times[i];
+    stats.mean_sim_time += sim_times[i];
+    stats.mean_render_time += render_times[i];
+    stats.mean_visible += visible_counts[i];
+    stats.mean_culled += culled_counts[i];
+  }
+  stats.mean_frame_time /= stats.num_frames;
+  stats.mean_sim_time /= stats.num_frames;
+  stats.mean_render_time /= stats.num_frames;
+  stats.mean_visible /= stats.num_frames;
+  stats.mean_culled /= stats.num_frames;
+
+  int p99_index = (int) (0.99 * (stats.num_frames - 1));
+  nth_element(sorted.begin(), sorted.begin() + p99_index, sorted.end());
+  stats.p99_frame_time = sorted[p99_index];
+
+  return stats;
+}
+
+//----------------------------------------------------------------------------
+
+void Frame_Scheduler::print_stats(FILE *fp)
+{
+  Frame_Stats stats = get_stats();
+
+  fprintf(fp, "frames: %ld, mean %.2f ms, p99 %.2f ms (sim %.2f ms, render %.2f ms), missed deadlines: %ld, target %.2f ms%s\n",
+	  stats.total_frames,
+	  1000.0 * stats.mean_frame_time, 1000.0 * stats.p99_frame_time,
+	  1000.0 * stats.mean_sim_time, 1000.0 * stats.mean_render_time,
+	  stats.missed_deadlines, 1000.0 * target_period,
+	  use_vsync ? " (vsync)" : "");
+
+  if (stats.skipped_renders > 0)
+    fprintf(fp, "skipped renders: %ld\n", stats.skipped_renders);
+
+  if (stats.mean_visible + stats.mean_culled > 0.0)
+    fprintf(fp, "creatures per frame: %.0f visible, %.0f culled\n", stats.mean_visible, stats.mean_culled);
+  fflush(fp);
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
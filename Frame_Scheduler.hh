@@ -0,0 +1,104 @@
+#ifndef FRAME_SCHEDULER_HH
+
+#define FRAME_SCHEDULER_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// frame pacing: sleep instead of spinning until the next frame is due, so
+// the core is free for the worker pool in the meantime
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define FRAME_STATS_WINDOW          600      // frames kept for mean/p99
+
+#define MIN_SPIN_MARGIN             0.0001   // seconds spun (not slept) before a deadline
+#define MAX_SPIN_MARGIN             0.002
+
+#define MAX_SKIPPED_RENDERS         2        // in a row, when sim + render don't fit in a frame
+
+//----------------------------------------------------------------------------
+
+struct Frame_Stats
+{
+  int num_frames;                           // in the window
+  double mean_frame_time;                   // seconds
+  double p99_frame_time;
+  double mean_sim_time;
+  double mean_render_time;
+  double mean_visible;                      // creatures past frustum culling
+  double mean_culled;
+  long total_frames;                        // since start
+  long missed_deadlines;
+  long skipped_renders;
+};
+
+//----------------------------------------------------------------------------
+
+class Frame_Scheduler
+{
+public:
+
+  double target_period;
+  bool use_vsync;                           // let the buffer swap do the pacing
+  bool is_free_running;                     // no pacing at all (offline capture) -- stats only
+  bool can_skip_renders;                    // off when every step has to be drawn (capture)
+
+  double frame_start;                       // when the current frame began
+  double sim_done, render_done;
+  double deadline;                          // when the current frame should be shown
+  double last_release;                      // when the previous one was
+
+  // exponential moving averages, used to predict how much of the frame is free
+  // and whether there is time to draw it at all
+
+  double sim_cost, render_cost;
+  double sleep_overshoot;                   // how late the OS tends to wake us
+
+  vector <double> frame_times;              // ring buffer
+  vector <double> sim_times;
+  vector <double> render_times;
+  vector <int> visible_counts;
+  vector <int> culled_counts;
+  int ring_index;
+  long total_frames;
+  long missed_deadlines;
+  long skipped_renders;
+  int num_skipped_in_a_row;
+  bool is_render_skipped;                   // this frame's
+
+  int frame_visible, frame_culled;
+
+  Frame_Scheduler(double);                  // target frames per second
+
+  void set_target_fps(double);
+  void begin_frame();
+  void end_simulation();
+  bool should_render();                     // false: skip drawing this frame to catch up
+  void end_render();
+  void record_culling(int, int);            // visible, culled -- this frame's
+  void wait_for_deadline();
+
+  Frame_Stats get_stats();
+  void print_stats(FILE * = stdout);
+};
+
+//----------------------------------------------------------------------------
+
+double get_monotonic_time();
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
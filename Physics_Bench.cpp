@@ -0,0 +1,280 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// physics benchmark: steps per second against body count, for the
+// single-threaded Bullet world with each broadphase, the multithreaded one at
+// each thread count and the sphere collider
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Physics_Bench.hh"
+
+#include "Asset_Loader.hh"
+#include "Flock_World.hh"
+#include "Frame_Scheduler.hh"
+#include "Render_Bench.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+static const int bench_body_counts[] = { 500, 2000, 8000, 32000 };
+static const int bench_sphere_counts[] = { 131072 };    // past what Bullet can do -- sphere collider only
+
+extern int num_flockers;
+extern int num_predators;
+extern int max_frames;
+
+extern bool is_bullet_multithreaded;
+extern int bullet_broadphase_type;
+extern int num_awake_bodies;
+
+extern float box_width;
+extern float box_height;
+extern float box_depth;
+
+extern Flocker *new_random_flocker(int);
+extern Predator *new_random_predator(int);
+
+//----------------------------------------------------------------------------
+
+// replace the flock with n fresh creatures (same seed every time)
+
+static void populate_physics_flock(int n)
+{
+  int i;
+
+  flock_world.clear();
+
+  srand48(BENCH_SEED);
+
+  num_flockers = n - num_predators;
+
+  for (i = 0; i < num_flockers; i++)
+    flock_world.add_flocker(new_random_flocker(i));
+  for (i = 0; i < num_predators; i++)
+    flock_world.add_predator(new_random_predator(i));
+  flock_world.resize_distance_tables();
+}
+
+//----------------------------------------------------------------------------
+
+// total time (seconds) of every profile zone called name under the iterator's
+// current node, however deep -- Bullet's BT_PROFILE zones nest differently in
+// the single- and multithreaded worlds
+
+static double sum_profile_zone(CProfileIterator *it, const char *name)
+{
+  double total = 0.0;
+  int num_children = 0;
+
+  for (it->First(); !it->Is_Done(); it->Next())
+    num_children++;
+
+  for (int c = 0; c < num_children; c++) {
+
+    it->First();
+    for (int k = 0; k < c; k++)
+      it->Next();
+
+    if (!strcmp(it->Get_Current_Name(), name))
+      total += 0.001 * it->Get_Current_Total_Time();   // ms
+    else {
+      it->Enter_Child(c);
+      total += sum_profile_zone(it, name);
+      it->Enter_Parent();
+    }
+  }
+
+  return total;
+}
+
+//----------------------------------------------------------------------------
+
+// per-step averages over the measured steps.  Bullet, unless a sphere collider
+// is given.  the zones come from Bullet's own profiler (main thread only) and
+// stay 0 if it was built with BT_NO_PROFILE
+
+static Physics_Timing time_physics_steps(int num_measured, Sphere_Collider *collider = NULL)
+{
+  Physics_Timing timing;
+  memset(&timing, 0, sizeof(Physics_Timing));
+
+  double start = get_monotonic_time();
+
+  for (int s = 0; s < PHYSICS_BENCH_WARMUP_STEPS + num_measured; s++) {
+    if (s == PHYSICS_BENCH_WARMUP_STEPS) {
+      CProfileManager::Reset();
+      start = get_monotonic_time();
+    }
+    if (collider)
+      collider->step(PHYSICS_BENCH_TIMESTEP);
+    else
+      update_physics_simulation(PHYSICS_BENCH_TIMESTEP);
+  }
+
+  timing.step_time = (get_monotonic_time() - start) / num_measured;
+
+  if (!collider) {
+    CProfileIterator *it = CProfileManager::Get_Iterator();
+    timing.broadphase_time = (sum_profile_zone(it, "updateAabbs") + sum_profile_zone(it, "calculateOverlappingPairs")) / num_measured;
+    timing.narrowphase_time = sum_profile_zone(it, "dispatchAllCollisionPairs") / num_measured;
+    timing.solver_time = (sum_profile_zone(it, "calculateSimulationIslands") + sum_profile_zone(it, "solveConstraints")) / num_measured;
+    CProfileManager::Release_Iterator(it);
+  }
+
+  return timing;
+}
+
+//----------------------------------------------------------------------------
+
+// speedup is against single_step_time, the single-threaded world named by
+// baseline at the same size, when there is one (0 -> none)
+
+static void write_physics_result(FILE *fp, const char *world, const char *broadphase, int threads, int bodies,
+				 Physics_Timing & timing, double single_step_time, const char *baseline, bool is_last)
+{
+  double step_time = timing.step_time;
+
+  fprintf(fp, "    { \"world\": \"%s\", \"broadphase\": \"%s\", \"threads\": %i, \"bodies\": %i,\n", world, broadphase, threads, bodies);
+  fprintf(fp, "      \"ms_per_step\": %.4f, \"steps_per_sec\": %.2f,\n", 1000.0 * step_time, 1.0 / step_time);
+  if (strcmp(world, "SPH"))
+    fprintf(fp, "      \"broadphase_ms\": %.4f, \"narrowphase_ms\": %.4f, \"solver_ms\": %.4f, \"awake_at_end\": %i,\n",
+	    1000.0 * timing.broadphase_time, 1000.0 * timing.narrowphase_time, 1000.0 * timing.solver_time, num_awake_bodies);
+  if (single_step_time > 0.0)
+    fprintf(fp, "      \"speedup\": %.3f, \"speedup_vs\": \"ST %s\" }%s\n", single_step_time / step_time, baseline, is_last ? "" : ",");
+  else
+    fprintf(fp, "      \"speedup\": null, \"speedup_vs\": null }%s\n", is_last ? "" : ",");
+  fflush(fp);
+
+  printf("%-3s %-5s %2i thread%s %6i bodies: %9.3f ms/step, %8.2f steps/s",
+	 world, broadphase, threads, threads == 1 ? " " : "s", bodies, 1000.0 * step_time, 1.0 / step_time);
+  if (strcmp(world, "SPH"))
+    printf(" (broad %.3f, narrow %.3f, solver %.3f ms)",
+	   1000.0 * timing.broadphase_time, 1000.0 * timing.narrowphase_time, 1000.0 * timing.solver_time);
+  if (single_step_time > 0.0)
+    printf(", %5.2fx vs ST %s", single_step_time / step_time, baseline);
+  printf("\n");
+  fflush(stdout);
+}
+
+//----------------------------------------------------------------------------
+
+// every size is stepped first by the plain btDiscreteDynamicsWorld with each
+// broadphase, then by btDiscreteDynamicsWorldMt (with the --broadphase one) at
+// 1, 2, 4, ... threads of the worker pool, then by the sphere collider on the
+// whole pool.  each configuration starts from the same seeded flock and a
+// freshly made world.  speedup is relative to a single-threaded world at that
+// size: the one with the same broadphase for the multithreaded runs (so it
+// measures threading alone), and DBVT, the default, for the other broadphases
+// and the sphere collider.  bigger flocks only get the sphere collider
+
+void run_physics_benchmark(const char *filename)
+{
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    printf("could not open %s for writing\n", filename);
+    exit(1);
+  }
+
+  int num_measured = max_frames > 0 ? max_frames : PHYSICS_BENCH_MEASURED_STEPS;
+  int num_sizes = sizeof(bench_body_counts) / sizeof(bench_body_counts[0]);
+  int num_sphere_sizes = sizeof(bench_sphere_counts) / sizeof(bench_sphere_counts[0]);
+  bool was_multithreaded = is_bullet_multithreaded;
+  int mt_broadphase_type = bullet_broadphase_type;
+  Sphere_Collider collider;
+  Physics_Timing timing;
+
+  require_obj_mesh();      // hull
+
+  Pool_Task_Scheduler *scheduler = get_bullet_task_scheduler();
+  int max_threads = scheduler->getMaxNumThreads();
+  int pool_threads = get_thread_pool()->num_threads();
+
+  vector <int> thread_counts;
+  for (int t = 1; t < max_threads; t *= 2)
+    thread_counts.push_back(t);
+  thread_counts.push_back(max_threads);
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"bullet_version\": %i,\n", btGetVersion());
+#if BT_THREADSAFE
+  fprintf(fp, "  \"bullet_threadsafe\": true,\n");
+#else
+  fprintf(fp, "  \"bullet_threadsafe\": false,\n");
+#endif
+  fprintf(fp, "  \"pool_threads\": %i,\n", pool_threads);
+  fprintf(fp, "  \"timestep\": %.6f,\n", PHYSICS_BENCH_TIMESTEP);
+  fprintf(fp, "  \"steps_per_config\": %i,\n", num_measured);
+  fprintf(fp, "  \"results\": [\n");
+
+  for (int s = 0; s < num_sizes; s++) {
+
+    int num_bodies = bench_body_counts[s];
+    double single_step_time[BROADPHASE_SAP32 + 1];
+
+    is_bullet_multithreaded = false;
+
+    for (int b = BROADPHASE_DBVT; b <= BROADPHASE_SAP32; b++) {
+
+      delete_bullet_simulator();
+      bullet_broadphase_type = b;
+      populate_physics_flock(num_bodies);
+      reset_bullet_simulator();
+
+      timing = time_physics_steps(num_measured);
+      single_step_time[b] = timing.step_time;
+      write_physics_result(fp, "ST", get_broadphase_name(b), 1, num_bodies, timing,
+			   single_step_time[BROADPHASE_DBVT], get_broadphase_name(BROADPHASE_DBVT), false);
+    }
+
+    delete_bullet_simulator();
+    is_bullet_multithreaded = true;
+    bullet_broadphase_type = mt_broadphase_type;
+
+    for (int t = 0; t < thread_counts.size(); t++) {
+
+      scheduler->setNumThreads(thread_counts[t]);
+      populate_physics_flock(num_bodies);
+      reset_bullet_simulator();
+
+      timing = time_physics_steps(num_measured);
+      write_physics_result(fp, "MT", get_broadphase_name(mt_broadphase_type), thread_counts[t], num_bodies, timing,
+			   single_step_time[mt_broadphase_type], get_broadphase_name(mt_broadphase_type), false);
+    }
+
+    delete_bullet_simulator();
+
+    populate_physics_flock(num_bodies);
+    collider.reset(box_width, box_height, box_depth, glm::vec3(0, -9.81f, 0));
+
+    timing = time_physics_steps(num_measured, &collider);
+    write_physics_result(fp, "SPH", "grid", pool_threads, num_bodies, timing,
+			 single_step_time[BROADPHASE_DBVT], get_broadphase_name(BROADPHASE_DBVT),
+			 num_sphere_sizes == 0 && s == num_sizes - 1);
+  }
+
+  for (int s = 0; s < num_sphere_sizes; s++) {
+
+    populate_physics_flock(bench_sphere_counts[s]);
+    collider.reset(box_width, box_height, box_depth, glm::vec3(0, -9.81f, 0));
+
+    timing = time_physics_steps(num_measured, &collider);
+    write_physics_result(fp, "SPH", "grid", pool_threads, bench_sphere_counts[s], timing, 0.0, NULL,
+			 s == num_sphere_sizes - 1);
+  }
+
+  fprintf(fp, "  ]\n}\n");
+  fclose(fp);
+
+  // leave physics the way the options asked for it
+
+  scheduler->setNumThreads(max_threads);
+  is_bullet_multithreaded = was_multithreaded;
+  bullet_broadphase_type = mt_broadphase_type;
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
@@ -0,0 +1,54 @@
+#ifndef PHYSICS_BENCH_HH
+
+#define PHYSICS_BENCH_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// physics benchmark: steps per second against body count, for the
+// single-threaded Bullet world with each broadphase, the multithreaded one at
+// each thread count and the sphere collider
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Flocker.hh"
+#include "Predator.hh"
+#include "Bullet_Utils.hh"
+#include "Sphere_Collider.hh"
+
+#include <LinearMath/btQuickprof.h>
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define PHYSICS_BENCH_WARMUP_STEPS   10
+#define PHYSICS_BENCH_MEASURED_STEPS 100    // per world/size/threads -- --frames overrides
+#define PHYSICS_BENCH_TIMESTEP       (1.0f / 60.0f)
+
+//----------------------------------------------------------------------------
+
+struct Physics_Timing                       // seconds per step
+{
+  double step_time;
+  double broadphase_time;                   // updateAabbs + calculateOverlappingPairs
+  double narrowphase_time;                  // dispatchAllCollisionPairs
+  double solver_time;                       // islands + solveConstraints
+};
+
+//----------------------------------------------------------------------------
+
+void run_physics_benchmark(const char *);   // JSON results file
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,246 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// physics checkpoints: the whole Bullet world written with btDefaultSerializer,
+// and read back (memory-mapped) into the pooled bodies so a scene can be
+// restarted right where it was saved
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Physics_Checkpoint.hh"
+
+#include "Flock_World.hh"
+#include "Frame_Scheduler.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+extern int num_flockers;
+extern int num_predators;
+extern int num_creatures;
+extern int velocity_scale;
+extern int num_bodies_in_world;
+extern bool is_hybrid_active;
+extern bool is_bullet_sleep_enabled;
+
+extern btDiscreteDynamicsWorld* bullet_dynamicsWorld;
+extern vector<btRigidBody*> bullet_rigidbodies;
+
+//----------------------------------------------------------------------------
+
+// the serialized structs come in float and double flavors, depending on how
+// the Bullet that wrote the file was built
+
+static void read_transform(btTransform & trans, const btTransformFloatData & data) { trans.deSerializeFloat(data); }
+static void read_transform(btTransform & trans, const btTransformDoubleData & data) { trans.deSerializeDouble(data); }
+static void read_vector(btVector3 & v, const btVector3FloatData & data) { v.deSerializeFloat(data); }
+static void read_vector(btVector3 & v, const btVector3DoubleData & data) { v.deSerializeDouble(data); }
+
+//----------------------------------------------------------------------------
+
+// a creature body if it has a mass and one of the names save_physics_checkpoint()
+// gave it -- the six walls have neither
+
+template <class Body_Data>
+static bool read_checkpoint_body(const Body_Data *data, Checkpoint_Body & body)
+{
+  const char *name = data->m_collisionObjectData.m_name;
+  char role[16];
+
+  if (data->m_inverseMass == 0 || !name || sscanf(name, "%15s %i", role, &body.index) != 2)
+    return false;
+
+  body.is_predator = !strcmp(role, "predator");
+  read_transform(body.transform, data->m_collisionObjectData.m_worldTransform);
+  read_vector(body.linear_velocity, data->m_linearVelocity);
+  read_vector(body.angular_velocity, data->m_angularVelocity);
+  body.activation_state = data->m_collisionObjectData.m_activationState1;
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+// every body and shape in the world, in Bullet's own .bullet format.  creature
+// bodies are named by role and get_creature() index so the restore doesn't
+// depend on the order the world happens to keep them in
+
+bool save_physics_checkpoint(const char *filename)
+{
+  if (!bullet_dynamicsWorld || !num_bodies_in_world) {
+    printf("no physics world to checkpoint\n");
+    return false;
+  }
+
+  double start = get_monotonic_time();
+
+  vector <string> names(num_creatures);
+  btDefaultSerializer serializer;
+
+  for (int i = 0; i < num_creatures; i++) {
+    char name[32];
+    sprintf(name, "%s %i", i < num_flockers ? "flocker" : "predator", i);
+    names[i] = name;
+    serializer.registerNameForPointer(bullet_rigidbodies[i], names[i].c_str());
+  }
+
+  bullet_dynamicsWorld->serialize(&serializer);
+
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    printf("could not open %s for writing\n", filename);
+    return false;
+  }
+
+  int size = serializer.getCurrentBufferSize();
+  bool is_written = fwrite(serializer.getBufferPointer(), size, 1, fp) == 1;
+  is_written = !fclose(fp) && is_written;
+
+  if (!is_written) {
+    printf("could not write %s\n", filename);
+    return false;
+  }
+
+  printf("physics checkpoint: %i bodies to %s (%i KB, %.1f ms)\n",
+	 num_creatures, filename, size / 1024, 1000.0 * (get_monotonic_time() - start));
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+static bool read_checkpoint_bodies(char *buffer, int size, const char *filename, vector <Checkpoint_Body> & bodies)
+{
+  bParse::btBulletFile file(buffer, size);
+
+  if (!file.ok()) {
+    printf("%s is not a Bullet file\n", filename);
+    return false;
+  }
+
+  file.parse(false);
+  if (!file.ok()) {
+    printf("could not parse %s\n", filename);
+    return false;
+  }
+
+  bool is_double = file.getFlags() & bParse::FD_DOUBLE_PRECISION;
+  Checkpoint_Body body;
+
+  for (int i = 0; i < file.m_rigidBodies.size(); i++)
+    if (is_double ? read_checkpoint_body((btRigidBodyDoubleData *) file.m_rigidBodies[i], body)
+	: read_checkpoint_body((btRigidBodyFloatData *) file.m_rigidBodies[i], body))
+      bodies.push_back(body);
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+// restart physics from a checkpoint.  the file is mapped private and writable:
+// the parser fixes up its pointers in place, and only the pages it touches get
+// copied.  only the creature bodies' states are taken from it -- the world,
+// walls and hull are the ones this run built, and the flock must be the size
+// it was when the checkpoint was saved
+
+bool restore_physics_checkpoint(const char *filename)
+{
+  double start = get_monotonic_time();
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("could not open %s\n", filename);
+    return false;
+  }
+
+  struct stat st;
+  char *buffer = (char *) MAP_FAILED;
+  if (!fstat(fd, &st) && st.st_size > 0)
+    buffer = (char *) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (buffer == MAP_FAILED) {
+    printf("could not map %s\n", filename);
+    return false;
+  }
+
+  vector <Checkpoint_Body> bodies;
+  bool is_read = read_checkpoint_bodies(buffer, st.st_size, filename, bodies);
+  munmap(buffer, st.st_size);
+
+  if (!is_read)
+    return false;
+
+  // same flock?
+
+  int num_saved_predators = 0;
+  for (int i = 0; i < bodies.size(); i++)
+    num_saved_predators += bodies[i].is_predator;
+
+  if (num_saved_predators != num_predators || bodies.size() - num_saved_predators != num_flockers) {
+    printf("%s has %i flockers and %i predators, but the flock has %i and %i\n",
+	   filename, (int) bodies.size() - num_saved_predators, num_saved_predators, num_flockers, num_predators);
+    return false;
+  }
+
+  // and every creature exactly once, in its own role -- flockers come first in
+  // get_creature() order, so the index says which one each body has to be
+
+  vector <bool> is_restored(bodies.size(), false);
+  for (int i = 0; i < bodies.size(); i++) {
+    int index = bodies[i].index;
+    if (index < 0 || index >= bodies.size() || is_restored[index] || bodies[i].is_predator != (index >= num_flockers)) {
+      printf("%s has a bad or repeated creature index (%i)\n", filename, index);
+      return false;
+    }
+    is_restored[index] = true;
+  }
+
+  // bind the bodies to the creatures as usual, then overwrite their states
+
+  reset_bullet_simulator();
+
+  for (int i = 0; i < bodies.size(); i++) {
+
+    Checkpoint_Body & body = bodies[i];
+    btRigidBody *rigidBody = bullet_rigidbodies[body.index];
+
+    rigidBody->setWorldTransform(body.transform);
+    rigidBody->setInterpolationWorldTransform(body.transform);
+    rigidBody->setLinearVelocity(body.linear_velocity);
+    rigidBody->setInterpolationLinearVelocity(body.linear_velocity);
+    rigidBody->setAngularVelocity(body.angular_velocity);
+    rigidBody->setInterpolationAngularVelocity(body.angular_velocity);
+
+    if (is_bullet_sleep_enabled && body.activation_state == ISLAND_SLEEPING)
+      rigidBody->forceActivationState(ISLAND_SLEEPING);
+
+    // sleeping bodies are skipped by updateAabbs(), so do each one here
+
+    bullet_dynamicsWorld->updateSingleAabb(rigidBody);
+
+    // and the creature follows, as if Bullet had just moved it
+
+    rigidBody->getMotionState()->setWorldTransform(body.transform);
+
+    Creature *c = get_creature(body.index);
+    c->velocity = glm::vec3(body.linear_velocity.getX(), body.linear_velocity.getY(), body.linear_velocity.getZ()) / (float) velocity_scale;
+    if (is_hybrid_active && glm::length(c->velocity) > 0.0f)
+      c->update_frame();
+  }
+
+  printf("physics checkpoint: %i bodies from %s (%.1f ms)\n",
+	 (int) bodies.size(), filename, 1000.0 * (get_monotonic_time() - start));
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
@@ -0,0 +1,55 @@
+#ifndef PHYSICS_CHECKPOINT_HH
+
+#define PHYSICS_CHECKPOINT_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// physics checkpoints: the whole Bullet world written with btDefaultSerializer,
+// and read back (memory-mapped) into the pooled bodies so a scene can be
+// restarted right where it was saved
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Bullet_Utils.hh"
+
+#include <LinearMath/btSerializer.h>
+#include <BulletFileLoader/btBulletFile.h>
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define PHYSICS_CHECKPOINT_FILE      "physics.bullet"   // default for keys K and L
+
+//----------------------------------------------------------------------------
+
+// one creature body as it was read from a checkpoint
+
+struct Checkpoint_Body
+{
+  int index;                                // get_creature() order, from the body's name
+  bool is_predator;
+  btTransform transform;
+  btVector3 linear_velocity;                // physics units, not flocking ones
+  btVector3 angular_velocity;
+  int activation_state;                     // ISLAND_SLEEPING bodies come back asleep
+};
+
+//----------------------------------------------------------------------------
+
+bool save_physics_checkpoint(const char *);       // false (and a message) if there's no world or the file can't be written
+bool restore_physics_checkpoint(const char *);    // false if the file is unreadable or the flock is a different size
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -12,12 +12,13 @@
 //----------------------------------------------------------------------------
 
 #include "Predator.hh"
+#include "Flock_World.hh"
+#include "Render_Bench.hh"
+#include "Thread_Pool.hh"
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
 
-vector <Predator *> predator_array;
-
 extern int flocker_history_length;
 extern int flocker_draw_mode;
 
@@ -39,11 +40,9 @@ extern GLuint obj_vertexbuffer;
 extern GLuint obj_uvbuffer;
 extern GLuint obj_normalbuffer;
 extern GLuint obj_elementbuffer;
-extern vector<unsigned short> obj_indices;
-
-vector <vector <double> > p_to_f_squared_distance;
-
-extern vector <Flocker *> flocker_array;
+extern float obj_scale;
+extern GLsizei obj_num_indices;
+extern GLenum obj_index_type;
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
@@ -78,9 +77,10 @@ void Predator::draw(glm::mat4 Model)
     glm::vec3 lightPos = glm::vec3(4,4,4);
     glUniform3f(objLightID, lightPos.x, lightPos.y, lightPos.z);
 
-    glm::mat4 RotationMatrix = glm::mat4(); // identity    -- glm::toMat4(quat_orientations[i]);
+    glm::mat4 RotationMatrix = glm::mat4(); // identity    -- glm::toMat4(orientation);
     glm::mat4 TranslationMatrix = translate(glm::mat4(), glm::vec3(position.x, position.y, position.z));
-    glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix;
+    glm::mat4 ScaleMatrix = glm::scale(glm::mat4(), glm::vec3(obj_scale));
+    glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix * ScaleMatrix;
 
     glm::mat4 MVP = ProjectionMat * ViewMat * Model * ModelMatrix;
 
@@ -93,6 +93,7 @@ void Predator::draw(glm::mat4 Model)
     // Bind this object's texture in Texture Unit 0
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, pred_Texture);
+    count_gl_call();
     // Set our "myTextureSampler" sampler to use Texture Unit 0
     glUniform1i(objTextureID, 0);
 
@@ -138,10 +139,11 @@ void Predator::draw(glm::mat4 Model)
     // Draw the triangles !
     glDrawElements(
 		   GL_TRIANGLES,      // mode
-		   obj_indices.size(),    // count
-		   GL_UNSIGNED_SHORT,   // type
+		   obj_num_indices,    // count
+		   obj_index_type,   // type
 		   (void*)0           // element array buffer offset
 		   );
+    count_gl_draw(GL_TRIANGLES, obj_num_indices);
       
 
     glDisableVertexAttribArray(0);
@@ -350,6 +352,8 @@ void Predator::draw(glm::mat4 Model)
   
   // 1st attribute buffer : vertices
   
+  require_buffers();
+
   glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
   glBufferData(GL_ARRAY_BUFFER, 3 * num_vertices * sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW);
   
@@ -381,6 +385,7 @@ void Predator::draw(glm::mat4 Model)
   // Draw the flocker!
   
   glDrawArrays(draw_mode, 0, num_vertices);
+  count_gl_draw(draw_mode, num_vertices);
   
   glDisableVertexAttribArray(0);
   glDisableVertexAttribArray(1);
@@ -391,7 +396,7 @@ void Predator::draw(glm::mat4 Model)
 
 //----------------------------------------------------------------------------
 
-void Predator::update()
+void Predator::compute_steering()
 {
     // set accelerations (aka forces)
     
@@ -402,13 +407,20 @@ void Predator::update()
         draw_color = glm::vec3(1.0f, 0.0f, 0.0f);
     else
         draw_color = glm::vec3(1.0f, 0.941f, 0.122f);
+}
+
+//----------------------------------------------------------------------------
+
+void Predator::update()
+{
+    compute_steering();
 
     // randomness
 
     if (random_force_limit > 0.0) {
-        acceleration.x += uniform_random(-random_force_limit, random_force_limit);
-        acceleration.y += uniform_random(-random_force_limit, random_force_limit);
-        acceleration.z += uniform_random(-random_force_limit, random_force_limit);
+        acceleration.x += world->uniform_random(-random_force_limit, random_force_limit);
+        acceleration.y += world->uniform_random(-random_force_limit, random_force_limit);
+        acceleration.z += world->uniform_random(-random_force_limit, random_force_limit);
     }
 
     // update velocity
@@ -438,18 +450,20 @@ bool Predator::compute_hunger_force() {
   hunger_force = glm::vec3(0, 0, 0);
 
   double min;
-  for (j = 0; j < p_to_f_squared_distance[index].size(); j++)
-    if (p_to_f_squared_distance[index][j] >= min_squared_hunger_distance &&
-	p_to_f_squared_distance[index][j] <= max_squared_hunger_distance) {
+  vector <double> & distance = world->p_to_f_squared_distance[index];
+
+  for (j = 0; j < distance.size(); j++)
+    if (distance[j] >= min_squared_hunger_distance &&
+	distance[j] <= max_squared_hunger_distance) {
 
       // set (unweighted) force magnitude
 
-      percent = (p_to_f_squared_distance[index][j] - max_squared_hunger_distance) * inv_range_squared_hunger_distance;
+      percent = (distance[j] - max_squared_hunger_distance) * inv_range_squared_hunger_distance;
       F = 0.5 + -0.5 * cos(percent * 2.0 * M_PI);
 
       // set force direction
 
-      direction = (float) F * glm::normalize(flocker_array[j]->position - position);   // opposite direction of hunger
+      direction = (float) F * glm::normalize(world->flockers[j]->position - position);   // opposite direction of hunger
       hunger_force += direction;
       count++;
     }
@@ -468,18 +482,27 @@ bool Predator::compute_hunger_force() {
 // attempt to be slightly efficient by pre-calculating all of the distances between
 // predator and flockers exactly once
 
-void calculate_p_to_f_squared_distances()
+void calculate_p_to_f_squared_distances(Flock_World *world)
 {
-  int pred_i, flock_i;
-  glm::vec3 diff;
-  double len;
-
-  for (pred_i = 0; pred_i < predator_array.size(); pred_i++)
-    for (flock_i = 0; flock_i < flocker_array.size(); flock_i++) {
-      diff = predator_array[pred_i]->position - flocker_array[flock_i]->position;
-      len = glm::length2(diff);
-      p_to_f_squared_distance[pred_i][flock_i] = len;
-    }
+  int pred_i;
+  vector <Flocker *> & flockers = world->flockers;
+
+  for (pred_i = 0; pred_i < world->predators.size(); pred_i++) {
+    Predator *p = world->predators[pred_i];
+    vector <double> & row = world->p_to_f_squared_distance[pred_i];
+
+    auto columns = [p, &row, &flockers](int begin, int end, int chunk) {
+      for (int flock_i = begin; flock_i < end; flock_i++) {
+	glm::vec3 diff = p->position - flockers[flock_i]->position;
+	row[flock_i] = glm::length2(diff);
+      }
+    };
+
+    if (world->is_parallel)
+      get_thread_pool()->parallel_for(0, flockers.size(), DISTANCE_COLUMN_GRAIN, columns);
+    else
+      columns(0, flockers.size(), 0);
+  }
 }
 
 
@@ -46,6 +46,7 @@ public:
 	   int = 1);               // number of past states to save
 
   void draw(glm::mat4);
+  void compute_steering();
   void update();
   bool compute_hunger_force();
 
@@ -53,7 +54,7 @@ public:
 
 //----------------------------------------------------------------------------
 
-void calculate_p_to_f_squared_distances();
+void calculate_p_to_f_squared_distances(Flock_World *);
 
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
@@ -0,0 +1,371 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// render-path benchmark: count GL calls and upload bytes, time the creature
+// draw loops on the CPU and GPU, and sweep draw modes x flock sizes
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Render_Bench.hh"
+
+#include "Asset_Loader.hh"
+#include "Flock_Culler.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+Render_Counters render_counters;
+
+static const int bench_flock_sizes[] = { 50, 500, 5000, 20000, 50000, 100000 };
+
+static const struct { int mode; const char *name; } bench_draw_modes[] = {
+  { DRAW_MODE_HISTORY, "HISTORY" },
+  { DRAW_MODE_AXES,    "AXES" },
+  { DRAW_MODE_POLY,    "POLY" },
+  { DRAW_MODE_OBJ,     "OBJ" },
+};
+
+extern float box_width;
+extern float box_height;
+extern float box_depth;
+
+extern int num_flockers;
+extern int num_predators;
+extern int max_frames;
+extern bool using_obj_program;
+extern GLuint programID;
+
+extern int flocker_history_length;
+extern int flocker_draw_mode;
+extern vector <Flocker *> & flocker_array;
+extern vector <Predator *> & predator_array;
+
+extern Frame_Capture *frame_capture;
+
+extern Flocker *new_random_flocker(int);
+extern Predator *new_random_predator(int);
+extern void setup_camera();
+extern void draw_box(glm::mat4);
+extern void draw_creatures(glm::mat4);
+
+//----------------------------------------------------------------------------
+
+void reset_render_counters()
+{
+  memset(&render_counters, 0, sizeof(Render_Counters));
+}
+
+//----------------------------------------------------------------------------
+
+// GLEW hands out post-1.1 entry points through function pointers, so counting
+// them is just a matter of swapping in a wrapper that forwards to the original
+
+#define COUNTED_GL_CALL(type, name, params, args)	\
+  static type real_##name;				\
+  static void GLAPIENTRY counted_##name params		\
+  {							\
+    render_counters.gl_calls++;				\
+    real_##name args;					\
+  }
+
+#define INSTALL_GL_COUNTER(name)			\
+  real_##name = __glew##name;				\
+  __glew##name = counted_##name
+
+#define REMOVE_GL_COUNTER(name)				\
+  if (real_##name) {					\
+    __glew##name = real_##name;				\
+    real_##name = NULL;					\
+  }
+
+COUNTED_GL_CALL(PFNGLUSEPROGRAMPROC, UseProgram, (GLuint program), (program))
+COUNTED_GL_CALL(PFNGLBINDBUFFERPROC, BindBuffer, (GLenum target, GLuint buffer), (target, buffer))
+COUNTED_GL_CALL(PFNGLVERTEXATTRIBPOINTERPROC, VertexAttribPointer,
+		(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer),
+		(index, size, type, normalized, stride, pointer))
+COUNTED_GL_CALL(PFNGLENABLEVERTEXATTRIBARRAYPROC, EnableVertexAttribArray, (GLuint index), (index))
+COUNTED_GL_CALL(PFNGLDISABLEVERTEXATTRIBARRAYPROC, DisableVertexAttribArray, (GLuint index), (index))
+COUNTED_GL_CALL(PFNGLUNIFORMMATRIX4FVPROC, UniformMatrix4fv,
+		(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value),
+		(location, count, transpose, value))
+COUNTED_GL_CALL(PFNGLUNIFORM1IPROC, Uniform1i, (GLint location, GLint v0), (location, v0))
+COUNTED_GL_CALL(PFNGLUNIFORM1FPROC, Uniform1f, (GLint location, GLfloat v0), (location, v0))
+COUNTED_GL_CALL(PFNGLUNIFORM3FPROC, Uniform3f, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2), (location, v0, v1, v2))
+COUNTED_GL_CALL(PFNGLACTIVETEXTUREPROC, ActiveTexture, (GLenum texture), (texture))
+
+static PFNGLBUFFERDATAPROC real_BufferData;
+static PFNGLBUFFERSUBDATAPROC real_BufferSubData;
+static PFNGLDRAWARRAYSINSTANCEDPROC real_DrawArraysInstanced;
+static PFNGLDRAWELEMENTSINSTANCEDPROC real_DrawElementsInstanced;
+
+static void GLAPIENTRY counted_BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+  render_counters.gl_calls++;
+  render_counters.buffer_uploads++;
+  render_counters.upload_bytes += size;
+  real_BufferData(target, size, data, usage);
+}
+
+static void GLAPIENTRY counted_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+  render_counters.gl_calls++;
+  render_counters.buffer_uploads++;
+  render_counters.upload_bytes += size;
+  real_BufferSubData(target, offset, size, data);
+}
+
+static void GLAPIENTRY counted_DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+  render_counters.gl_calls++;
+  render_counters.draw_calls++;
+  if (mode == GL_TRIANGLES)
+    render_counters.triangles += (long) (count / 3) * instances;
+  real_DrawArraysInstanced(mode, first, count, instances);
+}
+
+static void GLAPIENTRY counted_DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instances)
+{
+  render_counters.gl_calls++;
+  render_counters.draw_calls++;
+  if (mode == GL_TRIANGLES)
+    render_counters.triangles += (long) (count / 3) * instances;
+  real_DrawElementsInstanced(mode, count, type, indices, instances);
+}
+
+void install_gl_counters()
+{
+  INSTALL_GL_COUNTER(UseProgram);
+  INSTALL_GL_COUNTER(BindBuffer);
+  INSTALL_GL_COUNTER(VertexAttribPointer);
+  INSTALL_GL_COUNTER(EnableVertexAttribArray);
+  INSTALL_GL_COUNTER(DisableVertexAttribArray);
+  INSTALL_GL_COUNTER(UniformMatrix4fv);
+  INSTALL_GL_COUNTER(Uniform1i);
+  INSTALL_GL_COUNTER(Uniform1f);
+  INSTALL_GL_COUNTER(Uniform3f);
+  INSTALL_GL_COUNTER(ActiveTexture);
+  INSTALL_GL_COUNTER(BufferData);
+  INSTALL_GL_COUNTER(BufferSubData);
+  INSTALL_GL_COUNTER(DrawArraysInstanced);
+  INSTALL_GL_COUNTER(DrawElementsInstanced);
+}
+
+void remove_gl_counters()
+{
+  REMOVE_GL_COUNTER(UseProgram);
+  REMOVE_GL_COUNTER(BindBuffer);
+  REMOVE_GL_COUNTER(VertexAttribPointer);
+  REMOVE_GL_COUNTER(EnableVertexAttribArray);
+  REMOVE_GL_COUNTER(DisableVertexAttribArray);
+  REMOVE_GL_COUNTER(UniformMatrix4fv);
+  REMOVE_GL_COUNTER(Uniform1i);
+  REMOVE_GL_COUNTER(Uniform1f);
+  REMOVE_GL_COUNTER(Uniform3f);
+  REMOVE_GL_COUNTER(ActiveTexture);
+  REMOVE_GL_COUNTER(BufferData);
+  REMOVE_GL_COUNTER(BufferSubData);
+  REMOVE_GL_COUNTER(DrawArraysInstanced);
+  REMOVE_GL_COUNTER(DrawElementsInstanced);
+}
+
+//----------------------------------------------------------------------------
+
+// replace the flock with n fresh creatures.  no flocking -- n x n distances
+// would take longer than the drawing being measured -- just coast along the
+// initial velocity until the trails are full, so every mode has something
+// representative to draw
+
+static void populate_benchmark_flock(int n)
+{
+  int i, h;
+
+  flock_world.clear();
+
+  srand48(BENCH_SEED);
+
+  num_flockers = n;
+
+  for (i = 0; i < num_flockers; i++)
+    flock_world.add_flocker(new_random_flocker(i));
+  for (i = 0; i < num_predators; i++)
+    flock_world.add_predator(new_random_predator(i));
+  flock_world.resize_distance_tables();
+
+  vector <Creature *> creatures(flocker_array.begin(), flocker_array.end());
+  creatures.insert(creatures.end(), predator_array.begin(), predator_array.end());
+
+  for (i = 0; i < creatures.size(); i++) {
+    Creature *c = creatures[i];
+    for (h = 0; h < flocker_history_length; h++) {
+      c->new_velocity = c->velocity;
+      c->new_position = c->position + c->velocity;
+      c->finalize_update(box_width, box_height, box_depth);
+    }
+    c->draw_color = c->base_color;
+  }
+}
+
+//----------------------------------------------------------------------------
+
+static const char *gl_string(GLenum name)
+{
+  const char *s = (const char *) glGetString(name);
+
+  return s ? s : "";
+}
+
+//----------------------------------------------------------------------------
+
+// driver strings are free text -- quote them as JSON strings
+
+static void write_json_string(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(fp, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(fp, "\\u%04x", c);
+    else
+      fputc(c, fp);
+  }
+
+  fputc('"', fp);
+}
+
+//----------------------------------------------------------------------------
+
+// every mode x size draws the same seeded flock from the default orbit camera
+// into the offscreen target.  counters cover draw_creatures() only -- the box
+// and the readback are not part of what's being compared
+
+void run_render_benchmark(const char *filename)
+{
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    printf("could not open %s for writing\n", filename);
+    exit(1);
+  }
+
+  int num_measured = max_frames > 0 ? max_frames : BENCH_MEASURED_FRAMES;
+  int num_sizes = sizeof(bench_flock_sizes) / sizeof(bench_flock_sizes[0]);
+  int num_modes = sizeof(bench_draw_modes) / sizeof(bench_draw_modes[0]);
+
+  install_gl_counters();
+
+  GLuint query;
+  glGenQueries(1, &query);
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"gl_vendor\": ");
+  write_json_string(fp, gl_string(GL_VENDOR));
+  fprintf(fp, ",\n  \"gl_renderer\": ");
+  write_json_string(fp, gl_string(GL_RENDERER));
+  fprintf(fp, ",\n  \"gl_version\": ");
+  write_json_string(fp, gl_string(GL_VERSION));
+  fprintf(fp, ",\n");
+  fprintf(fp, "  \"width\": %i,\n", frame_capture->width);
+  fprintf(fp, "  \"height\": %i,\n", frame_capture->height);
+  fprintf(fp, "  \"frames_per_config\": %i,\n", num_measured);
+  fprintf(fp, "  \"results\": [\n");
+
+  for (int m = 0; m < num_modes; m++) {
+
+    flocker_draw_mode = bench_draw_modes[m].mode;
+    using_obj_program = flocker_draw_mode == DRAW_MODE_OBJ;
+    if (using_obj_program)
+      require_obj_assets();
+
+    for (int s = 0; s < num_sizes; s++) {
+
+      populate_benchmark_flock(bench_flock_sizes[s]);
+
+      Render_Counters total;
+      memset(&total, 0, sizeof(Render_Counters));
+      double gpu_time = 0.0, frame_time = 0.0;
+
+      for (int f = 0; f < BENCH_WARMUP_FRAMES + num_measured; f++) {
+
+	double frame_start = get_monotonic_time();
+
+	frame_capture->begin_frame();
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	setup_camera();
+	glm::mat4 M = glm::translate(glm::vec3(-0.5f * box_width, -0.5f * box_height, -0.5f * box_depth));
+
+	glUseProgram(programID);
+	draw_box(M);
+
+	reset_render_counters();
+
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	draw_creatures(M);
+	glEndQuery(GL_TIME_ELAPSED);
+
+	Render_Counters frame = render_counters;
+
+	frame_capture->end_frame(false);
+
+	// waits for the GPU -- frame time here is the full round trip
+
+	GLuint64 elapsed_ns;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+
+	if (f < BENCH_WARMUP_FRAMES)
+	  continue;
+
+	total.gl_calls += frame.gl_calls;
+	total.draw_calls += frame.draw_calls;
+	total.triangles += frame.triangles;
+	total.buffer_uploads += frame.buffer_uploads;
+	total.upload_bytes += frame.upload_bytes;
+	total.flocker_draw_time += frame.flocker_draw_time;
+	total.predator_draw_time += frame.predator_draw_time;
+	total.cull_time += frame.cull_time;
+	gpu_time += 1.0e-9 * elapsed_ns;
+	frame_time += get_monotonic_time() - frame_start;
+      }
+
+      int num_creatures = flocker_array.size() + predator_array.size();
+      double cpu_time = total.cull_time + total.flocker_draw_time + total.predator_draw_time;
+
+      fprintf(fp, "    { \"mode\": \"%s\", \"num_flockers\": %i, \"num_predators\": %i, \"num_visible\": %i,\n",
+	      bench_draw_modes[m].name, (int) flocker_array.size(), (int) predator_array.size(), (int) visible_creatures.size());
+      fprintf(fp, "      \"gl_calls_per_frame\": %.1f, \"draw_calls_per_frame\": %.1f,\n",
+	      (double) total.gl_calls / num_measured, (double) total.draw_calls / num_measured);
+      fprintf(fp, "      \"buffer_uploads_per_frame\": %.1f, \"upload_bytes_per_frame\": %.1f, \"triangles_per_frame\": %.1f,\n",
+	      (double) total.buffer_uploads / num_measured, (double) total.upload_bytes / num_measured,
+	      (double) total.triangles / num_measured);
+      fprintf(fp, "      \"cull_cpu_ms\": %.4f, \"flocker_draw_cpu_ms\": %.4f, \"predator_draw_cpu_ms\": %.4f, \"cpu_us_per_creature\": %.4f,\n",
+	      1000.0 * total.cull_time / num_measured,
+	      1000.0 * total.flocker_draw_time / num_measured, 1000.0 * total.predator_draw_time / num_measured,
+	      1.0e6 * cpu_time / num_measured / num_creatures);
+      fprintf(fp, "      \"gpu_ms\": %.4f, \"frame_ms\": %.4f }%s\n",
+	      1000.0 * gpu_time / num_measured, 1000.0 * frame_time / num_measured,
+	      m == num_modes - 1 && s == num_sizes - 1 ? "" : ",");
+      fflush(fp);
+
+      printf("%-8s %6i creatures: %8.3f ms cpu, %8.3f ms gpu, %8.1f draw calls, %10.0f bytes uploaded per frame\n",
+	     bench_draw_modes[m].name, num_creatures,
+	     1000.0 * cpu_time / num_measured, 1000.0 * gpu_time / num_measured,
+	     (double) total.draw_calls / num_measured, (double) total.upload_bytes / num_measured);
+      fflush(stdout);
+    }
+  }
+
+  fprintf(fp, "  ]\n}\n");
+  fclose(fp);
+
+  glDeleteQueries(1, &query);
+
+  remove_gl_counters();
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
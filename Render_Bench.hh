@@ -0,0 +1,82 @@
+#ifndef RENDER_BENCH_HH
+
+#define RENDER_BENCH_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// render-path benchmark: count GL calls and upload bytes, time the creature
+// draw loops on the CPU and GPU, and sweep draw modes x flock sizes
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Flocker.hh"
+#include "Predator.hh"
+#include "Frame_Scheduler.hh"
+#include "Frame_Capture.hh"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define BENCH_WARMUP_FRAMES          5
+#define BENCH_MEASURED_FRAMES        20     // per mode/size -- --frames overrides
+#define BENCH_SEED                   440    // same flock every run
+
+//----------------------------------------------------------------------------
+
+struct Render_Counters
+{
+  long gl_calls;                            // every counted GL entry point
+  long draw_calls;                          // glDraw*
+  long triangles;                           // submitted by GL_TRIANGLES draws, all instances
+  long buffer_uploads;                      // glBufferData / glBufferSubData
+  long upload_bytes;
+  double flocker_draw_time;                 // seconds in Flocker::draw(), or the whole-flock draw
+  double predator_draw_time;                // seconds in Predator::draw()
+  double cull_time;                         // seconds in cull_creatures()
+};
+
+extern Render_Counters render_counters;
+
+// GL 1.1 entry points (glDrawArrays, glDrawElements, glBindTexture) are linked
+// straight against libGL, with no GLEW pointer to swap, so their call sites
+// count themselves
+
+inline void count_gl_draw(GLenum mode, GLsizei count)
+{
+  render_counters.gl_calls++;
+  render_counters.draw_calls++;
+  if (mode == GL_TRIANGLES)
+    render_counters.triangles += count / 3;
+}
+
+inline void count_gl_call()
+{
+  render_counters.gl_calls++;
+}
+
+//----------------------------------------------------------------------------
+
+void reset_render_counters();
+void install_gl_counters();                 // after glewInit() -- only while benchmarking
+void remove_gl_counters();                  // back to the plain GLEW entry points
+
+void run_render_benchmark(const char *);    // JSON results file
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,292 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// lightweight physics: every creature is a sphere that falls, bounces off the
+// six sides of the box and doesn't interpenetrate the others.  contacts come
+// from a uniform grid and are resolved by position-based Jacobi iterations,
+// all on the worker pool -- meant for flocks far bigger than Bullet can step
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Sphere_Collider.hh"
+
+#include "Flock_World.hh"
+
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+extern int velocity_scale;                  // flocking -> physics velocities, as for Bullet
+
+//----------------------------------------------------------------------------
+
+Sphere_Collider::Sphere_Collider()
+{
+  num_spheres = 0;
+  radius = SPHERE_RADIUS;
+  width = height = depth = 1.0f;
+  gravity = glm::vec3(0, 0, 0);
+  inv_cell_size = 1.0f;
+  grid_w = grid_h = grid_d = 1;
+}
+
+//----------------------------------------------------------------------------
+
+// start from the creatures' current positions and velocities.  the spheres
+// shrink if the default size would pack the box too tightly
+
+void Sphere_Collider::reset(float _width, float _height, float _depth, glm::vec3 _gravity)
+{
+  width = _width;
+  height = _height;
+  depth = _depth;
+  gravity = _gravity;
+
+  num_spheres = flocker_array.size() + predator_array.size();
+
+  radius = SPHERE_RADIUS;
+  if (num_spheres > 0) {
+    float max_radius = cbrt(SPHERE_MAX_PACKING * width * height * depth / (num_spheres * 4.0 / 3.0 * M_PI));
+    radius = min(radius, max_radius);
+  }
+
+  inv_cell_size = 0.5f / radius;
+  grid_w = max(1, (int) ceil(width * inv_cell_size));
+  grid_h = max(1, (int) ceil(height * inv_cell_size));
+  grid_d = max(1, (int) ceil(depth * inv_cell_size));
+
+  x.resize(num_spheres);  y.resize(num_spheres);  z.resize(num_spheres);
+  vx.resize(num_spheres); vy.resize(num_spheres); vz.resize(num_spheres);
+  px.resize(num_spheres); py.resize(num_spheres); pz.resize(num_spheres);
+  sx.resize(num_spheres); sy.resize(num_spheres); sz.resize(num_spheres);
+  dx.resize(num_spheres); dy.resize(num_spheres); dz.resize(num_spheres);
+  sphere_cell.resize(num_spheres);
+  cell_spheres.resize(num_spheres);
+  cell_start.resize(grid_w * grid_h * grid_d + 1);
+
+  get_thread_pool()->parallel_for(0, num_spheres, SPHERE_GRAIN, [this](int begin, int end, int chunk) {
+      for (int i = begin; i < end; i++) {
+	Creature *c = get_creature(i);
+	x[i] = min(max(c->position.x, radius), width - radius);
+	y[i] = min(max(c->position.y, radius), height - radius);
+	z[i] = min(max(c->position.z, radius), depth - radius);
+	vx[i] = c->velocity.x * velocity_scale;
+	vy[i] = c->velocity.y * velocity_scale;
+	vz[i] = c->velocity.z * velocity_scale;
+      }
+    });
+}
+
+//----------------------------------------------------------------------------
+
+// anything outside the box (mid-step) is binned into the nearest border cell
+
+int Sphere_Collider::get_cell(float x, float y, float z)
+{
+  int i = min(max((int) (x * inv_cell_size), 0), grid_w - 1);
+  int j = min(max((int) (y * inv_cell_size), 0), grid_h - 1);
+  int k = min(max((int) (z * inv_cell_size), 0), grid_d - 1);
+
+  return (k * grid_h + j) * grid_w + i;
+}
+
+//----------------------------------------------------------------------------
+
+// counting sort of the predicted positions into the grid.  cell indices are
+// computed on the pool; the count and the scatter are single passes over
+// plain int arrays, cheap next to the contact search
+
+void Sphere_Collider::build_grid()
+{
+  Thread_Pool *pool = get_thread_pool();
+
+  pool->parallel_for(0, num_spheres, SPHERE_GRAIN, [this](int begin, int end, int chunk) {
+      for (int i = begin; i < end; i++)
+	sphere_cell[i] = get_cell(px[i], py[i], pz[i]);
+    });
+
+  fill(cell_start.begin(), cell_start.end(), 0);
+  for (int i = 0; i < num_spheres; i++)
+    cell_start[sphere_cell[i] + 1]++;
+  for (int c = 1; c < cell_start.size(); c++)
+    cell_start[c] += cell_start[c - 1];
+
+  // cell_start[c] is the write cursor of cell c -- it ends up at the start of
+  // cell c + 1, so shift everything back by one afterwards
+
+  for (int i = 0; i < num_spheres; i++)
+    cell_spheres[cell_start[sphere_cell[i]]++] = i;
+  for (int c = cell_start.size() - 1; c > 0; c--)
+    cell_start[c] = cell_start[c - 1];
+  cell_start[0] = 0;
+
+  pool->parallel_for(0, num_spheres, SPHERE_GRAIN, [this](int begin, int end, int chunk) {
+      for (int s = begin; s < end; s++) {
+	int i = cell_spheres[s];
+	sx[s] = px[i];
+	sy[s] = py[i];
+	sz[s] = pz[i];
+      }
+    });
+}
+
+//----------------------------------------------------------------------------
+
+// one Jacobi pass: every sphere looks at the 27 cells around it and moves half
+// of each overlap away from the other sphere, averaged over its contacts so
+// crowded spheres don't overshoot.  corrections are gathered first and applied
+// after, so each chunk only ever writes its own spheres
+
+void Sphere_Collider::solve_contacts()
+{
+  Thread_Pool *pool = get_thread_pool();
+
+  float diameter = 2.0f * radius;
+  float diameter2 = diameter * diameter;
+
+  pool->parallel_for(0, num_spheres, SPHERE_GRAIN, [this, diameter, diameter2](int begin, int end, int chunk) {
+
+      // plain pointers so the inner loop isn't reloading them through the vectors
+
+      const float *x = &sx[0], *y = &sy[0], *z = &sz[0];
+      const int *start = &cell_start[0];
+
+      for (int s = begin; s < end; s++) {
+
+	float xs = x[s], ys = y[s], zs = z[s];
+	int ci = min(max((int) (xs * inv_cell_size), 0), grid_w - 1);
+	int cj = min(max((int) (ys * inv_cell_size), 0), grid_h - 1);
+	int ck = min(max((int) (zs * inv_cell_size), 0), grid_d - 1);
+
+	float cx = 0.0f, cy = 0.0f, cz = 0.0f, num_contacts = 0.0f;
+
+	for (int k = max(ck - 1, 0); k <= min(ck + 1, grid_d - 1); k++)
+	  for (int j = max(cj - 1, 0); j <= min(cj + 1, grid_h - 1); j++) {
+
+	    // the cells of one row are contiguous, so are their spheres
+
+	    int row = (k * grid_h + j) * grid_w;
+	    int first = start[row + max(ci - 1, 0)];
+	    int last = start[row + min(ci + 1, grid_w - 1) + 1];
+
+	    // branch-free: a sphere is its own neighbor at distance 0, and
+	    // spheres exactly on top of each other are left to the others to push apart
+
+	    for (int t = first; t < last; t++) {
+	      float ex = xs - x[t], ey = ys - y[t], ez = zs - z[t];
+	      float dist2 = ex * ex + ey * ey + ez * ez;
+	      float is_contact = dist2 < diameter2 && dist2 > 1.0e-12f ? 1.0f : 0.0f;
+	      float dist = sqrtf(dist2) + 1.0e-12f;
+	      float push = is_contact * 0.5f * (diameter - dist) / dist;
+	      cx += push * ex;
+	      cy += push * ey;
+	      cz += push * ez;
+	      num_contacts += is_contact;
+	    }
+	  }
+
+	float scale = num_contacts > 0.0f ? 1.0f / num_contacts : 0.0f;
+	dx[s] = scale * cx;
+	dy[s] = scale * cy;
+	dz[s] = scale * cz;
+      }
+    });
+
+  pool->parallel_for(0, num_spheres, SPHERE_GRAIN, [this](int begin, int end, int chunk) {
+      for (int s = begin; s < end; s++) {
+	sx[s] += dx[s];
+	sy[s] += dy[s];
+	sz[s] += dz[s];
+      }
+    });
+}
+
+//----------------------------------------------------------------------------
+
+// keep every (cell-ordered) sphere inside the six planes of the box
+
+void Sphere_Collider::solve_walls()
+{
+  get_thread_pool()->parallel_for(0, num_spheres, SPHERE_GRAIN, [this](int begin, int end, int chunk) {
+      for (int s = begin; s < end; s++) {
+	sx[s] = min(max(sx[s], radius), width - radius);
+	sy[s] = min(max(sy[s], radius), height - radius);
+	sz[s] = min(max(sz[s], radius), depth - radius);
+      }
+    });
+}
+
+//----------------------------------------------------------------------------
+
+// position-based step: predict with gravity, bin, project contacts and walls,
+// then velocity is whatever the projection left.  spheres hitting a wall
+// bounce back off it with SPHERE_RESTITUTION -- but the speed into the wall is
+// measured before projection, and one resting on the floor picks up a step of
+// gravity every time, so anything that slow just stops.  the creatures get the new
+// position and velocity (in flocking units) and turn to face where they're going
+
+void Sphere_Collider::step(float dt)
+{
+  if (num_spheres == 0 || dt <= 0.0f)
+    return;
+
+  Thread_Pool *pool = get_thread_pool();
+
+  pool->parallel_for(0, num_spheres, SPHERE_GRAIN, [this, dt](int begin, int end, int chunk) {
+      for (int i = begin; i < end; i++) {
+	vx[i] += gravity.x * dt;
+	vy[i] += gravity.y * dt;
+	vz[i] += gravity.z * dt;
+	px[i] = x[i] + vx[i] * dt;
+	py[i] = y[i] + vy[i] * dt;
+	pz[i] = z[i] + vz[i] * dt;
+      }
+    });
+
+  build_grid();
+
+  for (int iter = 0; iter < SPHERE_ITERATIONS; iter++) {
+    solve_contacts();
+    solve_walls();
+  }
+
+  // scatter back to creature order, derive velocities and move the creatures
+
+  float inv_dt = 1.0f / dt;
+  float rest_speed = max((float) SPHERE_REST_STEPS * glm::length(gravity) * dt, (float) SPHERE_REST_SPEED);
+
+  pool->parallel_for(0, num_spheres, SPHERE_GRAIN, [this, inv_dt, rest_speed](int begin, int end, int chunk) {
+      for (int s = begin; s < end; s++) {
+	int i = cell_spheres[s];
+	float v0x = vx[i], v0y = vy[i], v0z = vz[i];   // velocity before projection
+
+	vx[i] = (sx[s] - x[i]) * inv_dt;
+	vy[i] = (sy[s] - y[i]) * inv_dt;
+	vz[i] = (sz[s] - z[i]) * inv_dt;
+
+	if ((sx[s] <= radius && v0x < -rest_speed) || (sx[s] >= width - radius && v0x > rest_speed))
+	  vx[i] = -SPHERE_RESTITUTION * v0x;
+	if ((sy[s] <= radius && v0y < -rest_speed) || (sy[s] >= height - radius && v0y > rest_speed))
+	  vy[i] = -SPHERE_RESTITUTION * v0y;
+	if ((sz[s] <= radius && v0z < -rest_speed) || (sz[s] >= depth - radius && v0z > rest_speed))
+	  vz[i] = -SPHERE_RESTITUTION * v0z;
+
+	x[i] = sx[s];
+	y[i] = sy[s];
+	z[i] = sz[s];
+
+	Creature *c = get_creature(i);
+	c->position = glm::vec3(x[i], y[i], z[i]);
+	c->velocity = glm::vec3(vx[i], vy[i], vz[i]) / (float) velocity_scale;
+	if (glm::length2(c->velocity) > 0.0f)
+	  c->update_frame();
+      }
+    });
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
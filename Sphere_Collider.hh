@@ -0,0 +1,87 @@
+#ifndef SPHERE_COLLIDER_HH
+
+#define SPHERE_COLLIDER_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// lightweight physics: every creature is a sphere that falls, bounces off the
+// six sides of the box and doesn't interpenetrate the others.  contacts come
+// from a uniform grid and are resolved by position-based Jacobi iterations,
+// all on the worker pool -- meant for flocks far bigger than Bullet can step
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Thread_Pool.hh"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define SPHERE_RADIUS                0.1      // world units, unless the flock wouldn't fit
+#define SPHERE_MAX_PACKING           0.3      // fraction of the box volume the spheres may fill
+#define SPHERE_ITERATIONS            4        // contact projection passes per step
+#define SPHERE_RESTITUTION           0.5      // off the box walls...
+#define SPHERE_REST_STEPS            2        // ...unless slower than this many steps of gravity
+#define SPHERE_REST_SPEED            0.01     //    (or this, in units per second, with no gravity)
+#define SPHERE_GRAIN                 2048     // spheres per worker pool chunk
+
+//----------------------------------------------------------------------------
+
+class Sphere_Collider
+{
+public:
+
+  int num_spheres;
+  float radius;
+  float width, height, depth;               // box, corner at the origin
+  glm::vec3 gravity;
+
+  // one array per coordinate, in creature order
+
+  vector <float> x, y, z;                   // positions
+  vector <float> vx, vy, vz;                // velocities (units per second)
+  vector <float> px, py, pz;                // predicted positions during a step
+
+  // uniform grid, cells one diameter wide, rebuilt every step by counting sort
+
+  float inv_cell_size;
+  int grid_w, grid_h, grid_d;
+  vector <int> sphere_cell;                 // per sphere
+  vector <int> cell_start;                  // first slot of each cell in cell_spheres (num_cells + 1)
+  vector <int> cell_spheres;                // sphere indices grouped by cell
+
+  // predicted positions gathered in cell order so neighbors are close in memory
+
+  vector <float> sx, sy, sz;
+  vector <float> dx, dy, dz;                // this pass's corrections, same order
+
+  Sphere_Collider();
+
+  void reset(float, float, float, glm::vec3);   // box, gravity -- spheres come from the creatures
+  void step(float);                         // seconds; moves the creatures too
+
+private:
+
+  int get_cell(float, float, float);
+  void build_grid();
+  void solve_contacts();
+  void solve_walls();
+};
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
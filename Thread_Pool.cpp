@@ -0,0 +1,238 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// simple fixed-size worker pool shared by the simulation and renderer
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Thread_Pool.hh"
+
+#include <atomic>
+#include <memory>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+// one parallel_for() call -- workers and the caller pull chunks from it until
+// none are left.  shared so that helpers which wake up late can't touch a dead batch
+
+struct Parallel_Batch
+{
+  int begin, end, chunk_size, num_chunks;
+  const function<void(int, int, int)> *body;
+
+  atomic <int> next_chunk;
+  atomic <int> chunks_done;
+
+  mutex done_mutex;
+  condition_variable done_cv;
+
+  // returns false when there was nothing left to grab
+
+  bool run_one_chunk()
+  {
+    int c = next_chunk.fetch_add(1);
+    if (c >= num_chunks)
+      return false;
+
+    int chunk_begin = begin + c * chunk_size;
+    int chunk_end = chunk_begin + chunk_size;
+    if (chunk_end > end)
+      chunk_end = end;
+
+    (*body)(chunk_begin, chunk_end, c);
+
+    if (chunks_done.fetch_add(1) + 1 == num_chunks) {
+      lock_guard <mutex> lock(done_mutex);
+      done_cv.notify_all();
+    }
+
+    return true;
+  }
+};
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+Thread_Pool::Thread_Pool(int num_workers)
+{
+  is_stopping = false;
+
+  if (num_workers <= 0) {
+    num_workers = (int) thread::hardware_concurrency() - 1;
+    if (num_workers < 0)
+      num_workers = 0;
+  }
+
+  for (int i = 0; i < num_workers; i++)
+    workers.push_back(thread(&Thread_Pool::worker_loop, this));
+}
+
+//----------------------------------------------------------------------------
+
+Thread_Pool::~Thread_Pool()
+{
+  {
+    lock_guard <mutex> lock(task_mutex);
+    is_stopping = true;
+  }
+  task_cv.notify_all();
+
+  for (int i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+//----------------------------------------------------------------------------
+
+int Thread_Pool::num_threads()
+{
+  return workers.size() + 1;
+}
+
+//----------------------------------------------------------------------------
+
+void Thread_Pool::worker_loop()
+{
+  while (true) {
+
+    function<void()> task;
+
+    {
+      unique_lock <mutex> lock(task_mutex);
+      task_cv.wait(lock, [this] { return is_stopping || !tasks.empty(); });
+
+      if (tasks.empty())
+	return;
+
+      task = tasks.front();
+      tasks.pop_front();
+    }
+
+    task();
+  }
+}
+
+//----------------------------------------------------------------------------
+
+void Thread_Pool::submit(function<void()> task)
+{
+  if (workers.size() == 0) {
+    task();
+    return;
+  }
+
+  {
+    lock_guard <mutex> lock(task_mutex);
+    tasks.push_back(task);
+  }
+  task_cv.notify_one();
+}
+
+//----------------------------------------------------------------------------
+
+bool Thread_Pool::run_pending_task()
+{
+  function<void()> task;
+
+  {
+    lock_guard <mutex> lock(task_mutex);
+    if (tasks.empty())
+      return false;
+
+    task = tasks.front();
+    tasks.pop_front();
+  }
+
+  task();
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+int Thread_Pool::num_chunks(int begin, int end, int grain)
+{
+  int n = end - begin;
+  if (n <= 0)
+    return 0;
+  if (grain < 1)
+    grain = 1;
+
+  // a few chunks per thread so uneven chunks even out
+
+  int max_chunks = 4 * num_threads();
+  int chunks = (n + grain - 1) / grain;
+  if (chunks > max_chunks)
+    chunks = max_chunks;
+
+  // round so that no chunk comes out empty
+
+  int chunk_size = (n + chunks - 1) / chunks;
+
+  return (n + chunk_size - 1) / chunk_size;
+}
+
+//----------------------------------------------------------------------------
+
+void Thread_Pool::parallel_for(int begin, int end, int grain, const function<void(int, int, int)> & body)
+{
+  int chunks = num_chunks(begin, end, grain);
+  if (chunks == 0)
+    return;
+
+  // not worth waking anybody up
+
+  if (chunks == 1 || workers.size() == 0) {
+    int chunk_size = (end - begin + chunks - 1) / chunks;
+    for (int c = 0; c < chunks; c++) {
+      int chunk_begin = begin + c * chunk_size;
+      body(chunk_begin, chunk_begin + chunk_size < end ? chunk_begin + chunk_size : end, c);
+    }
+    return;
+  }
+
+  shared_ptr <Parallel_Batch> batch(new Parallel_Batch);
+
+  batch->begin = begin;
+  batch->end = end;
+  batch->num_chunks = chunks;
+  batch->chunk_size = (end - begin + chunks - 1) / chunks;
+  batch->body = &body;
+  batch->next_chunk = 0;
+  batch->chunks_done = 0;
+
+  // one helper per worker (at most one per chunk the caller won't do itself)
+
+  int num_helpers = chunks - 1 < workers.size() ? chunks - 1 : workers.size();
+
+  {
+    lock_guard <mutex> lock(task_mutex);
+    for (int i = 0; i < num_helpers; i++)
+      tasks.push_back([batch] { while (batch->run_one_chunk()); });
+  }
+  task_cv.notify_all();
+
+  // caller pitches in -- this also means nested parallel_for() calls can't deadlock
+
+  while (batch->run_one_chunk());
+
+  unique_lock <mutex> lock(batch->done_mutex);
+  batch->done_cv.wait(lock, [&batch] { return batch->chunks_done.load() == batch->num_chunks; });
+}
+
+//----------------------------------------------------------------------------
+
+// created on first use, lives until exit
+
+Thread_Pool *get_thread_pool()
+{
+  static Thread_Pool *pool = new Thread_Pool();
+
+  return pool;
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
@@ -0,0 +1,64 @@
+#ifndef THREAD_POOL_HH
+
+#define THREAD_POOL_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// simple fixed-size worker pool shared by the simulation and renderer
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+class Thread_Pool
+{
+public:
+
+  vector <thread> workers;
+  deque <function<void()> > tasks;
+
+  mutex task_mutex;
+  condition_variable task_cv;
+  bool is_stopping;
+
+  Thread_Pool(int = 0);                     // number of workers (0 -> one per core, minus the caller)
+  ~Thread_Pool();
+
+  int num_threads();                        // workers plus the calling thread
+
+  void submit(function<void()>);            // fire-and-forget task
+  bool run_pending_task();                  // let the caller do one queued task, if any
+
+  // split [begin, end) into chunks of at least grain items and block until all are done.
+  // body is called as body(chunk_begin, chunk_end, chunk_index)
+
+  void parallel_for(int, int, int, const function<void(int, int, int)> &);
+  int num_chunks(int, int, int);            // how many chunks parallel_for() will use for this range
+
+private:
+
+  void worker_loop();
+};
+
+//----------------------------------------------------------------------------
+
+Thread_Pool *get_thread_pool();
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,475 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// trajectory replay: a recording from Trajectory_Recorder, memory-mapped and
+// played back through the creatures (so every draw mode works), with chunks
+// decoded ahead of the playhead on a background thread
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Trajectory_Player.hh"
+
+#include "Flock_World.hh"
+#include "Frame_Scheduler.hh"
+#include "Thread_Pool.hh"
+
+#include <zlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+extern vector <Flocker *> & flocker_array;
+extern vector <Predator *> & predator_array;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+Trajectory_Player::Trajectory_Player(const char *_filename)
+{
+  filename = _filename;
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("could not open %s\n", filename.c_str());
+    exit(1);
+  }
+
+  struct stat st;
+  mapping = (char *) MAP_FAILED;
+  if (!fstat(fd, &st) && st.st_size >= (off_t) sizeof(Trajectory_Header))
+    mapping = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    printf("could not map %s\n", filename.c_str());
+    exit(1);
+  }
+  mapping_size = st.st_size;
+
+  // chunks are read wherever the playhead goes
+
+  madvise(mapping, mapping_size, MADV_RANDOM);
+
+  memcpy(&header, mapping, sizeof(Trajectory_Header));
+  if (header.magic != TRAJECTORY_MAGIC || header.version != TRAJECTORY_VERSION ||
+      !header.frames_per_chunk || header.frames_per_chunk > TRAJECTORY_MAX_CHUNK_FRAMES) {
+    printf("%s is not a version %i trajectory recording\n", filename.c_str(), TRAJECTORY_VERSION);
+    exit(1);
+  }
+
+  if (!read_index()) {
+    printf("%s has a damaged chunk index\n", filename.c_str());
+    exit(1);
+  }
+  if (index.empty()) {
+    printf("%s has no complete chunks\n", filename.c_str());
+    exit(1);
+  }
+
+  num_frames = index.back().first_frame + index.back().num_frames;
+  frame_size = (size_t) TRAJECTORY_NUM_FIELDS * header.num_creatures;
+
+  playhead = 0.0;
+  speed = 1.0;
+  shown_frame = -1;
+
+  for (int i = 0; i < TRAJECTORY_PLAYER_CACHE_CHUNKS; i++) {
+    slots[i].chunk = -1;
+    slots[i].is_ready = false;
+  }
+  current_chunk = 0;
+  is_finishing = false;
+  stall_time = 0.0;
+  num_stalls = 0;
+
+  decoder = thread(&Trajectory_Player::decoder_loop, this);
+
+  printf("replaying %s: %i creatures, %li frames in %i chunks\n",
+	 filename.c_str(), header.num_creatures, num_frames, (int) index.size());
+}
+
+//----------------------------------------------------------------------------
+
+Trajectory_Player::~Trajectory_Player()
+{
+  {
+    lock_guard <mutex> lock(slot_mutex);
+    is_finishing = true;
+  }
+  slot_cv.notify_all();
+  decoder.join();
+
+  munmap(mapping, mapping_size);
+
+  printf("replay: waited on the decoder %i times, %.2f s in all\n", num_stalls, stall_time);
+}
+
+//----------------------------------------------------------------------------
+
+// chunk i as the player needs it: inside [header, end), really a chunk, and
+// holding frames i * frames_per_chunk on (all of them, unless it is the last)
+
+bool Trajectory_Player::is_chunk_valid(const Trajectory_Chunk_Index & entry, int i, int num_chunks, uint64_t end)
+{
+  Trajectory_Chunk_Header chunk_header;
+
+  if (entry.offset < sizeof(Trajectory_Header) || entry.offset > end || end - entry.offset < sizeof(Trajectory_Chunk_Header))
+    return false;
+  memcpy(&chunk_header, mapping + entry.offset, sizeof(Trajectory_Chunk_Header));
+
+  return chunk_header.magic == TRAJECTORY_CHUNK_MAGIC &&
+    chunk_header.compressed_size <= end - entry.offset - sizeof(Trajectory_Chunk_Header) &&
+    chunk_header.first_frame == entry.first_frame && chunk_header.num_frames == entry.num_frames &&
+    entry.first_frame == (uint64_t) i * header.frames_per_chunk &&
+    entry.num_frames > 0 && entry.num_frames <= header.frames_per_chunk &&
+    (i == num_chunks - 1 || entry.num_frames == header.frames_per_chunk);
+}
+
+//----------------------------------------------------------------------------
+
+// the index the recorder wrote at the end, or -- if it never got to -- one
+// made by walking the chunks from the front.  every chunk but the last holds
+// frames_per_chunk frames, so a frame's chunk is one division away.  false
+// if the footer's index points anywhere it shouldn't
+
+bool Trajectory_Player::read_index()
+{
+  if (mapping_size >= sizeof(Trajectory_Header) + sizeof(Trajectory_Footer)) {
+
+    Trajectory_Footer footer;
+    memcpy(&footer, mapping + mapping_size - sizeof(Trajectory_Footer), sizeof(Trajectory_Footer));
+    uint64_t index_size = (uint64_t) footer.num_chunks * sizeof(Trajectory_Chunk_Index);
+
+    if (footer.magic == TRAJECTORY_INDEX_MAGIC) {
+
+      if (footer.index_offset < sizeof(Trajectory_Header) || footer.index_offset > mapping_size ||
+	  mapping_size - footer.index_offset != index_size + sizeof(Trajectory_Footer))
+	return false;
+
+      index.resize(footer.num_chunks);
+      if (footer.num_chunks)
+	memcpy(&index[0], mapping + footer.index_offset, index_size);
+
+      for (int i = 0; i < index.size(); i++)
+	if (!is_chunk_valid(index[i], i, index.size(), footer.index_offset))
+	  return false;
+
+      return true;
+    }
+  }
+
+  printf("%s has no chunk index (recording cut short?) -- scanning it\n", filename.c_str());
+
+  uint64_t offset = sizeof(Trajectory_Header);
+
+  while (offset + sizeof(Trajectory_Chunk_Header) <= mapping_size) {
+
+    Trajectory_Chunk_Header chunk_header;
+    memcpy(&chunk_header, mapping + offset, sizeof(Trajectory_Chunk_Header));
+
+    Trajectory_Chunk_Index entry;
+    entry.offset = offset;
+    entry.first_frame = chunk_header.first_frame;
+    entry.num_frames = chunk_header.num_frames;
+
+    // a short chunk can only be the last one
+
+    if (!is_chunk_valid(entry, index.size(), index.size() + 1, mapping_size) ||
+	(!index.empty() && index.back().num_frames != header.frames_per_chunk))
+      break;
+
+    index.push_back(entry);
+
+    offset += sizeof(Trajectory_Chunk_Header) + chunk_header.compressed_size;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+
+// inflate one chunk straight from the mapping and undo the deltas: frame by
+// frame, velocities first since the positions were predicted from them
+
+void Trajectory_Player::decode_chunk(int chunk, vector <uint16_t> & values)
+{
+  const Trajectory_Chunk_Index & entry = index[chunk];
+  Trajectory_Chunk_Header chunk_header;
+  memcpy(&chunk_header, mapping + entry.offset, sizeof(Trajectory_Chunk_Header));
+
+  int n = header.num_creatures;
+  size_t raw_frame_size = 2 * frame_size;
+  vector <unsigned char> raw(entry.num_frames * raw_frame_size);
+  uLongf raw_size = raw.size();
+
+  values.assign(entry.num_frames * frame_size, 0);
+
+  if (uncompress(&raw[0], &raw_size, (const Bytef *) mapping + entry.offset + sizeof(Trajectory_Chunk_Header),
+		 chunk_header.compressed_size) != Z_OK || raw_size != raw.size()) {
+    printf("chunk %i of %s is damaged\n", chunk, filename.c_str());
+    return;
+  }
+
+  for (int fr = 0; fr < entry.num_frames; fr++) {
+
+    const unsigned char *planes = &raw[fr * raw_frame_size];
+    uint16_t *frame = &values[fr * frame_size];
+    const uint16_t *prev = fr ? frame - frame_size : NULL;   // key frame: nothing before it
+
+    for (int k = 0; k < TRAJECTORY_NUM_FIELDS; k++) {
+
+      int f = (k + 3) % TRAJECTORY_NUM_FIELDS;     // velocity x, y, z, then position x, y, z
+      const unsigned char *low = planes + (size_t) 2 * f * n;
+      const unsigned char *high = low + n;
+      uint16_t *out = frame + (size_t) f * n;
+
+      if (fr == 0)
+	for (int i = 0; i < n; i++)
+	  out[i] = low[i] | (high[i] << 8);
+      else
+	for (int i = 0; i < n; i++) {
+	  uint16_t zigzag = low[i] | (high[i] << 8);
+	  int16_t delta = (int16_t) ((zigzag >> 1) ^ -(zigzag & 1));
+	  uint16_t predicted = f < 3
+	    ? predict_trajectory_position(prev[(size_t) f * n + i], frame[(size_t) (3 + f) * n + i], header.box_size[f], header.velocity_range)
+	    : prev[(size_t) f * n + i];
+	  out[i] = (uint16_t) (predicted + delta);
+	}
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+
+// decode the most wanted chunk into the slot whose chunk is farthest from the
+// playhead
+
+void Trajectory_Player::decoder_loop()
+{
+  while (true) {
+
+    int chunk;
+    Chunk_Slot *slot = NULL;
+
+    {
+      unique_lock <mutex> lock(slot_mutex);
+      slot_cv.wait(lock, [this] { return is_finishing || !wanted_chunks.empty(); });
+      if (is_finishing)
+	return;
+
+      chunk = wanted_chunks.front();
+      wanted_chunks.pop_front();
+
+      // already decoded (or being decoded) -- nothing to do
+
+      int farthest = -1;
+      for (int i = 0; i < TRAJECTORY_PLAYER_CACHE_CHUNKS; i++) {
+	if (slots[i].chunk == chunk) {
+	  slot = &slots[i];
+	  break;
+	}
+	if (slots[i].chunk == current_chunk)
+	  continue;
+	int distance = slots[i].chunk < 0 ? INT_MAX : abs(slots[i].chunk - current_chunk);
+	if (farthest < 0 || distance > farthest) {
+	  farthest = distance;
+	  slot = &slots[i];
+	}
+      }
+      if (!slot || slot->chunk == chunk)
+	continue;
+
+      slot->chunk = chunk;
+      slot->is_ready = false;
+    }
+
+    decode_chunk(chunk, slot->values);
+
+    {
+      lock_guard <mutex> lock(slot_mutex);
+      slot->is_ready = true;
+    }
+    slot_cv.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------
+
+// call with slot_mutex held
+
+void Trajectory_Player::request_chunk(int chunk, bool is_urgent)
+{
+  if (chunk < 0 || chunk >= index.size())
+    return;
+
+  for (int i = 0; i < TRAJECTORY_PLAYER_CACHE_CHUNKS; i++)
+    if (slots[i].chunk == chunk)
+      return;
+
+  for (int i = 0; i < wanted_chunks.size(); i++)
+    if (wanted_chunks[i] == chunk) {
+      if (!is_urgent)
+	return;
+      wanted_chunks.erase(wanted_chunks.begin() + i);
+      break;
+    }
+
+  if (is_urgent)
+    wanted_chunks.push_front(chunk);
+  else
+    wanted_chunks.push_back(chunk);
+  slot_cv.notify_all();
+}
+
+//----------------------------------------------------------------------------
+
+// the frame's decoded values -- waiting for them only if the decoder didn't
+// see this chunk coming (a seek, or playing faster than it keeps up with).
+// the next chunks in the direction of play are asked for on the way out
+
+const uint16_t *Trajectory_Player::get_frame(long frame)
+{
+  int chunk = frame / header.frames_per_chunk;
+  Chunk_Slot *slot = NULL;
+
+  unique_lock <mutex> lock(slot_mutex);
+
+  current_chunk = chunk;
+
+  for (int i = 0; i < TRAJECTORY_PLAYER_CACHE_CHUNKS; i++)
+    if (slots[i].chunk == chunk)
+      slot = &slots[i];
+
+  if (!slot || !slot->is_ready) {
+
+    double t = get_monotonic_time();
+    request_chunk(chunk, true);
+
+    slot_cv.wait(lock, [this, chunk, &slot] {
+	for (int i = 0; i < TRAJECTORY_PLAYER_CACHE_CHUNKS; i++)
+	  if (slots[i].chunk == chunk && slots[i].is_ready) {
+	    slot = &slots[i];
+	    return true;
+	  }
+	return false;
+      });
+
+    stall_time += get_monotonic_time() - t;
+    num_stalls++;
+  }
+
+  int direction = speed < 0.0 ? -1 : 1;
+  int chunks_per_frame = (int) (fabs(speed) / header.frames_per_chunk);
+  for (int k = 1; k <= 1 + chunks_per_frame && k < TRAJECTORY_PLAYER_CACHE_CHUNKS; k++)
+    request_chunk(chunk + direction * k, false);
+
+  return &slot->values[(frame - index[chunk].first_frame) * frame_size];
+}
+
+//----------------------------------------------------------------------------
+
+// into the creatures, as if the flock had just stepped there.  a jump anywhere
+// but to the next frame starts the trails over
+
+void Trajectory_Player::show_frame(long frame)
+{
+  if (frame == shown_frame)
+    return;
+
+  const uint16_t *values = get_frame(frame);
+  bool is_continuous = frame == shown_frame + 1;
+  int n = header.num_creatures;
+  glm::vec3 box(header.box_size[0], header.box_size[1], header.box_size[2]);
+  float range = header.velocity_range;
+
+  get_thread_pool()->parallel_for(0, n, TRAJECTORY_GRAIN, [values, is_continuous, n, box, range](int begin, int end, int chunk) {
+      for (int i = begin; i < end; i++) {
+
+	Creature *c = get_creature(i);
+
+	for (int k = 0; k < 3; k++) {
+	  c->position[k] = dequantize_trajectory_value(values[(size_t) k * n + i], 0.0f, box[k]);
+	  c->velocity[k] = dequantize_trajectory_value(values[(size_t) (3 + k) * n + i], -range, range);
+	}
+
+	if (!is_continuous)
+	  c->position_history.clear();
+	c->update_frame();
+      }
+    });
+
+  shown_frame = frame;
+}
+
+//----------------------------------------------------------------------------
+
+// the playhead moves by fractions of a frame below 1x, so only the frame
+// shown is whole.  playing stops at either end -- reverse() or a seek gets it
+// going again
+
+void Trajectory_Player::advance(bool is_playing)
+{
+  if (is_playing) {
+    playhead += speed;
+    if (playhead < 0.0)
+      playhead = 0.0;
+    else if (playhead > num_frames - 1)
+      playhead = num_frames - 1;
+  }
+
+  show_frame((long) playhead);
+}
+
+//----------------------------------------------------------------------------
+
+void Trajectory_Player::seek(long frame)
+{
+  playhead = frame < 0 ? 0 : (frame >= num_frames ? num_frames - 1 : frame);
+}
+
+//----------------------------------------------------------------------------
+
+void Trajectory_Player::scrub(int steps)
+{
+  seek((long) playhead + steps * TRAJECTORY_PLAYER_SCRUB_FRAMES);
+}
+
+//----------------------------------------------------------------------------
+
+void Trajectory_Player::change_speed(double factor)
+{
+  double magnitude = fabs(speed) * factor;
+
+  if (magnitude > TRAJECTORY_PLAYER_MAX_SPEED)
+    magnitude = TRAJECTORY_PLAYER_MAX_SPEED;
+  if (magnitude < 1.0 / TRAJECTORY_PLAYER_MAX_SPEED)
+    magnitude = 1.0 / TRAJECTORY_PLAYER_MAX_SPEED;
+
+  speed = speed < 0.0 ? -magnitude : magnitude;
+  print_status();
+}
+
+//----------------------------------------------------------------------------
+
+void Trajectory_Player::reverse()
+{
+  speed = -speed;
+  print_status();
+}
+
+//----------------------------------------------------------------------------
+
+void Trajectory_Player::print_status()
+{
+  printf("replay: frame %li of %li, speed %gx%s; %i decoder waits (%.1f ms)\n",
+	 (long) playhead, num_frames, fabs(speed), speed < 0.0 ? " backwards" : "", num_stalls, 1000.0 * stall_time);
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
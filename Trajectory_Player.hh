@@ -0,0 +1,89 @@
+#ifndef TRAJECTORY_PLAYER_HH
+
+#define TRAJECTORY_PLAYER_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// trajectory replay: a recording from Trajectory_Recorder, memory-mapped and
+// played back through the creatures (so every draw mode works), with chunks
+// decoded ahead of the playhead on a background thread
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Trajectory_Recorder.hh"
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define TRAJECTORY_PLAYER_CACHE_CHUNKS   4        // decoded chunks kept around the playhead
+#define TRAJECTORY_PLAYER_SCRUB_FRAMES   120      // frames per arrow key press
+#define TRAJECTORY_PLAYER_MAX_SPEED      64.0     // recorded frames per shown frame
+
+//----------------------------------------------------------------------------
+
+class Trajectory_Player
+{
+public:
+
+  string filename;
+  char *mapping;                            // the whole file, read-only
+  size_t mapping_size;
+  Trajectory_Header header;
+  vector <Trajectory_Chunk_Index> index;    // from the footer, or by walking the chunks
+  long num_frames;
+  size_t frame_size;                        // decoded values per frame
+
+  double playhead;                          // in recorded frames
+  double speed;                             // recorded frames per shown frame; < 0 plays backwards
+  long shown_frame;                         // last frame applied to the creatures (-1 -> none)
+
+  // decoded chunks, each TRAJECTORY_NUM_FIELDS * num_creatures values per frame.
+  // the decoder never touches the slot holding current_chunk
+
+  struct Chunk_Slot
+  {
+    int chunk;                              // -1 -> empty
+    bool is_ready;
+    vector <uint16_t> values;
+  };
+
+  Chunk_Slot slots[TRAJECTORY_PLAYER_CACHE_CHUNKS];
+  deque <int> wanted_chunks;                // front first
+  int current_chunk;
+  bool is_finishing;
+  mutex slot_mutex;
+  condition_variable slot_cv;
+  thread decoder;
+
+  double stall_time;                        // waiting on the decoder for the current chunk
+  int num_stalls;
+
+  Trajectory_Player(const char *);          // exits if the file isn't a recording
+  ~Trajectory_Player();
+
+  void advance(bool);                       // move the playhead (if playing) and show that frame
+  void seek(long);
+  void scrub(int);                          // by this many TRAJECTORY_PLAYER_SCRUB_FRAMES
+  void change_speed(double);                // multiply
+  void reverse();
+  void print_status();
+
+private:
+
+  bool is_chunk_valid(const Trajectory_Chunk_Index &, int, int, uint64_t);   // entry, its number, chunks, end of chunk data
+  bool read_index();
+  void request_chunk(int, bool);            // chunk, urgent (front of the line)
+  const uint16_t *get_frame(long);
+  void show_frame(long);
+  void decoder_loop();
+  void decode_chunk(int, vector <uint16_t> &);
+};
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,337 @@
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// trajectory recording: every step's positions and velocities, quantized to
+// 16 bits against the box, delta-coded from the step before and deflated in
+// chunks on background threads
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include "Trajectory_Recorder.hh"
+
+#include "Flock_World.hh"
+#include "Frame_Scheduler.hh"
+#include "Thread_Pool.hh"
+
+#include <zlib.h>
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+extern vector <Flocker *> & flocker_array;
+extern vector <Predator *> & predator_array;
+
+//----------------------------------------------------------------------------
+
+uint16_t quantize_trajectory_value(float value, float lower, float upper)
+{
+  float t = (value - lower) / (upper - lower);
+
+  if (t <= 0.0f)
+    return 0;
+  if (t >= 1.0f)
+    return 65535;
+
+  return (uint16_t) (t * 65535.0f + 0.5f);
+}
+
+//----------------------------------------------------------------------------
+
+float dequantize_trajectory_value(uint16_t q, float lower, float upper)
+{
+  return lower + (upper - lower) * (q / 65535.0f);
+}
+
+//----------------------------------------------------------------------------
+
+// where the last position would be after one step at this velocity -- what
+// a flocking step does, so only the rounding is left to encode
+
+uint16_t predict_trajectory_position(uint16_t previous_q, uint16_t velocity_q, float box_size, float velocity_range)
+{
+  float step = ((float) velocity_q - 32767.5f) * (2.0f * velocity_range / box_size);
+
+  return (uint16_t) (previous_q + (int) lrintf(step));
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+Trajectory_Recorder::Trajectory_Recorder(const char *_filename, int num_creatures, int num_flockers, glm::vec3 box_size)
+{
+  filename = _filename;
+
+  memset(&header, 0, sizeof(Trajectory_Header));
+  header.magic = TRAJECTORY_MAGIC;
+  header.version = TRAJECTORY_VERSION;
+  header.num_creatures = num_creatures;
+  header.num_flockers = num_flockers;
+  header.box_size[0] = box_size.x;
+  header.box_size[1] = box_size.y;
+  header.box_size[2] = box_size.z;
+  header.velocity_range = TRAJECTORY_VELOCITY_RANGE;
+
+  frame_size = (size_t) TRAJECTORY_NUM_FIELDS * 2 * num_creatures;
+
+  size_t frames_per_chunk = TRAJECTORY_CHUNK_BYTES / (frame_size ? frame_size : 1);
+  if (frames_per_chunk < TRAJECTORY_MIN_CHUNK_FRAMES)
+    frames_per_chunk = TRAJECTORY_MIN_CHUNK_FRAMES;
+  if (frames_per_chunk > TRAJECTORY_MAX_CHUNK_FRAMES)
+    frames_per_chunk = TRAJECTORY_MAX_CHUNK_FRAMES;
+  header.frames_per_chunk = frames_per_chunk;
+
+  fp = fopen(filename.c_str(), "wb");
+  if (!fp) {
+    printf("could not open %s for writing\n", filename.c_str());
+    exit(1);
+  }
+  is_write_ok = fwrite(&header, sizeof(Trajectory_Header), 1, fp) == 1;
+  file_offset = sizeof(Trajectory_Header);
+
+  previous.assign((size_t) TRAJECTORY_NUM_FIELDS * num_creatures, 0);
+  current_buffer = -1;
+  chunk_frames = 0;
+  frames_recorded = 0;
+  is_stopped = false;
+
+  // one buffer being filled, one per compressor, and one spare so the step
+  // doesn't wait while a compressor is writing
+
+  for (int i = 0; i < TRAJECTORY_NUM_COMPRESSORS + 2; i++) {
+    buffers.push_back((unsigned char *) malloc(header.frames_per_chunk * frame_size));
+    free_buffers.push_back(i);
+  }
+  num_chunks_queued = num_chunks_written = 0;
+  is_finishing = false;
+
+  record_time = stall_time = 0.0;
+  raw_bytes = compressed_bytes = 0;
+
+  for (int i = 0; i < TRAJECTORY_NUM_COMPRESSORS; i++)
+    compressors.push_back(thread(&Trajectory_Recorder::compressor_loop, this));
+
+  printf("recording %i creatures to %s, %i frames (%.1f MB raw) per chunk\n",
+	 num_creatures, filename.c_str(), header.frames_per_chunk, header.frames_per_chunk * frame_size / 1048576.0);
+}
+
+//----------------------------------------------------------------------------
+
+Trajectory_Recorder::~Trajectory_Recorder()
+{
+  finish();
+
+  for (int i = 0; i < buffers.size(); i++)
+    free(buffers[i]);
+}
+
+//----------------------------------------------------------------------------
+
+// quantize straight into the chunk being filled, one field at a time in
+// byte planes -- small deltas make long runs of zero (high) bytes
+
+void Trajectory_Recorder::record_frame()
+{
+  if (is_stopped)
+    return;
+
+  int n = header.num_creatures;
+
+  if (flocker_array.size() + predator_array.size() != n) {
+    printf("flock is no longer %i creatures -- trajectory recording stopped at frame %li\n", n, frames_recorded);
+    is_stopped = true;
+    return;
+  }
+
+  if (current_buffer < 0) {
+    unique_lock <mutex> lock(queue_mutex);
+    if (free_buffers.empty()) {
+      double t = get_monotonic_time();
+      queue_cv.wait(lock, [this] { return !free_buffers.empty(); });
+      stall_time += get_monotonic_time() - t;
+    }
+    current_buffer = free_buffers.front();
+    free_buffers.pop_front();
+  }
+
+  double start = get_monotonic_time();
+
+  unsigned char *frame = buffers[current_buffer] + chunk_frames * frame_size;
+  bool is_key = chunk_frames == 0;
+  uint16_t *prev = &previous[0];
+  glm::vec3 box(header.box_size[0], header.box_size[1], header.box_size[2]);
+  float range = header.velocity_range;
+
+  get_thread_pool()->parallel_for(0, n, TRAJECTORY_GRAIN, [frame, is_key, prev, box, range, n](int begin, int end, int chunk) {
+      for (int i = begin; i < end; i++) {
+
+	Creature *c = get_creature(i);
+	uint16_t q[TRAJECTORY_NUM_FIELDS];
+
+	for (int k = 0; k < 3; k++) {
+	  q[k] = quantize_trajectory_value(c->position[k], 0.0f, box[k]);
+	  q[3 + k] = quantize_trajectory_value(c->velocity[k], -range, range);
+	}
+
+	for (int f = 0; f < TRAJECTORY_NUM_FIELDS; f++) {
+	  uint16_t & p = prev[(size_t) f * n + i];
+	  uint16_t value = q[f];
+	  if (!is_key) {
+	    uint16_t predicted = f < 3 ? predict_trajectory_position(p, q[3 + f], box[f], range) : p;
+	    int16_t delta = (int16_t) (uint16_t) (q[f] - predicted);   // mod 2^16 -- a wrap around the box is no big jump
+	    value = (uint16_t) ((delta << 1) ^ (delta >> 15));         // zigzag: small magnitudes -> small values
+	  }
+	  p = q[f];
+
+	  unsigned char *plane = frame + (size_t) 2 * f * n;
+	  plane[i] = value & 0xff;
+	  plane[n + i] = value >> 8;
+	}
+      }
+    });
+
+  record_time += get_monotonic_time() - start;
+
+  chunk_frames++;
+  frames_recorded++;
+
+  if (chunk_frames == header.frames_per_chunk)
+    queue_chunk();
+}
+
+//----------------------------------------------------------------------------
+
+void Trajectory_Recorder::queue_chunk()
+{
+  Chunk_Job job;
+  job.buffer = current_buffer;
+  job.first_frame = frames_recorded - chunk_frames;
+  job.num_frames = chunk_frames;
+
+  {
+    lock_guard <mutex> lock(queue_mutex);
+    job.sequence = num_chunks_queued++;
+    filled_buffers.push_back(job);
+  }
+  queue_cv.notify_all();
+
+  current_buffer = -1;
+  chunk_frames = 0;
+}
+
+//----------------------------------------------------------------------------
+
+// deflate whichever chunk is next in line, give its buffer back, then wait for
+// the chunks before it to be written before writing it.  the wait and the
+// write are under write_mutex only, so a slow disk holds up other compressors
+// but never record_frame() or queue_chunk()
+
+void Trajectory_Recorder::compressor_loop()
+{
+  vector <unsigned char> compressed(compressBound(header.frames_per_chunk * frame_size));
+
+  while (true) {
+
+    Chunk_Job job;
+
+    {
+      unique_lock <mutex> lock(queue_mutex);
+      queue_cv.wait(lock, [this] { return is_finishing || !filled_buffers.empty(); });
+      if (filled_buffers.empty())
+	return;
+      job = filled_buffers.front();
+      filled_buffers.pop_front();
+    }
+
+    uLong raw_size = job.num_frames * frame_size;
+    uLongf compressed_size = compressed.size();
+    if (compress2(&compressed[0], &compressed_size, buffers[job.buffer], raw_size, TRAJECTORY_ZLIB_LEVEL) != Z_OK)
+      compressed_size = 0;
+
+    {
+      lock_guard <mutex> lock(queue_mutex);
+      free_buffers.push_back(job.buffer);
+    }
+    queue_cv.notify_all();
+
+    {
+      unique_lock <mutex> lock(write_mutex);
+      write_cv.wait(lock, [this, &job] { return num_chunks_written == job.sequence; });
+
+      Trajectory_Chunk_Header chunk_header;
+      chunk_header.magic = TRAJECTORY_CHUNK_MAGIC;
+      chunk_header.first_frame = job.first_frame;
+      chunk_header.num_frames = job.num_frames;
+      chunk_header.compressed_size = compressed_size;
+
+      Trajectory_Chunk_Index entry;
+      entry.offset = file_offset;
+      entry.first_frame = job.first_frame;
+      entry.num_frames = job.num_frames;
+
+      if (compressed_size && is_write_ok) {
+	is_write_ok = fwrite(&chunk_header, sizeof(Trajectory_Chunk_Header), 1, fp) == 1
+	  && fwrite(&compressed[0], 1, compressed_size, fp) == compressed_size;
+	index.push_back(entry);
+	file_offset += sizeof(Trajectory_Chunk_Header) + compressed_size;
+	raw_bytes += raw_size;
+	compressed_bytes += sizeof(Trajectory_Chunk_Header) + compressed_size;
+      }
+      else
+	is_write_ok = false;
+
+      num_chunks_written++;
+    }
+    write_cv.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------
+
+void Trajectory_Recorder::finish()
+{
+  if (!fp)
+    return;
+
+  if (chunk_frames > 0)
+    queue_chunk();
+
+  {
+    lock_guard <mutex> lock(queue_mutex);
+    is_finishing = true;
+  }
+  queue_cv.notify_all();
+
+  for (int i = 0; i < compressors.size(); i++)
+    compressors[i].join();
+  compressors.clear();
+
+  // chunk index, so a player can seek without reading every chunk
+
+  Trajectory_Footer footer;
+  footer.index_offset = file_offset;
+  footer.num_chunks = index.size();
+  footer.magic = TRAJECTORY_INDEX_MAGIC;
+
+  if (is_write_ok && !index.empty())
+    is_write_ok = fwrite(&index[0], sizeof(Trajectory_Chunk_Index), index.size(), fp) == index.size();
+  if (is_write_ok)
+    is_write_ok = fwrite(&footer, sizeof(Trajectory_Footer), 1, fp) == 1;
+  is_write_ok = !fclose(fp) && is_write_ok;
+  fp = NULL;
+
+  if (!is_write_ok)
+    printf("could not write all of %s\n", filename.c_str());
+
+  printf("recorded %li frames of %i creatures to %s: %.1f MB raw, %.1f MB on disk (%.1fx); "
+	 "%.3f ms/frame quantizing, stalled %.2f s waiting on compressors\n",
+	 frames_recorded, header.num_creatures, filename.c_str(), raw_bytes / 1048576.0, compressed_bytes / 1048576.0,
+	 compressed_bytes ? (double) raw_bytes / compressed_bytes : 0.0,
+	 frames_recorded ? 1000.0 * record_time / frames_recorded : 0.0, stall_time);
+  fflush(stdout);
+}
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
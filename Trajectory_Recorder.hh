@@ -0,0 +1,168 @@
+#ifndef TRAJECTORY_RECORDER_HH
+
+#define TRAJECTORY_RECORDER_HH
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+//
+// "Creature Box" -- flocking app
+//
+// trajectory recording: every step's positions and velocities, quantized to
+// 16 bits against the box, delta-coded from the step before and deflated in
+// chunks on background threads
+//
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <glm/glm.hpp>
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#define TRAJECTORY_MAGIC             0x4a415254   // "TRAJ"
+#define TRAJECTORY_CHUNK_MAGIC       0x4b4e4843   // "CHNK"
+#define TRAJECTORY_INDEX_MAGIC       0x58444954   // "TIDX"
+#define TRAJECTORY_VERSION           1
+
+#define TRAJECTORY_NUM_FIELDS        6        // position x, y, z, velocity x, y, z
+#define TRAJECTORY_VELOCITY_RANGE    0.1      // velocities quantized over [-range, range] per step
+#define TRAJECTORY_CHUNK_BYTES       (32 << 20)   // aim for chunks of about this much raw data...
+#define TRAJECTORY_MIN_CHUNK_FRAMES  4        // ...but never fewer frames than this
+#define TRAJECTORY_MAX_CHUNK_FRAMES  120      //    or more than this
+#define TRAJECTORY_NUM_COMPRESSORS   2        // background threads deflating chunks
+#define TRAJECTORY_ZLIB_LEVEL        1        // fastest -- the deltas are mostly zero bytes anyway
+#define TRAJECTORY_GRAIN             8192     // creatures per worker pool chunk when quantizing
+
+// file layout: Trajectory_Header, then chunks (a Trajectory_Chunk_Header and
+// its deflated frames), then one Trajectory_Chunk_Index per chunk and the
+// Trajectory_Footer.  a file without a footer (the recorder never finished)
+// can still be read chunk by chunk from the front.
+//
+// a raw frame is TRAJECTORY_NUM_FIELDS fields, each as num_creatures low
+// bytes followed by num_creatures high bytes of 16-bit values.  the first
+// frame of a chunk holds the quantized values themselves; the others hold
+// zigzag-coded differences from the frame before -- for positions, from the
+// last position moved by this frame's velocity (predict_trajectory_position())
+// -- so every chunk decodes on its own
+
+struct Trajectory_Header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_creatures;
+  uint32_t num_flockers;                    // the rest are predators
+  uint32_t frames_per_chunk;                // the last chunk may have fewer
+  float box_size[3];                        // positions quantize over [0, box_size]
+  float velocity_range;
+  uint32_t reserved;
+};
+
+struct Trajectory_Chunk_Header
+{
+  uint32_t magic;
+  uint32_t first_frame;
+  uint32_t num_frames;
+  uint32_t compressed_size;                 // bytes of zlib data that follow
+};
+
+struct Trajectory_Chunk_Index
+{
+  uint64_t offset;                          // of the chunk header, from the start of the file
+  uint32_t first_frame;
+  uint32_t num_frames;
+};
+
+struct Trajectory_Footer
+{
+  uint64_t index_offset;
+  uint32_t num_chunks;
+  uint32_t magic;
+};
+
+//----------------------------------------------------------------------------
+
+uint16_t quantize_trajectory_value(float, float, float);          // value, lower, upper
+float dequantize_trajectory_value(uint16_t, float, float);
+uint16_t predict_trajectory_position(uint16_t, uint16_t, float, float);   // last position, this velocity, box side, velocity range
+
+//----------------------------------------------------------------------------
+
+class Trajectory_Recorder
+{
+public:
+
+  string filename;
+  FILE *fp;
+  Trajectory_Header header;
+  size_t frame_size;                        // raw bytes per frame
+
+  vector <uint16_t> previous;               // last frame's quantized values, field-major
+  int current_buffer;                       // chunk being filled (-1 -> none yet)
+  int chunk_frames;                         // frames in it so far
+  long frames_recorded;
+  bool is_stopped;                          // flock changed size -- nothing more is recorded
+
+  // chunk buffers cycle free -> filling -> filled -> (compressor) -> free.
+  // compressors can finish out of order, so chunks wait their turn to be written.
+  // queue_mutex covers only the buffer queues, so the step thread never waits
+  // on a write; write_mutex covers the file and everything after num_chunks_written
+
+  struct Chunk_Job
+  {
+    int buffer;
+    long sequence;
+    long first_frame;
+    int num_frames;
+  };
+
+  vector <unsigned char *> buffers;
+  deque <int> free_buffers;
+  deque <Chunk_Job> filled_buffers;
+  long num_chunks_queued;
+  bool is_finishing;
+  mutex queue_mutex;
+  condition_variable queue_cv;
+
+  long num_chunks_written;                  // whose turn it is to write
+  vector <Trajectory_Chunk_Index> index;
+  uint64_t file_offset;
+  bool is_write_ok;
+  mutex write_mutex;
+  condition_variable write_cv;
+
+  vector <thread> compressors;
+
+  double record_time;                       // step thread, quantizing
+  double stall_time;                        // step thread, waiting for a free buffer
+  uint64_t raw_bytes, compressed_bytes;     // written so far -- under write_mutex
+
+  Trajectory_Recorder(const char *, int, int, glm::vec3);   // file, creatures, flockers, box size
+  ~Trajectory_Recorder();
+
+  void record_frame();                      // the creatures as they are now -- after the step
+  void finish();                            // flush everything, write the index and report
+
+private:
+
+  void queue_chunk();
+  void compressor_loop();
+};
+
+//----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,283 @@
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <glm/glm.hpp>
+
+#include "objloader.hpp"
+#include "vboindexer.hpp"
+#include "meshsimplify.hpp"
+#include "meshcache.hpp"
+
+// Compiled mesh format : a fixed header followed by the vertex, UV, normal and
+// index arrays exactly as they go to glBufferData, each starting on a 4 byte
+// boundary. The header records the size and mtime of the .obj it came from so
+// that editing the .obj invalidates the cache, and where each level of detail
+// starts in the index array.
+
+#define MESHCACHE_MAGIC   0x4853454d  // "MESH"
+#define MESHCACHE_VERSION 5
+
+#define MESHCACHE_LOD_RATIO        0.5f   // triangles kept from one level to the next
+#define MESHCACHE_LOD_MIN_INDICES  (3 * 32)
+#define MESHCACHE_LOD_MAX_ERROR    0.1f   // of the bounding box diagonal
+
+struct MeshCacheLod {
+	uint32_t first_index;
+	uint32_t num_indices;
+	float    error;
+	uint32_t reserved;
+};
+
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t index_size;
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	uint32_t num_lods;
+	uint64_t source_size;
+	int64_t  source_mtime;
+	float    bounds_min[3];
+	float    bounds_max[3];
+	MeshCacheLod lods[MESHCACHE_MAX_LODS];
+};
+
+static size_t align4(size_t n){
+	return (n + 3) & ~(size_t) 3;
+}
+
+static size_t meshImageSize(const MeshCacheHeader & header){
+	return sizeof(MeshCacheHeader)
+		+ (size_t) header.num_vertices * (sizeof(glm::vec3) + sizeof(glm::vec2) + sizeof(glm::vec3))
+		+ align4((size_t) header.num_indices * header.index_size);
+}
+
+// Point the mesh's arrays into a complete image (header + arrays)
+static bool bindMeshImage(const char * image, size_t size, MeshCache & mesh){
+	if (size < sizeof(MeshCacheHeader))
+		return false;
+
+	const MeshCacheHeader * header = (const MeshCacheHeader *) image;
+	if (header->magic != MESHCACHE_MAGIC || header->version != MESHCACHE_VERSION)
+		return false;
+	if (header->index_size != 2 && header->index_size != 4)
+		return false;
+	if (header->num_lods < 1 || header->num_lods > MESHCACHE_MAX_LODS)
+		return false;
+	if (meshImageSize(*header) != size)
+		return false;
+	for (unsigned int l=0; l<header->num_lods; l++)
+		if ((uint64_t) header->lods[l].first_index + header->lods[l].num_indices > header->num_indices)
+			return false;
+
+	const char * p = image + sizeof(MeshCacheHeader);
+
+	mesh.num_vertices = header->num_vertices;
+	mesh.num_indices  = header->num_indices;
+	mesh.index_size   = header->index_size;
+	mesh.vertices = (const glm::vec3 *) p;  p += header->num_vertices * sizeof(glm::vec3);
+	mesh.uvs      = (const glm::vec2 *) p;  p += header->num_vertices * sizeof(glm::vec2);
+	mesh.normals  = (const glm::vec3 *) p;  p += header->num_vertices * sizeof(glm::vec3);
+	mesh.indices  = (const void *) p;
+	mesh.bounds_min = glm::vec3(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+	mesh.bounds_max = glm::vec3(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+	mesh.num_lods = header->num_lods;
+	for (unsigned int l=0; l<header->num_lods; l++){
+		mesh.lod_first_index[l] = header->lods[l].first_index;
+		mesh.lod_num_indices[l] = header->lods[l].num_indices;
+		mesh.lod_error[l]       = header->lods[l].error;
+	}
+	return true;
+}
+
+// Map the cache if it matches the current .obj ; returns false otherwise
+static bool mapMeshCache(const std::string & cache_path, const struct stat & source, MeshCache & mesh){
+	int fd = open(cache_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(MeshCacheHeader)){
+		close(fd);
+		return false;
+	}
+
+	void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return false;
+
+	const MeshCacheHeader * header = (const MeshCacheHeader *) mapping;
+	bool ok = header->source_size == (uint64_t) source.st_size
+		&& header->source_mtime == (int64_t) source.st_mtime
+		&& bindMeshImage((const char *) mapping, st.st_size, mesh);
+	if (!ok){
+		munmap(mapping, st.st_size);
+		return false;
+	}
+
+	// the whole file goes to the GPU right away, so ask for it all up front
+	madvise(mapping, st.st_size, MADV_WILLNEED);
+
+	mesh.mapping = mapping;
+	mesh.mapping_size = st.st_size;
+	return true;
+}
+
+// Append coarser and coarser versions of the indexed mesh to "indices", each
+// simplified from the one before, until they stop getting smaller
+static unsigned int buildLods(
+	std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	float max_error,
+	MeshCacheLod lods[MESHCACHE_MAX_LODS]
+){
+	lods[0].first_index = 0;
+	lods[0].num_indices = indices.size();
+	lods[0].error = 0.0f;
+
+	unsigned int num_lods = 1;
+	std::vector<unsigned int> previous(indices), simplified;
+	while (num_lods < MESHCACHE_MAX_LODS && previous.size() > MESHCACHE_LOD_MIN_INDICES){
+		size_t target = (size_t) (previous.size() / 3 * MESHCACHE_LOD_RATIO) * 3;
+		float error = simplifyMesh(previous, &vertices[0], vertices.size(), target, max_error, simplified);
+
+		// not worth a level of its own
+		if (simplified.empty() || simplified.size() > previous.size() * 0.85f)
+			break;
+
+		optimizeVertexCache(simplified, vertices.size());
+
+		MeshCacheLod & lod = lods[num_lods++];
+		lod.first_index = indices.size();
+		lod.num_indices = simplified.size();
+		lod.error = lods[num_lods - 2].error + error;   // measured against the level before, so add up
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		previous.swap(simplified);
+	}
+	return num_lods;
+}
+
+// Parse and index the .obj, and lay the result out as a cache image
+static bool buildMeshImage(const char * path, const struct stat & source, std::vector<char> & image){
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	if (!loadOBJ_parallel(path, vertices, uvs, normals))
+		return false;
+
+	std::vector<unsigned int> indices;
+	std::vector<glm::vec3> indexed_vertices;
+	std::vector<glm::vec2> indexed_uvs;
+	std::vector<glm::vec3> indexed_normals;
+	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+	if (indices.empty()){
+		printf("%s has no faces\n", path);
+		return false;
+	}
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MESHCACHE_MAGIC;
+	header.version = MESHCACHE_VERSION;
+	header.index_size = indexed_vertices.size() > 65536 ? sizeof(unsigned int) : sizeof(unsigned short);
+	header.num_vertices = indexed_vertices.size();
+	header.source_size = source.st_size;
+	header.source_mtime = source.st_mtime;
+
+	glm::vec3 lo(0.0f), hi(0.0f);
+	for (unsigned int i=0; i<indexed_vertices.size(); i++){
+		lo = i == 0 ? indexed_vertices[i] : glm::min(lo, indexed_vertices[i]);
+		hi = i == 0 ? indexed_vertices[i] : glm::max(hi, indexed_vertices[i]);
+	}
+	for (int k=0; k<3; k++){
+		header.bounds_min[k] = lo[k];
+		header.bounds_max[k] = hi[k];
+	}
+
+	header.num_lods = buildLods(indices, indexed_vertices, MESHCACHE_LOD_MAX_ERROR * glm::length(hi - lo), header.lods);
+	header.num_indices = indices.size();
+
+	image.assign(meshImageSize(header), 0);
+	char * p = &image[0];
+	memcpy(p, &header, sizeof(header));                                         p += sizeof(header);
+	memcpy(p, &indexed_vertices[0], indexed_vertices.size() * sizeof(glm::vec3)); p += indexed_vertices.size() * sizeof(glm::vec3);
+	memcpy(p, &indexed_uvs[0],      indexed_uvs.size() * sizeof(glm::vec2));      p += indexed_uvs.size() * sizeof(glm::vec2);
+	memcpy(p, &indexed_normals[0],  indexed_normals.size() * sizeof(glm::vec3));  p += indexed_normals.size() * sizeof(glm::vec3);
+
+	// 16 bit indices whenever they are enough -- half the index bandwidth
+	if (header.index_size == sizeof(unsigned short)){
+		unsigned short * out = (unsigned short *) p;
+		for (size_t i=0; i<indices.size(); i++)
+			out[i] = (unsigned short) indices[i];
+	}else
+		memcpy(p, &indices[0], indices.size() * sizeof(unsigned int));
+	return true;
+}
+
+// Written under a temporary name and renamed, so a concurrent launch never maps half a file
+static bool writeMeshCache(const std::string & cache_path, const std::vector<char> & image){
+	char suffix[32];
+	sprintf(suffix, ".tmp%d", (int) getpid());
+	std::string temp_path = cache_path + suffix;
+
+	FILE * file = fopen(temp_path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(&image[0], 1, image.size(), file) == image.size();
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(temp_path.c_str(), cache_path.c_str()) != 0){
+		unlink(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool loadMeshCached(const char * path, MeshCache & mesh){
+	mesh.mapping = NULL;
+	mesh.mapping_size = 0;
+	mesh.storage.clear();
+
+	struct stat source;
+	if (stat(path, &source) != 0){
+		printf("Impossible to open %s\n", path);
+		return false;
+	}
+
+	std::string cache_path = std::string(path) + ".mesh";
+
+	if (mapMeshCache(cache_path, source, mesh)){
+		printf("Loaded mesh cache %s (%u vertices, %u indices, %u levels of detail)\n", cache_path.c_str(), mesh.num_vertices, mesh.lod_num_indices[0], mesh.num_lods);
+		return true;
+	}
+
+	std::vector<char> image;
+	if (!buildMeshImage(path, source, image))
+		return false;
+
+	// read-only asset directory : keep the image in memory and reparse next time
+	if (writeMeshCache(cache_path, image) && mapMeshCache(cache_path, source, mesh))
+		return true;
+
+	printf("Could not write mesh cache %s\n", cache_path.c_str());
+	mesh.storage.swap(image);
+	return bindMeshImage(&mesh.storage[0], mesh.storage.size(), mesh);
+}
+
+void unloadMesh(MeshCache & mesh){
+	if (mesh.mapping)
+		munmap(mesh.mapping, mesh.mapping_size);
+	mesh.mapping = NULL;
+	mesh.mapping_size = 0;
+	std::vector<char>().swap(mesh.storage);
+	mesh.num_vertices = mesh.num_indices = mesh.num_lods = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#define MESHCACHE_MAX_LODS 6
+
+// Indexed mesh, ready for glBufferData. The arrays point either into a
+// memory-mapped cache file or into a buffer owned by the mesh.
+// "indices" holds every level of detail back to back, all over the same
+// vertices ; level 0 is the full mesh and each next one has about half the
+// triangles.
+struct MeshCache {
+	unsigned int num_vertices;
+	unsigned int num_indices;       // all levels
+	unsigned int index_size;        // bytes per index : 2 or 4
+
+	unsigned int num_lods;
+	unsigned int lod_first_index[MESHCACHE_MAX_LODS];
+	unsigned int lod_num_indices[MESHCACHE_MAX_LODS];
+	float lod_error[MESHCACHE_MAX_LODS];   // how far the level strays from the full mesh, model units
+
+	const glm::vec3 * vertices;
+	const glm::vec2 * uvs;
+	const glm::vec3 * normals;
+	const void * indices;
+
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+
+	void * mapping;                 // mmap'ed cache file, or NULL
+	size_t mapping_size;
+	std::vector<char> storage;      // used instead when the cache could not be written
+};
+
+// Load "path" (an .obj) through its compiled cache "path.mesh". The cache is
+// rebuilt whenever it is missing, stale or from another format version.
+bool loadMeshCached(const char * path, MeshCache & mesh);
+
+void unloadMesh(MeshCache & mesh);
+
+#endif
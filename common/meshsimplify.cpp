@@ -0,0 +1,226 @@
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glm/glm.hpp>
+
+#include "meshsimplify.hpp"
+
+// Symmetric 4x4 quadric : weighted sum of squared distances to a set of planes,
+// plus the sum of the weights, so the error can be read back as a mean
+struct Quadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double w;
+};
+
+static void quadricFromPlane(Quadric & q, double a, double b, double c, double d, double weight){
+	q.a2 = weight * a * a; q.ab = weight * a * b; q.ac = weight * a * c; q.ad = weight * a * d;
+	q.b2 = weight * b * b; q.bc = weight * b * c; q.bd = weight * b * d;
+	q.c2 = weight * c * c; q.cd = weight * c * d;
+	q.d2 = weight * d * d;
+	q.w = weight;
+}
+
+static void quadricAdd(Quadric & q, const Quadric & r){
+	q.a2 += r.a2; q.ab += r.ab; q.ac += r.ac; q.ad += r.ad;
+	q.b2 += r.b2; q.bc += r.bc; q.bd += r.bd;
+	q.c2 += r.c2; q.cd += r.cd;
+	q.d2 += r.d2;
+	q.w += r.w;
+}
+
+// Area-weighted mean squared distance from p to the planes : length², whatever
+// the size of the triangles
+static double quadricError(const Quadric & q, const glm::vec3 & p){
+	if (q.w <= 0.0)
+		return 0.0;
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z + 2 * q.ad * x
+	         + q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y
+	         + q.c2 * z * z + 2 * q.cd * z
+	         + q.d2;
+	return e > 0.0 ? e / q.w : 0.0;
+}
+
+struct Collapse {
+	unsigned int from, to;
+	double cost;
+	bool operator<(const Collapse & that) const{
+		return cost < that.cost;
+	}
+};
+
+static inline uint64_t edgeKey(unsigned int a, unsigned int b){
+	return a < b ? ((uint64_t) a << 32) | b : ((uint64_t) b << 32) | a;
+}
+
+// Does moving "from" onto "to" turn any triangle around "from" over ?
+static bool collapseFlips(
+	const std::vector<unsigned int> & indices,
+	const std::vector<unsigned int> & triangles, unsigned int first, unsigned int count,
+	const glm::vec3 * positions, unsigned int from, unsigned int to
+){
+	for (unsigned int j=first; j<first+count; j++){
+		const unsigned int * tri = &indices[3 * triangles[j]];
+		if (tri[0] == to || tri[1] == to || tri[2] == to)
+			continue;   // goes away
+
+		glm::vec3 p[3], q[3];
+		for (int k=0; k<3; k++){
+			p[k] = positions[tri[k]];
+			q[k] = tri[k] == from ? positions[to] : p[k];
+		}
+		glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+		glm::vec3 after  = glm::cross(q[1] - q[0], q[2] - q[0]);
+		if (glm::dot(before, after) <= 0.0f)
+			return true;
+	}
+	return false;
+}
+
+float simplifyMesh(
+	const std::vector<unsigned int> & indices,
+	const glm::vec3 * positions,
+	unsigned int num_vertices,
+	size_t target_index_count,
+	float max_error,
+	std::vector<unsigned int> & out_indices
+){
+	out_indices = indices;
+
+	// Lock seams : vertices that share a position with another vertex
+	std::vector<char> locked(num_vertices, 0);
+	std::unordered_map<uint64_t, unsigned int> first_at_position;
+	std::vector<unsigned int> welded(num_vertices);
+	for (unsigned int v=0; v<num_vertices; v++){
+		uint32_t bits[3];
+		memcpy(bits, &positions[v], sizeof(bits));
+		uint64_t key = ((uint64_t) bits[0] * 73856093u) ^ ((uint64_t) bits[1] * 19349663u << 16) ^ ((uint64_t) bits[2] * 83492791u << 32);
+		std::unordered_map<uint64_t, unsigned int>::iterator it = first_at_position.find(key);
+		welded[v] = v;
+		if (it == first_at_position.end())
+			first_at_position[key] = v;
+		else if (positions[it->second] == positions[v]){
+			welded[v] = it->second;
+			locked[v] = locked[it->second] = 1;
+		}
+	}
+
+	// Lock open borders : edges (between welded positions) used by one triangle only
+	std::unordered_map<uint64_t, int> edge_use;
+	for (size_t t=0; t<indices.size(); t+=3)
+		for (int k=0; k<3; k++)
+			edge_use[edgeKey(welded[indices[t+k]], welded[indices[t+(k+1)%3]])]++;
+	for (size_t t=0; t<indices.size(); t+=3)
+		for (int k=0; k<3; k++){
+			unsigned int a = indices[t+k], b = indices[t+(k+1)%3];
+			if (edge_use[edgeKey(welded[a], welded[b])] == 1)
+				locked[a] = locked[b] = 1;
+		}
+
+	// Area-weighted plane quadrics
+	Quadric zero;
+	memset(&zero, 0, sizeof(zero));
+	std::vector<Quadric> quadrics(num_vertices, zero);
+	for (size_t t=0; t<indices.size(); t+=3){
+		glm::vec3 p0 = positions[indices[t]], p1 = positions[indices[t+1]], p2 = positions[indices[t+2]];
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(n);
+		if (length == 0.0f)
+			continue;
+		n /= length;
+		Quadric q;
+		quadricFromPlane(q, n.x, n.y, n.z, -glm::dot(n, p0), 0.5 * length);
+		for (int k=0; k<3; k++)
+			quadricAdd(quadrics[indices[t+k]], q);
+	}
+
+	double max_cost = (double) max_error * max_error;
+	double worst_cost = 0.0;
+
+	// Passes of non-overlapping collapses, cheapest first
+	while (out_indices.size() > target_index_count){
+		size_t num_triangles = out_indices.size() / 3;
+
+		// vertex -> triangles
+		std::vector<unsigned int> offset(num_vertices + 1, 0);
+		for (size_t i=0; i<out_indices.size(); i++)
+			offset[out_indices[i] + 1]++;
+		for (unsigned int v=0; v<num_vertices; v++)
+			offset[v + 1] += offset[v];
+		std::vector<unsigned int> triangles(out_indices.size());
+		std::vector<unsigned int> fill(offset.begin(), offset.end() - 1);
+		for (size_t t=0; t<num_triangles; t++)
+			for (int k=0; k<3; k++)
+				triangles[fill[out_indices[3*t+k]]++] = t;
+
+		std::vector<Collapse> candidates;
+		for (size_t t=0; t<num_triangles; t++)
+			for (int k=0; k<3; k++){
+				unsigned int a = out_indices[3*t+k], b = out_indices[3*t+(k+1)%3];
+				Quadric q = quadrics[a];
+				quadricAdd(q, quadrics[b]);
+				double cost = quadricError(q, positions[b]);
+				if (!locked[a]){
+					Collapse c = { a, b, cost };
+					candidates.push_back(c);
+				}
+				if (!locked[b]){
+					Collapse c = { b, a, quadricError(q, positions[a]) };
+					candidates.push_back(c);
+				}
+			}
+		std::sort(candidates.begin(), candidates.end());
+
+		size_t triangles_to_remove = (out_indices.size() - target_index_count + 2) / 3;
+		size_t removed = 0;
+		std::vector<char> touched(num_vertices, 0);
+		std::vector<unsigned int> collapse_to(num_vertices);
+		for (unsigned int v=0; v<num_vertices; v++)
+			collapse_to[v] = v;
+
+		for (size_t i=0; i<candidates.size() && removed < triangles_to_remove; i++){
+			const Collapse & c = candidates[i];
+			if (c.cost > max_cost)
+				break;
+			if (touched[c.from] || touched[c.to])
+				continue;
+			if (collapseFlips(out_indices, triangles, offset[c.from], offset[c.from + 1] - offset[c.from], positions, c.from, c.to))
+				continue;
+
+			collapse_to[c.from] = c.to;
+			quadricAdd(quadrics[c.to], quadrics[c.from]);
+			worst_cost = std::max(worst_cost, c.cost);
+
+			// freeze the neighbourhood for the rest of this pass, so the flip test above stays valid
+			for (unsigned int j=offset[c.from]; j<offset[c.from + 1]; j++){
+				const unsigned int * tri = &out_indices[3 * triangles[j]];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+					removed++;
+			}
+		}
+
+		if (removed == 0)
+			break;   // nothing more within max_error
+
+		size_t n = 0;
+		for (size_t t=0; t<out_indices.size(); t+=3){
+			unsigned int a = collapse_to[out_indices[t]];
+			unsigned int b = collapse_to[out_indices[t+1]];
+			unsigned int c = collapse_to[out_indices[t+2]];
+			if (a != b && b != c && c != a){
+				out_indices[n++] = a;
+				out_indices[n++] = b;
+				out_indices[n++] = c;
+			}
+		}
+		out_indices.resize(n);
+	}
+
+	return (float) sqrt(worst_cost);
+}
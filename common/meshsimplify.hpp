@@ -0,0 +1,19 @@
+#ifndef MESHSIMPLIFY_HPP
+#define MESHSIMPLIFY_HPP
+
+// Quadric error metric edge collapse (Garland & Heckbert, 1997), restricted to
+// collapsing a vertex onto one of its neighbours so that every level of detail
+// can share one vertex buffer. Vertices on open borders and on attribute seams
+// (same position, different uv or normal) never move, so textures don't tear.
+// Stops at target_index_count, or when the next collapse would cost more than
+// max_error. Returns the largest error accepted (a distance, in model units).
+float simplifyMesh(
+	const std::vector<unsigned int> & indices,
+	const glm::vec3 * positions,
+	unsigned int num_vertices,
+	size_t target_index_count,
+	float max_error,
+	std::vector<unsigned int> & out_indices
+);
+
+#endif
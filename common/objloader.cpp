@@ -1,12 +1,24 @@
 #include <vector>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
 #include <string>
 #include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <glm/glm.hpp>
 
 #include "objloader.hpp"
 
+#include <Thread_Pool.hh>
+
 // Very, VERY simple OBJ loader.
 // Here is a short list of features a real function would provide : 
 // - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
@@ -111,6 +123,392 @@ bool loadOBJ(
 }
 
 
+// Faster OBJ loader for big meshes. The file is memory-mapped and split at
+// line boundaries into one chunk per pool thread, and the chunks are parsed on
+// the app's worker pool (so calling this from a pool task doesn't start more
+// threads than there are cores). Face indices are resolved against the whole
+// file afterwards, so negative (relative) indices work across chunk boundaries.
+// Handles v, v/vt, v//vn and v/vt/vn corners and polygons of any size (fan
+// triangulated). A missing UV becomes (0,0), a missing normal the face normal.
+
+#define OBJ_MIN_CHUNK_SIZE (256 * 1024)
+#define OBJ_MISSING_INDEX  INT_MIN
+
+struct ObjCorner {
+	int index[3];             // v, vt, vn ; 0-based
+	unsigned char relative;   // bit k set -> index[k] counts from the chunk's first element
+};
+
+struct ObjChunk {
+	const char * begin;
+	const char * end;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<ObjCorner> corners;    // 3 per triangle
+	const char * error;               // start of the first line that could not be parsed
+	bool out_of_range;
+	size_t first_corner;               // where this chunk's triangles go in the output
+	int first_element[3];              // v, vt, vn defined before this chunk
+};
+
+static inline bool isBlank(char c){
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char * skipBlanks(const char * p, const char * end){
+	while (p < end && isBlank(*p))
+		p++;
+	return p;
+}
+
+static const double powersOf10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Plain decimal notation only (sign, digits, fraction, exponent) -- anything
+// else, like "nan" or hex floats, goes through strtof.
+// Returns NULL if there is no number at p.
+static const char * parseFloat(const char * p, const char * end, float & out){
+	p = skipBlanks(p, end);
+	const char * start = p;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')){
+		negative = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any_digits = false;
+	while (p < end && *p >= '0' && *p <= '9'){
+		if (digits < 19){
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa)
+				digits++;
+		}else
+			exponent++;
+		any_digits = true;
+		p++;
+	}
+	if (p < end && *p == '.'){
+		p++;
+		while (p < end && *p >= '0' && *p <= '9'){
+			if (digits < 19){
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					digits++;
+				exponent--;
+			}
+			any_digits = true;
+			p++;
+		}
+	}
+	if (any_digits && p < end && (*p == 'e' || *p == 'E')){
+		const char * q = p + 1;
+		bool negative_exponent = false;
+		if (q < end && (*q == '-' || *q == '+')){
+			negative_exponent = *q == '-';
+			q++;
+		}
+		if (q < end && *q >= '0' && *q <= '9'){
+			int e = 0;
+			while (q < end && *q >= '0' && *q <= '9'){
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+				q++;
+			}
+			exponent += negative_exponent ? -e : e;
+			p = q;
+		}
+	}
+
+	if (!any_digits || (p < end && !isBlank(*p) && *p != '\n')){
+		// not plain decimal -- let the C library have a go at the token
+		char token[64];
+		const char * token_end = start;
+		while (token_end < end && !isBlank(*token_end) && *token_end != '\n' && token_end - start < 63)
+			token_end++;
+		memcpy(token, start, token_end - start);
+		token[token_end - start] = '\0';
+		char * parsed_end;
+		out = strtof(token, &parsed_end);
+		return parsed_end == token ? NULL : start + (parsed_end - token);
+	}
+
+	double value = (double) mantissa;
+	if (exponent < 0)
+		value = exponent >= -22 ? value / powersOf10[-exponent] : value * pow(10.0, exponent);
+	else if (exponent > 0)
+		value = exponent <= 22 ? value * powersOf10[exponent] : value * pow(10.0, exponent);
+	out = (float) (negative ? -value : value);
+	return p;
+}
+
+static const char * parseInt(const char * p, const char * end, int & out){
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')){
+		negative = *p == '-';
+		p++;
+	}
+	if (p == end || *p < '0' || *p > '9')
+		return NULL;
+	int value = 0;
+	while (p < end && *p >= '0' && *p <= '9'){
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	out = negative ? -value : value;
+	return p;
+}
+
+// One face corner : "v", "v/vt", "v//vn" or "v/vt/vn"
+static const char * parseCorner(const char * p, const char * end, const int counts[3], ObjCorner & corner){
+	int value[3] = { 0, 0, 0 };
+
+	p = parseInt(p, end, value[0]);
+	if (p == NULL)
+		return NULL;
+	if (p < end && *p == '/'){
+		p++;
+		if (p < end && *p != '/'){
+			p = parseInt(p, end, value[1]);
+			if (p == NULL)
+				return NULL;
+		}
+		if (p < end && *p == '/'){
+			p = parseInt(p + 1, end, value[2]);
+			if (p == NULL)
+				return NULL;
+		}
+	}
+	if (value[0] == 0)
+		return NULL;
+
+	corner.relative = 0;
+	for (int k=0; k<3; k++){
+		if (value[k] > 0)
+			corner.index[k] = value[k] - 1;
+		else if (value[k] < 0){
+			corner.index[k] = counts[k] + value[k];
+			corner.relative |= 1 << k;
+		}else
+			corner.index[k] = OBJ_MISSING_INDEX;
+	}
+	return p;
+}
+
+static void parseObjChunk(ObjChunk & chunk){
+	std::vector<ObjCorner> polygon;
+	const char * p = chunk.begin;
+	const char * end = chunk.end;
+
+	while (p < end){
+		const char * line = p;
+		const char * eol = (const char *) memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+
+		p = skipBlanks(p, eol);
+		bool ok = true;
+
+		if (eol - p >= 2 && p[0] == 'v' && isBlank(p[1])){
+			glm::vec3 vertex;
+			ok = (p = parseFloat(p + 1, eol, vertex.x)) && (p = parseFloat(p, eol, vertex.y)) && (p = parseFloat(p, eol, vertex.z));
+			chunk.positions.push_back(vertex);
+		}else if (eol - p >= 3 && p[0] == 'v' && p[1] == 't' && isBlank(p[2])){
+			glm::vec2 uv(0.0f, 0.0f);
+			ok = (p = parseFloat(p + 2, eol, uv.x)) != NULL;
+			if (ok && skipBlanks(p, eol) < eol)
+				ok = (p = parseFloat(p, eol, uv.y)) != NULL;
+			uv.y = -uv.y; // Invert V coordinate, as in loadOBJ
+			chunk.uvs.push_back(uv);
+		}else if (eol - p >= 3 && p[0] == 'v' && p[1] == 'n' && isBlank(p[2])){
+			glm::vec3 normal;
+			ok = (p = parseFloat(p + 2, eol, normal.x)) && (p = parseFloat(p, eol, normal.y)) && (p = parseFloat(p, eol, normal.z));
+			chunk.normals.push_back(normal);
+		}else if (eol - p >= 2 && p[0] == 'f' && isBlank(p[1])){
+			int counts[3] = { (int) chunk.positions.size(), (int) chunk.uvs.size(), (int) chunk.normals.size() };
+			polygon.clear();
+			p = skipBlanks(p + 1, eol);
+			while (ok && p < eol){
+				ObjCorner corner;
+				p = parseCorner(p, eol, counts, corner);
+				ok = p != NULL;
+				if (ok){
+					polygon.push_back(corner);
+					p = skipBlanks(p, eol);
+				}
+			}
+			ok = ok && polygon.size() >= 3;
+			for (unsigned int i=1; ok && i+1<polygon.size(); i++){
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[i]);
+				chunk.corners.push_back(polygon[i+1]);
+			}
+		}
+		// anything else (comments, o, g, s, usemtl, mtllib, l, ...) is ignored
+
+		if (!ok){
+			chunk.error = line;
+			return;
+		}
+		p = eol + 1;
+	}
+}
+
+// Turn a chunk's corners into triangle-soup attributes, now that every
+// chunk's element counts are known
+static void emitObjChunk(
+	ObjChunk & chunk,
+	const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	int totals[3] = { (int) positions.size(), (int) uvs.size(), (int) normals.size() };
+
+	for (size_t t=0; t<chunk.corners.size(); t+=3){
+		int index[3][3];
+		for (int c=0; c<3; c++){
+			const ObjCorner & corner = chunk.corners[t+c];
+			for (int k=0; k<3; k++){
+				int i = corner.index[k];
+				if (i != OBJ_MISSING_INDEX){
+					if (corner.relative & (1 << k))
+						i += chunk.first_element[k];
+					if (i < 0 || i >= totals[k]){
+						chunk.out_of_range = true;
+						return;
+					}
+				}
+				index[c][k] = i;
+			}
+		}
+
+		glm::vec3 face_normal(0.0f);
+		if (index[0][2] == OBJ_MISSING_INDEX || index[1][2] == OBJ_MISSING_INDEX || index[2][2] == OBJ_MISSING_INDEX){
+			glm::vec3 n = glm::cross(positions[index[1][0]] - positions[index[0][0]], positions[index[2][0]] - positions[index[0][0]]);
+			float length = glm::length(n);
+			face_normal = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+		}
+
+		size_t o = chunk.first_corner + t;
+		for (int c=0; c<3; c++){
+			out_vertices[o+c] = positions[index[c][0]];
+			out_uvs[o+c]      = index[c][1] == OBJ_MISSING_INDEX ? glm::vec2(0.0f, 0.0f) : uvs[index[c][1]];
+			out_normals[o+c]  = index[c][2] == OBJ_MISSING_INDEX ? face_normal : normals[index[c][2]];
+		}
+	}
+}
+
+bool loadOBJ_parallel(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	printf("Loading OBJ file %s...\n", path);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0){
+		printf("Impossible to open the file ! Are you in the right path ?\n");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0){
+		printf("%s is empty\n", path);
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	const char * data = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED){
+		printf("Impossible to map %s\n", path);
+		return false;
+	}
+	madvise((void *) data, size, MADV_SEQUENTIAL);
+
+	// Split at line boundaries
+	Thread_Pool * pool = get_thread_pool();
+	size_t num_chunks = std::min<size_t>(pool->num_threads(), size / OBJ_MIN_CHUNK_SIZE);
+	if (num_chunks < 1)
+		num_chunks = 1;
+
+	std::vector<ObjChunk> chunks(num_chunks);
+	const char * data_end = data + size;
+	const char * p = data;
+	for (size_t c=0; c<num_chunks; c++){
+		const char * q = c + 1 == num_chunks ? data_end : data + size * (c + 1) / num_chunks;
+		if (q < p)
+			q = p;
+		if (q < data_end){
+			q = (const char *) memchr(q, '\n', data_end - q);
+			q = q ? q + 1 : data_end;
+		}
+		chunks[c].begin = p;
+		chunks[c].end = q;
+		chunks[c].error = NULL;
+		chunks[c].out_of_range = false;
+		p = q;
+	}
+
+	pool->parallel_for(0, num_chunks, 1, [&chunks](int begin, int end, int chunk){
+		for (int c=begin; c<end; c++)
+			parseObjChunk(chunks[c]);
+	});
+
+	for (size_t c=0; c<num_chunks; c++){
+		if (chunks[c].error){
+			long line = 1 + std::count(data, chunks[c].error, '\n');
+			printf("%s:%ld : can't be read by our parser\n", path, line);
+			munmap((void *) data, size);
+			return false;
+		}
+	}
+	munmap((void *) data, size);
+
+	// Gather the elements and work out where each chunk's triangles go
+	std::vector<glm::vec3> positions, normals;
+	std::vector<glm::vec2> uvs;
+	size_t num_corners = 0;
+	for (size_t c=0; c<num_chunks; c++){
+		chunks[c].first_element[0] = positions.size();
+		chunks[c].first_element[1] = uvs.size();
+		chunks[c].first_element[2] = normals.size();
+		chunks[c].first_corner = num_corners;
+		positions.insert(positions.end(), chunks[c].positions.begin(), chunks[c].positions.end());
+		uvs      .insert(uvs.end(),       chunks[c].uvs.begin(),       chunks[c].uvs.end());
+		normals  .insert(normals.end(),   chunks[c].normals.begin(),   chunks[c].normals.end());
+		num_corners += chunks[c].corners.size();
+	}
+
+	out_vertices.resize(num_corners);
+	out_uvs     .resize(num_corners);
+	out_normals .resize(num_corners);
+
+	pool->parallel_for(0, num_chunks, 1, [&](int begin, int end, int chunk){
+		for (int c=begin; c<end; c++)
+			emitObjChunk(chunks[c], positions, uvs, normals, out_vertices, out_uvs, out_normals);
+	});
+
+	for (size_t c=0; c<num_chunks; c++){
+		if (chunks[c].out_of_range){
+			printf("%s : face index out of range\n", path);
+			return false;
+		}
+	}
+
+	printf("%u vertices, %u triangles (%u chunks)\n", (unsigned int) positions.size(), (unsigned int) (num_corners / 3), (unsigned int) num_chunks);
+	return true;
+}
+
+
 #ifdef USE_ASSIMP // don't use this #define, it's only for me (it AssImp fails to compile on your machine, at least all the other tutorials still work)
 
 // Include AssImp
@@ -9,6 +9,14 @@ bool loadOBJ(
 );
 
 
+// mmap'ed, multithreaded ; also takes quads, polygons and missing vt/vn
+bool loadOBJ_parallel(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs, 
+	std::vector<glm::vec3> & out_normals
+);
+
 
 bool loadAssImp(
 	const char * path, 
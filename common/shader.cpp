@@ -9,16 +9,152 @@ using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <GL/glew.h>
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+// Program binary cache : linked programs are saved with glGetProgramBinary and
+// reloaded with glProgramBinary on later launches. A cache file is named after a
+// hash of both sources plus the driver's vendor, renderer and version strings,
+// so editing a shader or updating the driver simply misses the cache.
+// Set SHADER_CACHE_DIR to move the cache, or to an empty string to disable it.
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+#define SHADER_CACHE_DEFAULT_DIR "shadercache"
+#define SHADER_CACHE_MAGIC       0x42505347  // "GSPB"
+#define SHADER_CACHE_VERSION     1
+
+struct ProgramCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+static uint64_t HashBytes(uint64_t hash, const char * data, size_t size){
+	// FNV-1a
+	for (size_t i = 0; i < size; i++){
+		hash ^= (unsigned char) data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint64_t HashString(uint64_t hash, const char * s){
+	if (s == NULL)
+		s = "";
+	return HashBytes(hash, s, strlen(s) + 1);   // the terminator keeps "ab"+"c" apart from "a"+"bc"
+}
+
+static bool ProgramCacheEnabled(std::string & dir){
+	if (!GLEW_ARB_get_program_binary && !GLEW_VERSION_4_1)
+		return false;
+
+	GLint NumFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &NumFormats);
+	if (NumFormats <= 0)
+		return false;
+
+	const char * env = getenv("SHADER_CACHE_DIR");
+	dir = env ? env : SHADER_CACHE_DEFAULT_DIR;
+	return !dir.empty();
+}
+
+static uint64_t ProgramCacheKey(const std::string & VertexShaderCode, const std::string & FragmentShaderCode){
+	uint64_t key = 14695981039346656037ULL;
+	key = HashString(key, VertexShaderCode.c_str());
+	key = HashString(key, FragmentShaderCode.c_str());
+	key = HashString(key, (const char *) glGetString(GL_VENDOR));
+	key = HashString(key, (const char *) glGetString(GL_RENDERER));
+	key = HashString(key, (const char *) glGetString(GL_VERSION));
+	return key;
+}
+
+static std::string ProgramCachePath(const std::string & dir, uint64_t key){
+	char name[32];
+	sprintf(name, "/%016llx.bin", (unsigned long long) key);
+	return dir + name;
+}
+
+// Returns 0 if there is no usable cached binary ; a stale or rejected one is removed
+static GLuint LoadCachedProgram(const std::string & path, uint64_t key){
+	FILE * file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+		return 0;
+
+	ProgramCacheHeader header;
+	std::vector<char> binary;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == SHADER_CACHE_MAGIC
+		&& header.version == SHADER_CACHE_VERSION
+		&& header.key == key
+		&& header.length > 0;
+	if (ok){
+		binary.resize(header.length);
+		ok = fread(&binary[0], 1, header.length, file) == header.length;
+	}
+	fclose(file);
+
+	GLuint ProgramID = 0;
+	if (ok){
+		ProgramID = glCreateProgram();
+		glProgramBinary(ProgramID, header.format, &binary[0], header.length);
+
+		GLint Result = GL_FALSE;
+		glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+		if (Result != GL_TRUE){
+			glDeleteProgram(ProgramID);
+			ProgramID = 0;
+		}
+	}
+
+	if (ProgramID == 0){
+		printf("Discarding stale program cache %s\n", path.c_str());
+		unlink(path.c_str());
+	}
+	return ProgramID;
+}
+
+// Written to a temporary file first so concurrent launches never see half a binary
+static void SaveCachedProgram(GLuint ProgramID, const std::string & dir, const std::string & path, uint64_t key){
+	GLint Length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &Length);
+	if (Length <= 0)
+		return;
+
+	std::vector<char> binary(Length);
+	GLenum Format = 0;
+	glGetProgramBinary(ProgramID, Length, &Length, &Format, &binary[0]);
+
+	ProgramCacheHeader header;
+	header.magic = SHADER_CACHE_MAGIC;
+	header.version = SHADER_CACHE_VERSION;
+	header.key = key;
+	header.format = Format;
+	header.length = Length;
+
+	mkdir(dir.c_str(), 0755);
+
+	char suffix[32];
+	sprintf(suffix, ".tmp%d", (int) getpid());
+	std::string temp_path = path + suffix;
+
+	FILE * file = fopen(temp_path.c_str(), "wb");
+	if (file == NULL)
+		return;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(&binary[0], 1, Length, file) == (size_t) Length;
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(temp_path.c_str(), path.c_str()) != 0)
+		unlink(temp_path.c_str());
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
 
 	// Read the Vertex Shader code from the file
 	std::string VertexShaderCode;
@@ -44,6 +180,24 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 		FragmentShaderStream.close();
 	}
 
+	// Try the program binary cache before compiling anything
+	std::string CacheDir, CachePath;
+	uint64_t CacheKey = 0;
+	bool UseCache = ProgramCacheEnabled(CacheDir);
+	if (UseCache){
+		CacheKey = ProgramCacheKey(VertexShaderCode, FragmentShaderCode);
+		CachePath = ProgramCachePath(CacheDir, CacheKey);
+		GLuint CachedProgramID = LoadCachedProgram(CachePath, CacheKey);
+		if (CachedProgramID != 0){
+			printf("Loaded cached program : %s, %s\n", vertex_file_path, fragment_file_path);
+			return CachedProgramID;
+		}
+	}
+
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
@@ -87,6 +241,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (UseCache)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -105,6 +261,9 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	if (UseCache && Result == GL_TRUE)
+		SaveCachedProgram(ProgramID, CacheDir, CachePath, CacheKey);
+
 	return ProgramID;
 }
 
@@ -1,6 +1,22 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
+#include <vector>
+
+// Image read from disk but not yet on the GPU : the file I/O can happen on any
+// thread, and only uploadTexture() needs the GL context
+struct TextureImage {
+	unsigned int width, height;
+	unsigned int format;        // GL_BGR, or one of the S3TC formats
+	unsigned int mipMapCount;
+	bool compressed;
+	std::vector<unsigned char> data;
+};
+
+bool readBMP(const char * imagepath, TextureImage & image);
+bool readDDS(const char * imagepath, TextureImage & image);
+GLuint uploadTexture(const TextureImage & image);
+
 // Load a .BMP file using our custom loader
 GLuint loadBMP_custom(const char * imagepath);
 
@@ -1,142 +1,353 @@
 #include <vector>
-#include <map>
+#include <algorithm>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h> // for memcpy
 
 #include <glm/glm.hpp>
 
 #include "vboindexer.hpp"
 
-#include <string.h> // for memcmp
+// All the entry points share one pipeline :
+// 1. deduplicate (position, uv, normal) with an open-addressing hash table,
+// 2. reorder the triangles for the post-transform vertex cache (Forsyth),
+// 3. renumber the vertices in the order the triangles first use them, so
+//    vertex fetches walk through memory front to back.
+// Vertices are merged when they are bit-for-bit equal (with -0 == +0).
+
+#define EMPTY_SLOT 0xffffffffu
+
+struct PackedVertex{
+	glm::vec3 position;
+	glm::vec2 uv;
+	glm::vec3 normal;
+};
 
+static inline uint32_t floatBits(float f){
+	if (f == 0.0f)
+		f = 0.0f; // -0 hashes and compares like +0
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
 
-// Returns true iif v1 can be considered equal to v2
-bool is_near(float v1, float v2){
-	return fabs( v1-v2 ) < 0.01f;
+static inline void packedBits(const PackedVertex & v, uint32_t bits[8]){
+	bits[0] = floatBits(v.position.x);
+	bits[1] = floatBits(v.position.y);
+	bits[2] = floatBits(v.position.z);
+	bits[3] = floatBits(v.uv.x);
+	bits[4] = floatBits(v.uv.y);
+	bits[5] = floatBits(v.normal.x);
+	bits[6] = floatBits(v.normal.y);
+	bits[7] = floatBits(v.normal.z);
 }
 
-// Searches through all already-exported vertices
-// for a similar one.
-// Similar = same position + same UVs + same normal
-bool getSimilarVertexIndex( 
-	glm::vec3 & in_vertex, 
-	glm::vec2 & in_uv, 
-	glm::vec3 & in_normal, 
-	std::vector<glm::vec3> & out_vertices,
-	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals,
-	unsigned short & result
-){
-	// Lame linear search
-	for ( unsigned int i=0; i<out_vertices.size(); i++ ){
-		if (
-			is_near( in_vertex.x , out_vertices[i].x ) &&
-			is_near( in_vertex.y , out_vertices[i].y ) &&
-			is_near( in_vertex.z , out_vertices[i].z ) &&
-			is_near( in_uv.x     , out_uvs     [i].x ) &&
-			is_near( in_uv.y     , out_uvs     [i].y ) &&
-			is_near( in_normal.x , out_normals [i].x ) &&
-			is_near( in_normal.y , out_normals [i].y ) &&
-			is_near( in_normal.z , out_normals [i].z )
-		){
-			result = i;
-			return true;
-		}
+static inline uint32_t hashBits(const uint32_t bits[8]){
+	uint32_t h = 2166136261u;
+	for (int i=0; i<8; i++){
+		h ^= bits[i];
+		h *= 16777619u;
+		h ^= h >> 15;
 	}
-	// No other vertex could be used instead.
-	// Looks like we'll have to add it to the VBO.
-	return false;
+	return h;
 }
 
-void indexVBO_slow(
+// For every input vertex, the index of its unique vertex ; for every unique
+// vertex, the first input vertex that had it
+static void buildVertexRemap(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
-	std::vector<glm::vec3> & out_vertices,
-	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
+	std::vector<unsigned int> & remap,
+	std::vector<unsigned int> & first
 ){
-	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
-
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
+	size_t count = in_vertices.size();
+
+	size_t table_size = 16;
+	while (table_size < 2 * count)
+		table_size *= 2;
+	std::vector<unsigned int> table(table_size, EMPTY_SLOT);
+	std::vector<uint32_t> unique_bits;   // 8 words per unique vertex
+
+	remap.resize(count);
+	first.clear();
+
+	for ( unsigned int i=0; i<count; i++ ){
+		PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
+		uint32_t bits[8];
+		packedBits(packed, bits);
+
+		// linear probing
+		size_t slot = hashBits(bits) & (table_size - 1);
+		while (table[slot] != EMPTY_SLOT && memcmp(&unique_bits[8 * table[slot]], bits, sizeof(bits)) != 0)
+			slot = (slot + 1) & (table_size - 1);
+
+		if (table[slot] == EMPTY_SLOT){
+			table[slot] = first.size();
+			first.push_back(i);
+			unique_bits.insert(unique_bits.end(), bits, bits + 8);
 		}
+		remap[i] = table[slot];
 	}
 }
 
-struct PackedVertex{
-	glm::vec3 position;
-	glm::vec2 uv;
-	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const{
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))>0;
-	};
-};
+// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation" (2006).
+// Greedily emits the triangle whose vertices score best : recently used
+// vertices score high, and so do vertices with few triangles left, so that
+// the walk doesn't strand lone triangles behind it.
+
+#define FORSYTH_CACHE_SIZE          32
+#define FORSYTH_CACHE_DECAY_POWER   1.5f
+#define FORSYTH_LAST_TRI_SCORE      0.75f
+#define FORSYTH_VALENCE_BOOST_SCALE 2.0f
+#define FORSYTH_VALENCE_BOOST_POWER 0.5f
+#define FORSYTH_MAX_VALENCE         64    // scores for busier vertices are computed, not looked up
+
+static float forsythVertexScore(int cache_position, unsigned int remaining){
+	if (remaining == 0)
+		return -1.0f;   // no triangles left -- never picked
+
+	float score = 0.0f;
+	if (cache_position >= 0){
+		if (cache_position < 3)
+			score = FORSYTH_LAST_TRI_SCORE;   // fixed, so it doesn't matter which of the last triangle's vertices we use
+		else{
+			float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+			score = powf(1.0f - (cache_position - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+		}
+	}
+	score += FORSYTH_VALENCE_BOOST_SCALE * powf((float) remaining, -FORSYTH_VALENCE_BOOST_POWER);
+	return score;
+}
+
+void optimizeVertexCache(std::vector<unsigned int> & indices, unsigned int num_vertices){
+	size_t num_triangles = indices.size() / 3;
+	if (num_triangles == 0)
+		return;
+
+	static float score_table[FORSYTH_CACHE_SIZE + 1][FORSYTH_MAX_VALENCE];
+	static bool have_score_table = false;
+	if (!have_score_table){
+		for (int c=0; c<=FORSYTH_CACHE_SIZE; c++)
+			for (int r=0; r<FORSYTH_MAX_VALENCE; r++)
+				score_table[c][r] = forsythVertexScore(c - 1, r);   // row 0 : not in the cache
+		have_score_table = true;
+	}
+
+	// vertex -> triangles, as offsets into one array
+	std::vector<unsigned int> remaining(num_vertices, 0);
+	for (size_t i=0; i<indices.size(); i++)
+		remaining[indices[i]]++;
+	std::vector<unsigned int> adjacency_offset(num_vertices + 1, 0);
+	for (unsigned int v=0; v<num_vertices; v++)
+		adjacency_offset[v + 1] = adjacency_offset[v] + remaining[v];
+	std::vector<unsigned int> adjacency(indices.size());
+	std::vector<unsigned int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+	for (size_t t=0; t<num_triangles; t++)
+		for (int k=0; k<3; k++)
+			adjacency[fill[indices[3*t+k]]++] = t;
+
+	std::vector<float> vertex_score(num_vertices);
+	for (unsigned int v=0; v<num_vertices; v++)
+		vertex_score[v] = remaining[v] < FORSYTH_MAX_VALENCE ? score_table[0][remaining[v]] : forsythVertexScore(-1, remaining[v]);
+
+	std::vector<float> triangle_score(num_triangles);
+	std::vector<bool> emitted(num_triangles, false);
+	for (size_t t=0; t<num_triangles; t++)
+		triangle_score[t] = vertex_score[indices[3*t]] + vertex_score[indices[3*t+1]] + vertex_score[indices[3*t+2]];
 
-bool getSimilarVertexIndex_fast( 
-	PackedVertex & packed, 
-	std::map<PackedVertex,unsigned short> & VertexToOutIndex,
-	unsigned short & result
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+
+	unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+	int cache_count = 0;
+	size_t scan_cursor = 0;   // for when nothing in the cache has triangles left
+
+	long best = -1;
+	float best_score = -1.0f;
+	for (size_t t=0; t<num_triangles; t++)
+		if (triangle_score[t] > best_score){
+			best_score = triangle_score[t];
+			best = t;
+		}
+
+	while (best >= 0){
+		const unsigned int * tri = &indices[3 * best];
+		emitted[best] = true;
+		output.insert(output.end(), tri, tri + 3);
+
+		// drop the triangle from its vertices' lists
+		for (int k=0; k<3; k++){
+			unsigned int v = tri[k];
+			unsigned int * list = &adjacency[adjacency_offset[v]];
+			for (unsigned int j=0; j<remaining[v]; j++)
+				if (list[j] == (unsigned int) best){
+					list[j] = list[remaining[v] - 1];
+					break;
+				}
+			remaining[v]--;
+		}
+
+		// LRU : the triangle's vertices move to the front
+		unsigned int new_cache[FORSYTH_CACHE_SIZE + 3];
+		int new_count = 0;
+		for (int k=0; k<3; k++)
+			if (k == 0 || (tri[k] != tri[0] && (k == 1 || tri[k] != tri[1])))   // degenerate triangles repeat a vertex
+				new_cache[new_count++] = tri[k];
+		for (int c=0; c<cache_count; c++){
+			unsigned int v = cache[c];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				new_cache[new_count++] = v;
+		}
+		cache_count = std::min(new_count, FORSYTH_CACHE_SIZE);
+		memcpy(cache, new_cache, new_count * sizeof(unsigned int));
+
+		// rescore everything that moved (evicted ones included), then their triangles
+		for (int c=0; c<new_count; c++){
+			unsigned int v = new_cache[c];
+			int position = c < FORSYTH_CACHE_SIZE ? c : -1;
+			vertex_score[v] = remaining[v] < FORSYTH_MAX_VALENCE ? score_table[position + 1][remaining[v]] : forsythVertexScore(position, remaining[v]);
+		}
+
+		best = -1;
+		best_score = -1.0f;
+		for (int c=0; c<new_count; c++){
+			unsigned int v = new_cache[c];
+			const unsigned int * list = &adjacency[adjacency_offset[v]];
+			for (unsigned int j=0; j<remaining[v]; j++){
+				unsigned int t = list[j];
+				float score = vertex_score[indices[3*t]] + vertex_score[indices[3*t+1]] + vertex_score[indices[3*t+2]];
+				triangle_score[t] = score;
+				if (score > best_score){
+					best_score = score;
+					best = t;
+				}
+			}
+		}
+
+		// dead end : carry on from any triangle not emitted yet
+		if (best < 0){
+			while (scan_cursor < num_triangles && emitted[scan_cursor])
+				scan_cursor++;
+			if (scan_cursor < num_triangles)
+				best = scan_cursor;
+		}
+	}
+
+	indices.swap(output);
+}
+
+// Renumber vertices in order of first use ; order[new] = old
+static void optimizeVertexFetch(std::vector<unsigned int> & indices, unsigned int num_vertices, std::vector<unsigned int> & order){
+	std::vector<unsigned int> new_index(num_vertices, EMPTY_SLOT);
+	order.clear();
+	order.reserve(num_vertices);
+
+	for (size_t i=0; i<indices.size(); i++){
+		unsigned int v = indices[i];
+		if (new_index[v] == EMPTY_SLOT){
+			new_index[v] = order.size();
+			order.push_back(v);
+		}
+		indices[i] = new_index[v];
+	}
+}
+
+// Steps 1-3 ; source[new vertex] is the input vertex to copy it from
+static void buildOptimizedIndex(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & indices,
+	std::vector<unsigned int> & remap,
+	std::vector<unsigned int> & source
 ){
-	std::map<PackedVertex,unsigned short>::iterator it = VertexToOutIndex.find(packed);
-	if ( it == VertexToOutIndex.end() ){
-		return false;
-	}else{
-		result = it->second;
-		return true;
+	std::vector<unsigned int> first;
+	buildVertexRemap(in_vertices, in_uvs, in_normals, remap, first);
+
+	indices = remap;
+	optimizeVertexCache(indices, first.size());
+
+	std::vector<unsigned int> order;
+	optimizeVertexFetch(indices, first.size(), order);
+
+	// remap now goes from input vertex to final vertex
+	std::vector<unsigned int> final_index(first.size());
+	source.resize(order.size());
+	for (unsigned int v=0; v<order.size(); v++){
+		final_index[order[v]] = v;
+		source[v] = first[order[v]];
 	}
+	for (size_t i=0; i<remap.size(); i++)
+		remap[i] = final_index[remap[i]];
 }
 
-void indexVBO(
+template <typename IndexType>
+static void indexVBO_hashed(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<IndexType> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
-	std::map<PackedVertex,unsigned short> VertexToOutIndex;
+	std::vector<unsigned int> indices, remap, source;
+	buildOptimizedIndex(in_vertices, in_uvs, in_normals, indices, remap, source);
 
-	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-		PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
-		
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex_fast( packed, VertexToOutIndex, index);
-
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			unsigned short newindex = (unsigned short)out_vertices.size() - 1;
-			out_indices .push_back( newindex );
-			VertexToOutIndex[ packed ] = newindex;
-		}
+	size_t base = out_vertices.size();
+	for ( unsigned int v=0; v<source.size(); v++ ){
+		out_vertices.push_back( in_vertices[source[v]]);
+		out_uvs     .push_back( in_uvs[source[v]]);
+		out_normals .push_back( in_normals[source[v]]);
 	}
+	for ( size_t i=0; i<indices.size(); i++ )
+		out_indices.push_back( (IndexType)(base + indices[i]) );
 }
 
+// Kept for compatibility ; used to be a linear search with a 0.01 tolerance
+void indexVBO_slow(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
 
+	std::vector<unsigned short> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	indexVBO_hashed(in_vertices, in_uvs, in_normals, out_indices, out_vertices, out_uvs, out_normals);
+}
 
+void indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
 
+	std::vector<unsigned short> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	indexVBO_hashed(in_vertices, in_uvs, in_normals, out_indices, out_vertices, out_uvs, out_normals);
+}
 
+void indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
 
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	indexVBO_hashed(in_vertices, in_uvs, in_normals, out_indices, out_vertices, out_uvs, out_normals);
+}
 
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
@@ -152,26 +363,24 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & out_tangents,
 	std::vector<glm::vec3> & out_bitangents
 ){
-	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
-
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-
-			// Average the tangents and the bitangents
-			out_tangents[index] += in_tangents[i];
-			out_bitangents[index] += in_bitangents[i];
-		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			out_tangents .push_back( in_tangents[i]);
-			out_bitangents .push_back( in_bitangents[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
-		}
+	std::vector<unsigned int> indices, remap, source;
+	buildOptimizedIndex(in_vertices, in_uvs, in_normals, indices, remap, source);
+
+	size_t base = out_vertices.size();
+	for ( unsigned int v=0; v<source.size(); v++ ){
+		out_vertices  .push_back( in_vertices[source[v]]);
+		out_uvs       .push_back( in_uvs[source[v]]);
+		out_normals   .push_back( in_normals[source[v]]);
+		out_tangents  .push_back( glm::vec3(0.0f));
+		out_bitangents.push_back( glm::vec3(0.0f));
 	}
+
+	// Average the tangents and the bitangents
+	for ( unsigned int i=0; i<remap.size(); i++ ){
+		out_tangents  [base + remap[i]] += in_tangents[i];
+		out_bitangents[base + remap[i]] += in_bitangents[i];
+	}
+
+	for ( size_t i=0; i<indices.size(); i++ )
+		out_indices.push_back( (unsigned short)(base + indices[i]) );
 }
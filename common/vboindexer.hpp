@@ -12,6 +12,21 @@ void indexVBO(
 	std::vector<glm::vec3> & out_normals
 );
 
+// Same, for meshes with more than 65535 unique vertices
+void indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+// Reorder triangles for the post-transform vertex cache (Forsyth) ; the
+// indexVBO functions already do this, it is exposed for index lists built later
+void optimizeVertexCache(std::vector<unsigned int> & indices, unsigned int num_vertices);
 
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
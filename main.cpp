@@ -43,6 +43,20 @@ using namespace glm;
 
 #include "Flocker.hh"
 #include "Predator.hh"
+#include "Flock_Renderer.hh"
+#include "Flock_Culler.hh"
+#include "Frame_Scheduler.hh"
+#include "Frame_Capture.hh"
+#include "Render_Bench.hh"
+#include "Physics_Bench.hh"
+#include "Physics_Checkpoint.hh"
+#include "Flock_Snapshot.hh"
+#include "Flock_World.hh"
+#include "Flock_Ensemble.hh"
+#include "Trajectory_Recorder.hh"
+#include "Trajectory_Player.hh"
+#include "Sphere_Collider.hh"
+#include "Asset_Loader.hh"
 
 //----------------------------------------------------------------------------
 
@@ -88,15 +102,12 @@ float box_depth =  7.0;
 
 // used for obj files
 
-vector<glm::vec3> obj_vertices;
-vector<glm::vec2> obj_uvs;
-vector<glm::vec3> obj_normals;
+MeshCache obj_mesh;
+float obj_scale = 1.0;                   // applied in the Model matrix, not to the mesh
+GLsizei obj_num_indices;
+GLenum obj_index_type;
 GLuint obj_Texture;
 GLuint pred_Texture;
-vector<unsigned short> obj_indices;
-vector<glm::vec3> obj_indexed_vertices;
-vector<glm::vec2> obj_indexed_uvs;
-vector<glm::vec3> obj_indexed_normals;
 GLuint obj_vertexbuffer;
 GLuint obj_uvbuffer;
 GLuint obj_normalbuffer;
@@ -111,10 +122,38 @@ glm::mat4 ViewMat;
 
 double target_FPS = 60.0;
 
+Frame_Scheduler frame_scheduler(target_FPS);
+
+// offscreen rendering / frame capture options
+
+bool is_headless = false;
+const char *capture_dir = NULL;
+const char *capture_encoder = NULL;
+int max_frames = 0;                      // 0 -> run until the window is closed
+const char *bench_render_file = NULL;    // render benchmark results (JSON)
+const char *bench_physics_file = NULL;   // physics benchmark results (JSON)
+const char *physics_checkpoint_file = PHYSICS_CHECKPOINT_FILE;
+bool is_restoring_checkpoint = false;    // start in physics mode from physics_checkpoint_file
+const char *flock_snapshot_file = FLOCK_SNAPSHOT_FILE;
+bool is_restoring_flock = false;         // start from flock_snapshot_file instead of a random flock
+double autosave_interval = 0.0;          // seconds between background flock snapshots (0 -> none)
+const char *trajectory_file = NULL;      // record every step here
+Trajectory_Recorder *trajectory_recorder = NULL;
+const char *replay_file = NULL;          // play a recording back instead of simulating
+Trajectory_Player *trajectory_player = NULL;
+const char *ensemble_file = NULL;        // run an ensemble of small worlds (JSON results) instead
+int ensemble_num_worlds = ENSEMBLE_NUM_WORLDS;
+int ensemble_grid_size = 0;              // > 0 -> grid sweep instead of random
+
+Frame_Capture *frame_capture = NULL;
+
 bool using_obj_program = false;
 
 bool is_paused = false;
 bool is_physics_active = false;
+bool use_sphere_collider = false;        // physics mode uses the sphere collider instead of Bullet
+
+Sphere_Collider sphere_collider;
 
 double orbit_cam_radius = DEFAULT_ORBIT_CAM_RADIUS;
 double orbit_cam_delta_radius = 0.1;
@@ -134,10 +173,13 @@ int num_predators = 1;
 
 extern int flocker_history_length;
 extern int flocker_draw_mode;
-extern vector <Flocker *> flocker_array;
-extern vector <Predator *> predator_array;
-extern vector <vector <double> > flocker_squared_distance;
-extern vector <vector <double> > p_to_f_squared_distance;
+extern vector <Flocker *> & flocker_array;
+extern vector <Predator *> & predator_array;
+extern float obj_lod_pixel_error;
+extern bool is_bullet_multithreaded;
+extern bool is_hybrid_active;
+extern int bullet_broadphase_type;
+extern bool is_bullet_sleep_enabled;
 
 GLuint box_vertexbuffer;
 GLuint box_colorbuffer;
@@ -146,17 +188,35 @@ GLuint box_colorbuffer;
 
 void end_program()
 {
+  frame_scheduler.print_stats();
+
+  // flush any frames still on their way to disk
+
+  if (frame_capture)
+    delete frame_capture;
+  if (trajectory_recorder)
+    delete trajectory_recorder;
+  if (trajectory_player)
+    delete trajectory_player;
+  finish_flock_snapshots();
+  finish_flock_autosave();
+
   // Cleanup VBOs and shader
 
   glDeleteBuffers(1, &box_vertexbuffer);
   glDeleteBuffers(1, &box_colorbuffer);
   glDeleteProgram(programID);
   glDeleteProgram(objprogramID);
+  delete_flock_renderer();
+  delete_bullet_simulator();
+  finish_loading_assets();
+  unloadMesh(obj_mesh);
   glDeleteVertexArrays(1, &VertexArrayID);
   
   // Close OpenGL window and terminate GLFW
 
   glfwTerminate();
+  delete_headless_context();
 
   exit(1);
 }
@@ -223,6 +283,37 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
   else if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
     is_paused = !is_paused;
 
+  // frame timing
+
+  else if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+    frame_scheduler.print_stats();
+    if (trajectory_player)
+      trajectory_player->print_status();
+    else if (is_physics_active && !use_sphere_collider)
+      print_bullet_stats();
+  }
+
+  // replay: seek, speed, direction
+
+  else if (trajectory_player && key == GLFW_KEY_LEFT && (action == GLFW_PRESS || action == GLFW_REPEAT))
+    trajectory_player->scrub(-1);
+  else if (trajectory_player && key == GLFW_KEY_RIGHT && (action == GLFW_PRESS || action == GLFW_REPEAT))
+    trajectory_player->scrub(1);
+  else if (trajectory_player && key == GLFW_KEY_UP && action == GLFW_PRESS)
+    trajectory_player->change_speed(2.0);
+  else if (trajectory_player && key == GLFW_KEY_DOWN && action == GLFW_PRESS)
+    trajectory_player->change_speed(0.5);
+  else if (trajectory_player && key == GLFW_KEY_BACKSPACE && action == GLFW_PRESS)
+    trajectory_player->reverse();
+  else if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+    is_culling_enabled = !is_culling_enabled;
+    printf("frustum culling %s\n", is_culling_enabled ? "on" : "off");
+  }
+  else if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+    frame_scheduler.use_vsync = !frame_scheduler.use_vsync;
+    glfwSwapInterval(frame_scheduler.use_vsync ? 1 : 0);
+  }
+
 
   // toggle physics/flocking dynamics modes
   
@@ -233,19 +324,42 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     
     if (is_physics_active) {
 
-      copy_flocker_states_to_graphics_objects();
-      initialize_bullet_simulator();
-
+      if (use_sphere_collider)
+	sphere_collider.reset(box_width, box_height, box_depth, glm::vec3(0, -9.81f, 0));
+      else {
+	require_obj_mesh();      // hull
+	reset_bullet_simulator();
+      }
     }
 
-    // stop physics simulator
-    
-    else {
+    // stop physics simulator -- the world and its bodies wait for the next time
+  }
 
-      delete_bullet_simulator();
+  // save the Bullet world / jump back to the saved one (starting physics if need be)
 
+  else if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+    if (is_physics_active && !use_sphere_collider)
+      save_physics_checkpoint(physics_checkpoint_file);
+  }
+  else if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+    if (!use_sphere_collider) {
+      require_obj_mesh();      // hull
+      if (restore_physics_checkpoint(physics_checkpoint_file))
+	is_physics_active = true;
     }
   }
+
+  // save the whole flock (written in the background)
+
+  else if (key == GLFW_KEY_N && action == GLFW_PRESS)
+    save_flock_snapshot(flock_snapshot_file);
+
+  // flocking forces inside physics: creatures flock and collide at once
+
+  else if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+    set_bullet_hybrid(!is_hybrid_active);
+    printf("hybrid flocking + physics %s\n", is_hybrid_active ? "on" : "off");
+  }
   
   // orbit rotate
 
@@ -284,6 +398,7 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
   // flocker drawing options
   // Draws Arrow
   else if (key == GLFW_KEY_7 && action == GLFW_PRESS) {
+    require_obj_assets();
     flocker_draw_mode = DRAW_MODE_OBJ;
     using_obj_program = true;
   }
@@ -299,6 +414,28 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     flocker_draw_mode = DRAW_MODE_HISTORY;
     using_obj_program = false;
   }
+  else if (key == GLFW_KEY_6 && action == GLFW_PRESS) {
+    flocker_draw_mode = DRAW_MODE_POINTS;
+    using_obj_program = false;
+  }
+  else if (key == GLFW_KEY_5 && action == GLFW_PRESS) {
+    flocker_draw_mode = DRAW_MODE_DENSITY;
+    using_obj_program = false;
+  }
+}
+
+//----------------------------------------------------------------------------
+
+// the app's creatures -- random weights, from drand48, in flock_world's box
+
+Flocker *new_random_flocker(int i)
+{
+  return flock_world.new_flocker(i, NULL, flocker_history_length);
+}
+
+Predator *new_random_predator(int i)
+{
+  return flock_world.new_predator(i, NULL, flocker_history_length);
 }
 
 //----------------------------------------------------------------------------
@@ -377,39 +514,21 @@ void initialize_flocking_simulation()
 
   //  initialize_random();
 
-  flocker_squared_distance.resize(num_flockers);
-  flocker_array.clear();
-  p_to_f_squared_distance.resize(num_predators);
-  predator_array.clear();
-
-  for (int i = 0; i < num_flockers; i++) {
-    flocker_array.push_back(new Flocker(i, 
-					  uniform_random(0, box_width), uniform_random(0, box_height), uniform_random(0, box_depth),
-					  uniform_random(-0.01, 0.01), uniform_random(-0.01, 0.01), uniform_random(-0.01, 0.01),
-					  0.002,            // randomness
-					  0.05, 0.5, uniform_random(0.01, 0.03),  // min, max separation distance, weight
-					  0.5,  1.0, uniform_random(0.0005, 0.002), // min, max alignment distance, weight
-					  1.0,  1.5, uniform_random(0.0005, 0.002), // min, max cohesion distance, weight
-                      0.0,  1.0, uniform_random(0.0005, 0.4), // min, max fear distance, weight
-					//					  0.05, 0.5, 0.02,  // min, max separation distance, weight
-					//					  0.5,  1.0, 0.001, // min, max alignment distance, weight
-					//					  1.0,  1.5, 0.001, // min, max cohesion distance, weight
-					  1.0,  1.0, 1.0,
-					  flocker_history_length));
-
-    flocker_squared_distance[i].resize(num_flockers);
-    
-  }
-  for (int i = 0; i < num_predators; i++) {
-    predator_array.push_back(new Predator(i,
-					  uniform_random(0, box_width), uniform_random(0, box_height), uniform_random(0, box_depth),
-					  uniform_random(-0.01, 0.01), uniform_random(-0.01, 0.01), uniform_random(-0.01, 0.01),
-                      0.1,  1.5, uniform_random(0.005, 0.02), // min, max hunger distance, weight
-					  1.0,  1.0, 1.0,
-					  flocker_history_length));
+  flock_world.box_size = glm::vec3(box_width, box_height, box_depth);
 
-    p_to_f_squared_distance[i].resize(num_flockers);
+  if (is_restoring_flock) {
+    if (!restore_flock_snapshot(flock_snapshot_file))
+      exit(1);
+    return;
   }
+
+  flock_world.clear();
+
+  for (int i = 0; i < num_flockers; i++)
+    flock_world.add_flocker(new_random_flocker(i));
+  for (int i = 0; i < num_predators; i++)
+    flock_world.add_predator(new_random_predator(i));
+  flock_world.resize_distance_tables();
 }
 
 //----------------------------------------------------------------------------
@@ -418,28 +537,63 @@ void initialize_flocking_simulation()
 
 void update_flocking_simulation()
 {
-  int i;
+  flock_world.step();
+}
 
-  // precalculate inter-flocker distances
+//----------------------------------------------------------------------------
 
-  calculate_flocker_squared_distances();
-  calculate_p_to_f_squared_distances();
+// draw every creature in the current draw mode.  whole-flock modes take care of
+// their own shader; the per-creature modes use whichever program is current
 
-  // get new_position, new_velocity for each flocker
+void draw_creatures(glm::mat4 M)
+{
+  if (flocker_draw_mode == DRAW_MODE_DENSITY) {
+    draw_flock_density(M);
+    return;
+  }
 
-  for (i = 0; i < flocker_array.size(); i++) 
-    flocker_array[i]->update();
-    
-  for (i = 0; i < predator_array.size(); i++)
-    predator_array[i]->update();
+  // only creatures that can be on screen go any further
 
-  // handle wrapping and make new position, velocity into current
+  double t_cull = get_monotonic_time();
 
-  for (i = 0; i < flocker_array.size(); i++) 
-    flocker_array[i]->finalize_update(box_width, box_height, box_depth);
-    
-  for (i = 0; i < predator_array.size(); i++)
-    predator_array[i]->finalize_update(box_width, box_height, box_depth);
+  cull_creatures(ProjectionMat * ViewMat * M, flocker_draw_mode);
+  frame_scheduler.record_culling(visible_creatures.size(), num_culled_creatures);
+
+  render_counters.cull_time += get_monotonic_time() - t_cull;
+
+  if (flocker_draw_mode == DRAW_MODE_POINTS) {
+    draw_flock_points(M);
+    return;
+  }
+  else if (flocker_draw_mode == DRAW_MODE_OBJ) {
+
+    // instanced, with a level of detail per creature -- all of it counts as flocker time
+
+    double t_start = get_monotonic_time();
+    draw_flock_obj(M);
+    render_counters.flocker_draw_time += get_monotonic_time() - t_start;
+    return;
+  }
+
+  if (using_obj_program)
+    glUseProgram(objprogramID);
+  else
+    glUseProgram(programID);
+
+  // time spent issuing the draws is tallied for the render benchmark
+
+  double t_start = get_monotonic_time();
+
+  for (int i = 0; i < num_visible_flockers; i++) 
+    flocker_array[visible_creatures[i]]->draw(M);
+
+  double t_flockers = get_monotonic_time();
+
+  for (int i = num_visible_flockers; i < visible_creatures.size(); i++)
+    predator_array[visible_creatures[i] - flocker_array.size()]->draw(M);
+
+  render_counters.flocker_draw_time += t_flockers - t_start;
+  render_counters.predator_draw_time += get_monotonic_time() - t_flockers;
 }
 
 //----------------------------------------------------------------------------
@@ -474,65 +628,80 @@ void setup_camera()
 
 //----------------------------------------------------------------------------
 
-// no error-checking -- you have been warned...
+// pull "--option [value]" arguments out of argv so that the positional ones
+// (object name, bullet demo) mean the same thing they always did
 
-void load_objects_and_textures(int argc, char **argv)
+void parse_options(int & argc, char **argv)
 {
-  if (argc == 1) {
-    loadOBJ("cube.obj", obj_vertices, obj_uvs, obj_normals);
-    obj_Texture = loadDDS("uvmap.DDS");
-    pred_Texture = loadDDS("inverse.DDS");
-  }
-  else if (!strcmp("cube", argv[1])) {
-    loadOBJ("cube.obj", obj_vertices, obj_uvs, obj_normals);
-    obj_Texture = loadDDS("uvmap.DDS");
-    pred_Texture = loadDDS("inverse.DDS");
-  }
-  else if (!strcmp("suzanne", argv[1])) {
-    loadOBJ("suzanne.obj", obj_vertices, obj_uvs, obj_normals);
-    obj_Texture = loadDDS("uvmap.DDS");
-    pred_Texture = loadDDS("inverse.DDS");
-  }
-  else if (!strcmp("banana", argv[1])) {
-    loadOBJ("banana.obj", obj_vertices, obj_uvs, obj_normals);
-    obj_Texture = loadBMP_custom("banana.bmp");
-    pred_Texture = loadDDS("inverse.DDS");
-  }
-  else {
-    printf("unsupported object\n");
-    exit(1);
-  }
-
-  // if not doing bullet demo, scale down objects to creature size -- kind of eye-balled this
-
-  if (argc < 3) {
-    for (int i = 0; i < obj_vertices.size(); i++) {
-      obj_vertices[i].x *= 0.15;
-      obj_vertices[i].y *= 0.15;
-      obj_vertices[i].z *= 0.15;
+  int n = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--headless"))
+      is_headless = true;
+    else if (!strcmp(argv[i], "--capture") && i + 1 < argc)
+      capture_dir = argv[++i];
+    else if (!strcmp(argv[i], "--encoder") && i + 1 < argc)
+      capture_encoder = argv[++i];
+    else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+      max_frames = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--no-cull"))
+      is_culling_enabled = false;
+    else if (!strcmp(argv[i], "--lod-error") && i + 1 < argc)
+      obj_lod_pixel_error = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--bench-render") && i + 1 < argc) {
+      bench_render_file = argv[++i];
+      is_headless = true;
+    }
+    else if (!strcmp(argv[i], "--physics-mt"))
+      is_bullet_multithreaded = true;
+    else if (!strcmp(argv[i], "--hybrid"))
+      is_hybrid_active = true;
+    else if (!strcmp(argv[i], "--spheres"))
+      use_sphere_collider = true;
+    else if (!strcmp(argv[i], "--no-sleep"))
+      is_bullet_sleep_enabled = false;
+    else if (!strcmp(argv[i], "--broadphase") && i + 1 < argc) {
+      bullet_broadphase_type = parse_broadphase(argv[++i]);
+      if (bullet_broadphase_type < 0) {
+	printf("unknown broadphase %s -- dbvt, sap or sap32\n", argv[i]);
+	exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--flock") && i + 1 < argc) {
+      flock_snapshot_file = argv[++i];
+      is_restoring_flock = true;
+    }
+    else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+      trajectory_file = argv[++i];
+    else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+      replay_file = argv[++i];
+    else if (!strcmp(argv[i], "--ensemble") && i + 1 < argc)
+      ensemble_file = argv[++i];
+    else if (!strcmp(argv[i], "--ensemble-worlds") && i + 1 < argc)
+      ensemble_num_worlds = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--ensemble-grid") && i + 1 < argc)
+      ensemble_grid_size = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--autosave") && i + 1 < argc)
+      autosave_interval = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc)
+      physics_checkpoint_file = argv[++i];
+    else if (!strcmp(argv[i], "--restore") && i + 1 < argc) {
+      physics_checkpoint_file = argv[++i];
+      is_restoring_checkpoint = true;
+    }
+    else if (!strcmp(argv[i], "--bench-physics") && i + 1 < argc) {
+      bench_physics_file = argv[++i];
+      is_headless = true;
+    }
+    else if (!strncmp(argv[i], "--", 2)) {
+      printf("unknown or incomplete option %s\n", argv[i]);
+      exit(1);
     }
+    else
+      argv[n++] = argv[i];
   }
 
-  indexVBO(obj_vertices, obj_uvs, obj_normals, obj_indices, obj_indexed_vertices, obj_indexed_uvs, obj_indexed_normals);
-
-  // Load into array buffers
-  
-  glGenBuffers(1, &obj_vertexbuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, obj_vertexbuffer);
-  glBufferData(GL_ARRAY_BUFFER, obj_indexed_vertices.size() * sizeof(glm::vec3), &obj_indexed_vertices[0], GL_STATIC_DRAW);
-  
-  glGenBuffers(1, &obj_uvbuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, obj_uvbuffer);
-  glBufferData(GL_ARRAY_BUFFER, obj_indexed_uvs.size() * sizeof(glm::vec2), &obj_indexed_uvs[0], GL_STATIC_DRAW);
-  
-  glGenBuffers(1, &obj_normalbuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, obj_normalbuffer);
-  glBufferData(GL_ARRAY_BUFFER, obj_indexed_normals.size() * sizeof(glm::vec3), &obj_indexed_normals[0], GL_STATIC_DRAW);
-  
-  // Generate a buffer for the indices as well
-  glGenBuffers(1, &obj_elementbuffer);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj_elementbuffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj_indices.size() * sizeof(unsigned short), &obj_indices[0] , GL_STATIC_DRAW);
+  argc = n;
 }
 
 //----------------------------------------------------------------------------
@@ -540,42 +709,97 @@ void load_objects_and_textures(int argc, char **argv)
 
 int main(int argc, char **argv)
 {  
-  // Initialise GLFW
+  double launch_time = get_monotonic_time();
 
-  if( !glfwInit() )
-    {
-      fprintf( stderr, "Failed to initialize GLFW\n" );
-      getchar();
+  parse_options(argc, argv);
+
+  // no window, no GL -- just the worker pool full of little flocks
+
+  if (ensemble_file) {
+    run_flock_ensemble(ensemble_file, ensemble_num_worlds, ensemble_grid_size);
+    return 0;
+  }
+
+  // start reading the object and its textures on the worker pool -- nothing
+  // waits on them until a draw mode (or physics) needs them
+
+  start_loading_assets(argc, argv);
+
+  if (is_headless) {
+
+    // no window: EGL context, everything drawn into frame_capture's FBO
+    
+    if (argc == 3) {
+      printf("bullet demo needs a window\n");
       return -1;
     }
+    if (!create_headless_context())
+      return -1;
+  }
+  else {
+
+    // Initialise GLFW
+
+    if( !glfwInit() )
+      {
+	fprintf( stderr, "Failed to initialize GLFW\n" );
+	getchar();
+	return -1;
+      }
   
-  glfwWindowHint(GLFW_SAMPLES, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); //We don't want the old OpenGL 
+    // captured frames are blitted into the window, which GL only allows
+    // into a single-sampled one
+
+    if (!capture_dir && !capture_encoder)
+      glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); //We don't want the old OpenGL 
   
-  // Open a window and create its OpenGL context
+    // Open a window and create its OpenGL context
 
-  window = glfwCreateWindow(win_w, win_h, "creatures", NULL, NULL);
-  if( window == NULL ){
-    fprintf( stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n" );
-    getchar();
-    glfwTerminate();
-    return -1;
+    window = glfwCreateWindow(win_w, win_h, "creatures", NULL, NULL);
+    if( window == NULL ){
+      fprintf( stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n" );
+      getchar();
+      glfwTerminate();
+      return -1;
+    }
+    glfwMakeContextCurrent(window);
+
+    // frame_scheduler does the pacing unless vsync is switched on
+
+    glfwSwapInterval(0);
   }
-  glfwMakeContextCurrent(window);
   
   // Initialize GLEW
 
   glewExperimental = true; // Needed for core profile
-  if (glewInit() != GLEW_OK) {
+  GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  if (is_headless && glew_status == GLEW_ERROR_NO_GLX_DISPLAY)   // GLX-flavored GLEW on an EGL context -- GL entry points are still fine
+    glew_status = GLEW_OK;
+#endif
+  if (glew_status != GLEW_OK) {
     fprintf(stderr, "Failed to initialize GLEW\n");
-    getchar();
+    if (!is_headless)
+      getchar();
     glfwTerminate();
     return -1;
   }
 
+  // offscreen target: always when headless, otherwise only when capturing
+
+  if (is_headless || capture_dir || capture_encoder) {
+    frame_capture = new Frame_Capture(win_w, win_h, capture_dir, capture_encoder);
+
+    // offline capture runs as fast as it can
+    
+    frame_scheduler.is_free_running = is_headless;
+    frame_scheduler.can_skip_renders = false;
+  }
+
   // background color, depth testing
 
   glClearColor(0.0f, 0.0f, 0.1f, 0.0f);
@@ -590,13 +814,13 @@ int main(int argc, char **argv)
 
   // Create and compile our GLSL program from the shaders
 
-  // obj rendering mode uses shaders that came with bullet demo program
+  // all rendering modes but OBJ, whose program is loaded along with the object
 
-  objprogramID = LoadShaders( "StandardShading.vertexshader", "StandardShading.fragmentshader" );
+  programID = LoadShaders( "Creatures.vertexshader", "Creatures.fragmentshader" );
 
-  // all other rendering modes
+  // point sprite and density modes
 
-  programID = LoadShaders( "Creatures.vertexshader", "Creatures.fragmentshader" );
+  initialize_flock_renderer();
 
   // Get handles for our uniform variables
 
@@ -604,102 +828,155 @@ int main(int argc, char **argv)
   ViewMatrixID = glGetUniformLocation(programID, "V");
   ModelMatrixID = glGetUniformLocation(programID, "M");
 
-  objMatrixID = glGetUniformLocation(objprogramID, "MVP");
-  objViewMatrixID = glGetUniformLocation(objprogramID, "V");
-  objModelMatrixID = glGetUniformLocation(objprogramID, "M");
-
-  objTextureID  = glGetUniformLocation(objprogramID, "myTextureSampler");
-  objLightID = glGetUniformLocation(objprogramID, "LightPosition_worldspace");
-
   // Use our shader
 
   glUseProgram(programID);
 
   // register all callbacks
-  
-  glfwSetKeyCallback(window, key_callback);
 
-  // objects, textures
-  
-  load_objects_and_textures(argc, argv);
+  if (window)
+    glfwSetKeyCallback(window, key_callback);
 
   // simulation
 
   initialize_random();
+
+  // a replay's flock and box come from the recording
+
+  if (replay_file) {
+    trajectory_player = new Trajectory_Player(replay_file);
+    num_flockers = trajectory_player->header.num_flockers;
+    num_predators = trajectory_player->header.num_creatures - trajectory_player->header.num_flockers;
+    box_width = trajectory_player->header.box_size[0];
+    box_height = trajectory_player->header.box_size[1];
+    box_depth = trajectory_player->header.box_size[2];
+    is_restoring_flock = false;
+  }
+
   initialize_flocking_simulation();
 
+  // sweep draw modes and flock sizes (and/or physics worlds and thread counts)
+  // instead of running the simulation
+
+  if (bench_render_file || bench_physics_file) {
+    if (bench_render_file)
+      run_render_benchmark(bench_render_file);
+    if (bench_physics_file)
+      run_physics_benchmark(bench_physics_file);
+    end_program();
+  }
+
+  // pick up a saved physics scene
+
+  if (is_restoring_checkpoint) {
+    require_obj_mesh();      // hull
+    if (!restore_physics_checkpoint(physics_checkpoint_file))
+      exit(1);
+    is_physics_active = true;
+  }
+
   // run a whole different program if bullet demo option selected
   
   if (argc == 3) { 
+    require_obj_assets();
     bullet_hello_main(argc, argv);
     return 1;
   }
   
   // timing stuff
 
-  double currentTime, lastTime;
   double target_period = 1.0 / target_FPS;
-  
-  lastTime = glfwGetTime();
+
+  frame_scheduler.set_target_fps(target_FPS);
+
+  if (autosave_interval > 0.0)
+    start_flock_autosave(FLOCK_AUTOSAVE_FILE, autosave_interval);
+
+  if (trajectory_file)
+    trajectory_recorder = new Trajectory_Recorder(trajectory_file, num_flockers + num_predators, num_flockers,
+						  glm::vec3(box_width, box_height, box_depth));
 
   // enter simulate-render loop (with event handling)
   
   do {
 
+    frame_scheduler.begin_frame();
+
     // STEP THE SIMULATION -- EITHER FLOCKING OR PHYSICS
 
-    if (!is_paused) {
+    if (trajectory_player)
+      trajectory_player->advance(!is_paused);
+    else if (!is_paused) {
       if (!is_physics_active)
 	update_flocking_simulation();
+      else if (use_sphere_collider)
+	sphere_collider.step(target_period);
       else
 	update_physics_simulation(target_period);
 
+      if (trajectory_recorder)
+	trajectory_recorder->record_frame();
     }
+
+    update_flock_autosave();
+
+    frame_scheduler.end_simulation();
     
-    // RENDER IT
+    // RENDER IT -- unless the scheduler says we are too far behind to afford it
 
-    // Clear the screen
+    bool is_rendering = frame_scheduler.should_render();
 
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-    // set model transform and color for each triangle and draw it offscreen
+    if (is_rendering) {
 
-    setup_camera();
+      // Clear the screen
 
-    // a centering translation for viewing
+      if (frame_capture)
+	frame_capture->begin_frame();
 
-    glm::mat4 M = glm::translate(glm::vec3(-0.5f * box_width, -0.5f * box_height, -0.5f * box_depth));
+      glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // draw box and creatures
+      // set model transform and color for each triangle and draw it offscreen
 
-    glUseProgram(programID);
-    draw_box(M);
+      setup_camera();
+
+      // a centering translation for viewing
+
+      glm::mat4 M = glm::translate(glm::vec3(-0.5f * box_width, -0.5f * box_height, -0.5f * box_depth));
+
+      // draw box and creatures
 
-    if (using_obj_program)
-      glUseProgram(objprogramID);
-    else
       glUseProgram(programID);
+      draw_box(M);
+
+      draw_creatures(M);
+
+      // queue readback of this frame (and show it, if there's a window)
 
-    for (int i = 0; i < flocker_array.size(); i++) 
-      flocker_array[i]->draw(M);
-      
-    for (int i = 0; i < predator_array.size(); i++)
-      predator_array[i]->draw(M);
+      if (frame_capture)
+	frame_capture->end_frame(window != NULL);
 
-    // busy wait if we are going too fast
+      frame_scheduler.end_render();
+    }
 
-    do {
-      currentTime = glfwGetTime();
-    } while (currentTime - lastTime < target_period);
+    // sleep if we are going too fast -- the worker pool has the core meanwhile
 
-    lastTime = currentTime;
+    frame_scheduler.wait_for_deadline();
 
     // Swap buffers
 
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+    if (window) {
+      if (is_rendering)
+	glfwSwapBuffers(window);
+      glfwPollEvents();
+    }
+
+    if (frame_scheduler.total_frames == 1)
+      printf("first frame %.1f ms after launch\n", 1000.0 * (get_monotonic_time() - launch_time));
+
+    if (max_frames > 0 && frame_scheduler.total_frames >= max_frames)
+      break;
 
-  } while ( glfwWindowShouldClose(window) == 0 );
+  } while ( window == NULL || glfwWindowShouldClose(window) == 0 );
   
   end_program();
   